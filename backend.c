@@ -11,6 +11,25 @@
 // We include our own "backend.h" to get the function declarations and the FileInfo struct.
 // This ensures our implementation matches the "contract" we defined in the header.
 #include "backend.h"
+// The shared directory walker used by copy, delete and zip.
+#include "treewalk.h"
+// The checkpoint journal behind resumable copies.
+#include "copyjournal.h"
+// The parallel tree delete.
+#include "rmtree.h"
+// Block-level updates of big changed files during a sync.
+#include "delta.h"
+// The checksum used to verify copies.
+#include "checksum.h"
+// Copying huge files without going through the page cache.
+#include "directio.h"
+// Moves that never replace an existing item.
+#include "saferename.h"
+// Writing zip archives with all CPU cores.
+#include "zipwriter.h"
+#include "zipreader.h"
+// Our tar.zst / tar.xz archives.
+#include "tarball.h"
 // We include all the standard C library headers that give us access to the system calls we need.
 #include <stdio.h>
 #include <stdlib.h>
@@ -19,10 +38,14 @@
 #include <dirent.h>     // Provides opendir(), readdir(), and closedir() for directory traversal.
 #include <time.h>
 #include <unistd.h>
-#include <ftw.h>        // Provides nftw() for advanced file tree walking (used for recursive delete).
-#include <fcntl.h>      // Provides open() and flags for file control (O_CREAT, O_RDONLY, etc.).
+#include <fcntl.h>      // Provides open(), openat() and flags for file control (O_CREAT, O_RDONLY, etc.).
 #include <errno.h>
-#include <zip.h>        // The header for the external libzip library we use for compression.
+
+// macOS calls the nanosecond timestamp fields by a different name.
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#define st_atim st_atimespec
+#endif
 
 // --- Helper Functions ---
 
@@ -59,6 +82,179 @@ void free_file_info(gpointer data) {
  */
 void free_favourite_location(gpointer data) { g_free(data); }
 
+// --- Progress Reporting ---
+
+void op_progress_init(OpProgress *progress) {
+    memset(progress, 0, sizeof(*progress));
+    g_mutex_init(&progress->lock);
+}
+
+void op_progress_clear(OpProgress *progress) {
+    g_mutex_clear(&progress->lock);
+}
+
+void op_progress_add(OpProgress *progress, guint64 bytes, guint files) {
+    if (!progress) return;
+    g_mutex_lock(&progress->lock);
+    progress->bytes_done += bytes;
+    progress->files_done += files;
+    g_mutex_unlock(&progress->lock);
+}
+
+void op_progress_take_back(OpProgress *progress, guint64 bytes) {
+    if (!progress) return;
+    g_mutex_lock(&progress->lock);
+    progress->bytes_done -= MIN(bytes, progress->bytes_done);
+    g_mutex_unlock(&progress->lock);
+}
+
+void op_progress_cancel(OpProgress *progress) {
+    if (progress) g_atomic_int_set(&progress->cancelled, TRUE);
+}
+
+gboolean op_progress_is_cancelled(OpProgress *progress) {
+    return progress && g_atomic_int_get(&progress->cancelled);
+}
+
+/**
+ * @brief The tree-walk callback behind measure_item(): counts every item and adds up file sizes.
+ */
+static TreeWalkResult measure_cb(TreeWalkEntry *e, gpointer user_data) {
+    OpProgress *progress = user_data;
+    if (e->event == TREE_WALK_DIR_POST) return TREE_WALK_CONTINUE;
+    if (op_progress_is_cancelled(progress)) return TREE_WALK_STOP;
+    g_mutex_lock(&progress->lock);
+    progress->files_total++;
+    if (S_ISREG(e->st.st_mode)) progress->bytes_total += e->st.st_size;
+    g_mutex_unlock(&progress->lock);
+    return TREE_WALK_CONTINUE;
+}
+
+void measure_item(const gchar *path, OpProgress *progress) {
+    if (progress) tree_walk(path, measure_cb, progress);
+}
+
+// --- Browsing Zip Archives ---
+
+// The archive that was browsed last. Opening an archive means reading its whole table of
+// contents, so it is kept while the user moves between its folders. Only the UI thread
+// lists folders, so this needs no lock.
+static struct {
+    gchar *path;
+    time_t mtime;
+    off_t size;
+    ZipIndex *index;
+} archive_cache;
+
+gboolean is_browsable_archive(const gchar *path) {
+    struct stat st;
+    gchar *lower = g_ascii_strdown(path, -1);
+    gboolean is_zip = g_str_has_suffix(lower, ".zip");
+    g_free(lower);
+    return is_zip && stat(path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+/**
+ * @brief Finds the archive a path like "/home/me/a.zip/docs/b.txt" points into.
+ * @param inner Set to where the path inside the archive starts in `path` ("/docs/b.txt").
+ * @return The archive's index (owned by the cache), or NULL if `path` is not inside an archive.
+ */
+static ZipIndex* archive_for_path(const gchar *path, const gchar **inner) {
+    // The longest part of the path that exists on disk has to be the archive itself.
+    gchar *archive = g_strdup(path);
+    struct stat st;
+    while (stat(archive, &st) != 0) {
+        gchar *parent = g_path_get_dirname(archive);
+        gboolean at_top = (strcmp(parent, archive) == 0);
+        g_free(archive);
+        archive = parent;
+        if (at_top) break;
+    }
+    ZipIndex *index = NULL;
+    if (S_ISREG(st.st_mode) && is_browsable_archive(archive)) {
+        if (!archive_cache.path || strcmp(archive_cache.path, archive) != 0
+            || archive_cache.mtime != st.st_mtime || archive_cache.size != st.st_size) {
+            // A different archive, or the same one changed on disk since it was read.
+            zip_index_free(archive_cache.index);
+            g_free(archive_cache.path);
+            archive_cache.index = zip_index_open(archive);
+            archive_cache.path = g_strdup(archive);
+            archive_cache.mtime = st.st_mtime;
+            archive_cache.size = st.st_size;
+        }
+        index = archive_cache.index;
+        *inner = path + strlen(archive);
+    }
+    g_free(archive);
+    return index;
+}
+
+/**
+ * @brief Lists a folder inside a zip archive, in the same form as get_directory_contents().
+ * Only the archive's table of contents is read, so this is quick even for huge archives.
+ */
+static GList* get_archive_contents(const gchar *path) {
+    const gchar *inner;
+    ZipIndex *index = archive_for_path(path, &inner);
+    GPtrArray *items = index ? zip_index_list(index, inner) : NULL;
+    if (!items) return NULL;
+    GList *list = NULL;
+    for (guint i = 0; i < items->len; i++) {
+        const ZipIndexItem *item = g_ptr_array_index(items, i);
+        FileInfo *info = g_new0(FileInfo, 1);
+        info->name = g_strdup(item->name);
+        // The path carries on through the archive, e.g. "/home/me/a.zip/docs/b.txt".
+        info->path = g_build_filename(path, item->name, NULL);
+        info->is_dir = item->is_dir;
+        info->type = g_strdup(info->is_dir ? "Directory" : "File");
+        info->size_formatted = info->is_dir ? g_strdup("") : format_size(item->size);
+        info->modified = zip_index_item_modified(item);
+        // Archives made on Windows have no Unix permissions, so they get the usual defaults,
+        // and some archivers leave out the file type bits.
+        mode_t mode = item->mode ? item->mode & 07777 : (info->is_dir ? 0755 : 0644);
+        mode |= info->is_dir ? S_IFDIR : S_IFREG;
+        info->permissions = g_malloc(11);
+        strmode(mode, info->permissions);
+        // Prepending and reversing once keeps this linear for folders with many entries.
+        list = g_list_prepend(list, info);
+    }
+    return g_list_reverse(list);
+}
+
+// The files extract_archive_member() made, for remove_extracted_members(). Like the archive
+// cache, this is only used on the UI thread.
+static GPtrArray *extracted_members = NULL;
+
+gchar* extract_archive_member(const gchar *member_path) {
+    const gchar *inner;
+    ZipIndex *index = archive_for_path(member_path, &inner);
+    if (!index) return NULL;
+    // Each member gets a fresh private folder, so its name can't clash with anything.
+    gchar *dir = g_dir_make_tmp("filemanager-XXXXXX", NULL);
+    gchar *file = dir ? zip_index_extract_member(index, inner, dir) : NULL;
+    if (dir && !file) rmdir(dir);
+    g_free(dir);
+    if (file) {
+        if (!extracted_members) extracted_members = g_ptr_array_new_with_free_func(g_free);
+        g_ptr_array_add(extracted_members, g_strdup(file));
+    }
+    return file;
+}
+
+void remove_extracted_members(void) {
+    if (!extracted_members) return;
+    for (guint i = 0; i < extracted_members->len; i++) {
+        const gchar *file = g_ptr_array_index(extracted_members, i);
+        gchar *dir = g_path_get_dirname(file);
+        // The folder was made for this one file, so once the file is gone it is empty.
+        unlink(file);
+        rmdir(dir);
+        g_free(dir);
+    }
+    g_ptr_array_free(extracted_members, TRUE);
+    extracted_members = NULL;
+}
+
 // --- Core Data Fetching ---
 
 /**
@@ -72,8 +268,9 @@ GList* get_directory_contents(const gchar *path) {
     // The opendir() system call asks the OS kernel for a "handle" or "stream" to a directory.
     DIR *d = opendir(path);
     // CRITICAL ERROR HANDLING: If the kernel returns NULL, the directory doesn't exist or we
-    // don't have permission to read it. We must stop immediately.
-    if (!d) return NULL;
+    // don't have permission to read it. We must stop immediately. The exception is a path
+    // into a zip archive, which is listed from the archive's table of contents instead.
+    if (!d) return errno == ENOTDIR ? get_archive_contents(path) : NULL;
 
     // This struct will hold the info for each item as the kernel gives it to us.
     struct dirent *dir;
@@ -110,13 +307,14 @@ GList* get_directory_contents(const gchar *path) {
             info->permissions = g_malloc(11);
             strmode(st.st_mode, info->permissions);
         }
-        // We add the completed FileInfo struct to our list of results.
-        list = g_list_append(list, info);
+        // We add the completed FileInfo struct to our list of results. Appending would walk the
+        // whole list every time, so we add at the front and reverse the list once at the end.
+        list = g_list_prepend(list, info);
     }
     // The closedir() system call tells the kernel: "I am finished with this directory stream."
     // This is a critical step to release the underlying resources and prevent leaks.
     closedir(d);
-    return list;
+    return g_list_reverse(list);
 }
 
 /**
@@ -177,153 +375,747 @@ gboolean rename_item(const gchar *old_path, const gchar *new_name) {
 }
 
 /**
- * @brief A callback function used by nftw() for recursive deletion.
- * This function is called for every single item found during the file tree walk.
+ * @brief The tree-walk callback used for deleting items while a sync walks the destination.
+ * Files are removed as soon as they are seen; a directory is removed in DIR_POST, which the
+ * walker only sends once every child has already been visited (and therefore deleted).
  */
-static int unlink_cb(const gchar *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
-    // The remove() system call deletes one file or one empty directory.
-    return remove(fpath);
+static TreeWalkResult unlink_cb(TreeWalkEntry *e, gpointer user_data) {
+    OpProgress *progress = user_data;
+    // Once cancelled we stop straight away; the remaining directories are left in place.
+    if (op_progress_is_cancelled(progress)) return TREE_WALK_STOP;
+    if (e->event == TREE_WALK_DIR_PRE) return TREE_WALK_CONTINUE;
+    // The unlinkat() system call deletes one name inside the already-open parent directory.
+    // AT_REMOVEDIR makes it behave like rmdir() instead of unlink().
+    int flags = (e->event == TREE_WALK_DIR_POST) ? AT_REMOVEDIR : 0;
+    if (unlinkat(e->parent_fd, e->name, flags) != 0) return TREE_WALK_FAILED;
+    op_progress_add(progress, S_ISREG(e->st.st_mode) ? e->st.st_size : 0, 1);
+    return TREE_WALK_CONTINUE;
 }
 
 /**
  * @brief Deletes a file or an entire directory tree.
  */
 gboolean delete_item(const gchar *path) {
-    // nftw() stands for "file tree walk". It's a powerful function that traverses an entire
-    // directory and all its subdirectories. We tell it to call our helper function (unlink_cb)
-    // on every item it finds, effectively deleting everything from the inside out.
-    return (nftw(path, unlink_cb, 64, FTW_DEPTH | FTW_PHYS) == 0);
+    return delete_item_with_progress(path, NULL);
+}
+
+gboolean delete_item_with_progress(const gchar *path, OpProgress *progress) {
+    // rmtree_at() deletes the item relative to its parent folder, spreading big trees
+    // over several threads and deleting everything from the inside out.
+    gchar *dir = g_path_get_dirname(path), *base = g_path_get_basename(path);
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    gboolean success = (dir_fd != -1 && rmtree_at(dir_fd, base, progress));
+    if (dir_fd != -1) close(dir_fd);
+    g_free(dir); g_free(base);
+    return success;
+}
+
+// How often a journaled copy of a big file records a checkpoint.
+#define CHECKPOINT_INTERVAL (64 * 1024 * 1024)
+// How much copy_file_range() is asked to copy at a time (also how often a cancel is noticed).
+#define KERNEL_COPY_CHUNK (8 * 1024 * 1024)
+
+// The state the copy walk needs: where the top-level item is being copied to, and how.
+typedef struct {
+    int dest_dir_fd;        // An open fd for the destination folder chosen by the user.
+    OpProgress *progress;   // Where to report progress (may be NULL).
+    CopyOptions options;    // What kind of copy this is (all FALSE for a plain copy).
+    CopyJournal *journal;   // The checkpoint journal, or NULL for an unjournaled copy.
+    GHashTable *links;      // With preserve_hardlinks: InodeKey* -> destination path (relative to dest_dir_fd).
+} CopyWalk;
+
+// Identifies a file independently of its name: two names with the same (device, inode)
+// pair are hard links to the same data.
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+} InodeKey;
+
+static guint inode_key_hash(gconstpointer key) {
+    const InodeKey *k = key;
+    return (guint)(k->ino ^ (k->ino >> 32) ^ (k->dev * 2654435761u));
+}
+
+static gboolean inode_key_equal(gconstpointer a, gconstpointer b) {
+    const InodeKey *ka = a, *kb = b;
+    return ka->dev == kb->dev && ka->ino == kb->ino;
+}
+
+// What copy_file_content() keeps track of while one file's data flows through.
+typedef struct {
+    CopyWalk *cw;
+    TreeWalkEntry *e;
+    const gchar *rel_path;      // The file's path relative to the copy (only with a journal).
+    int dst_fd;
+    guint64 offset;             // How many bytes of the file are at the destination.
+    guint64 last_checkpoint;
+    Checksum checksum;          // Of the source bytes, when verifying.
+} FileCopy;
+
+/**
+ * @brief Does the bookkeeping for a chunk that has just been written to the destination.
+ * `data` is NULL when the kernel copied the chunk for us (never the case when verifying).
+ * @return FALSE if the copy should stop (it was cancelled).
+ */
+static gboolean chunk_copied(const guchar *data, gsize len, gpointer user_data) {
+    FileCopy *fc = user_data;
+    CopyWalk *cw = fc->cw;
+    // The bytes are still in the buffer, so checksumming them costs no extra read.
+    if (cw->options.verify) checksum_update(&fc->checksum, data, len);
+    fc->offset += len;
+    op_progress_add(cw->progress, len, 0);
+    // Checking between chunks lets a cancel take effect in the middle of a huge file.
+    if (op_progress_is_cancelled(cw->progress)) return FALSE;
+    if (cw->journal && fc->offset - fc->last_checkpoint >= CHECKPOINT_INTERVAL) {
+        // fdatasync() makes sure the bytes really are on disk before we say so.
+        if (fdatasync(fc->dst_fd) == 0) copy_journal_checkpoint(cw->journal, fc->rel_path, &fc->e->st, fc->offset);
+        fc->last_checkpoint = fc->offset;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief Decides whether a file is copied with direct I/O (directio.h), and if so switches
+ * both descriptors over. Only huge files qualify: for them, going through the page cache
+ * would push everybody else's data out of memory.
+ */
+static gboolean use_direct_io(const TreeWalkEntry *e, int src_fd, int dst_fd, guint64 offset) {
+    if ((guint64)e->st.st_size < DIRECT_IO_MIN_SIZE || offset % DIRECT_IO_ALIGN != 0) return FALSE;
+    if (!direct_io_enable(src_fd, TRUE)) return FALSE;
+    if (direct_io_enable(dst_fd, TRUE)) return TRUE;
+    // The destination's file system doesn't support it: copy the normal way.
+    direct_io_enable(src_fd, FALSE);
+    return FALSE;
+}
+
+/**
+ * @brief Copies with copy_file_range(), which moves the data inside the kernel instead of
+ * through our buffer. On file systems with shared extents (btrfs, XFS) and network file
+ * systems with server-side copy, the data isn't moved at all.
+ * @return FALSE if the kernel can't copy between these two files; nothing was copied then.
+ */
+static gboolean copy_in_kernel(int src_fd, int dst_fd, FileCopy *fc, gboolean *done) {
+#ifdef __linux__
+    for (gboolean first = TRUE;; first = FALSE) {
+        // NULL offsets: use (and advance) both files' positions, which a resume has set.
+        ssize_t n = copy_file_range(src_fd, NULL, dst_fd, NULL, KERNEL_COPY_CHUNK, 0);
+        if (n == -1 && first && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) return FALSE;
+        if (n <= 0) { *done = (n == 0); return TRUE; }
+        if (!chunk_copied(NULL, n, fc)) { *done = FALSE; return TRUE; }
+    }
+#else
+    return FALSE;
+#endif
+}
+
+/**
+ * @brief With preserve_metadata: gives a copied item the original's owner, permissions and
+ * timestamps. Uses the open `fd` if there is one, otherwise `name` in `dir_fd` (for symlinks).
+ */
+static void copy_metadata(int fd, int dir_fd, const gchar *name, const struct stat *st) {
+    struct timespec times[2] = { st->st_atim, st->st_mtim };
+    // Only root may give files to another user; for everyone else the copy simply stays ours.
+    // Changing the owner can clear set-user-ID bits, so it comes before the permissions.
+    if (fd != -1) {
+        if (fchown(fd, st->st_uid, st->st_gid) != 0 && errno != EPERM) return;
+        fchmod(fd, st->st_mode & 07777);
+        futimens(fd, times);
+    } else {
+        if (fchownat(dir_fd, name, st->st_uid, st->st_gid, AT_SYMLINK_NOFOLLOW) != 0 && errno != EPERM) return;
+        utimensat(dir_fd, name, times, AT_SYMLINK_NOFOLLOW);
+    }
 }
 
 /**
  * @brief A helper function that copies the raw data from one file to another.
+ * Both files are named relative to an open directory, so the kernel only has to look up
+ * a single name for each open() instead of re-resolving a full path.
+ * For a journaled copy, the file may be skipped (already copied by an interrupted run) or
+ * continued from its last checkpoint, and new checkpoints are recorded along the way.
+ * With verification on, the data is checksummed as it passes through the buffer, and the
+ * finished copy is read back from the disk and checked against that checksum. Otherwise
+ * the kernel is asked to copy the data itself first, which is the fastest way when it can.
  */
-static gboolean copy_file_content(const gchar *src, const gchar *dst) {
+static gboolean copy_file_content(CopyWalk *cw, TreeWalkEntry *e, int dst_dir_fd) {
     int src_fd, dst_fd; // Integers to hold the "keys" (file descriptors) to our files.
     gchar buf[8192];    // A small bucket (8KB) to carry data between files.
     ssize_t nread;      // To keep track of how many bytes were read in each step.
+    guint64 offset = 0; // Where in the file we start (non-zero when resuming).
+    gboolean complete = FALSE;
+    gchar *rel_path = NULL;
+
+    // The journal identifies files by their path relative to the copy, so only build that
+    // string when there is a journal.
+    if (cw->journal) {
+        rel_path = tree_walk_entry_relpath(e);
+        struct stat dst_st;
+        if (!copy_journal_lookup(cw->journal, rel_path, &e->st, &complete, &offset)
+            || fstatat(dst_dir_fd, e->name, &dst_st, 0) != 0 || (guint64)dst_st.st_size < offset) {
+            // No usable record, or the destination doesn't hold what the journal promised.
+            complete = FALSE;
+            offset = 0;
+        }
+        if (complete) {
+            // An earlier run finished this file and the source hasn't changed since: skip it.
+            op_progress_add(cw->progress, e->st.st_size, 1);
+            g_free(rel_path);
+            return TRUE;
+        }
+    }
 
     // Get a file descriptor for the source file (read-only).
-    src_fd = open(src, O_RDONLY);
-    if (src_fd == -1) return FALSE; // Always check for errors!
-
-    // Get a file descriptor for the destination file (write-only, create if needed, overwrite if exists).
-    dst_fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (dst_fd == -1) { close(src_fd); return FALSE; }
-
-    // This is the main I/O loop. It continues as long as read() successfully reads data.
-    // The read() system call fills our bucket with data from the source file.
-    while ((nread = read(src_fd, buf, sizeof(buf))) > 0) {
-        // The write() system call pours the data from our bucket into the destination file.
-        if (write(dst_fd, buf, nread) != nread) {
+    src_fd = openat(e->parent_fd, e->name, O_RDONLY | O_CLOEXEC);
+    if (src_fd == -1) { g_free(rel_path); return FALSE; } // Always check for errors!
+
+    // Get a file descriptor for the destination file (write-only, create if needed). A fresh
+    // copy overwrites what's there; a resumed one keeps the part that is already done.
+    // O_NOFOLLOW refuses to open through a symbolic link: the copy must not overwrite whatever
+    // file the link points to. The link itself is replaced by the copy instead.
+    dst_fd = openat(dst_dir_fd, e->name, O_WRONLY | O_CREAT | O_CLOEXEC | O_NOFOLLOW | (offset ? 0 : O_TRUNC), 0644);
+    if (dst_fd == -1 && errno == ELOOP && unlinkat(dst_dir_fd, e->name, 0) == 0) {
+        // Whatever the journal said about the link's target, the new file starts empty.
+        offset = 0;
+        dst_fd = openat(dst_dir_fd, e->name, O_WRONLY | O_CREAT | O_CLOEXEC | O_NOFOLLOW | O_TRUNC, 0644);
+    }
+    if (dst_fd == -1) { close(src_fd); g_free(rel_path); return FALSE; }
+
+    FileCopy fc = { .cw = cw, .e = e, .rel_path = rel_path, .dst_fd = dst_fd, .offset = offset, .last_checkpoint = offset };
+    if (cw->options.verify) {
+        checksum_init(&fc.checksum);
+        // A resumed file's first part was copied by the earlier run; it still has to be in
+        // the checksum, so read it once here (it is not copied again).
+        for (guint64 pos = 0; pos < offset; pos += nread) {
+            nread = pread(src_fd, buf, MIN(sizeof(buf), offset - pos), pos);
+            if (nread <= 0) { close(src_fd); close(dst_fd); g_free(rel_path); return FALSE; }
+            checksum_update(&fc.checksum, buf, nread);
+        }
+    }
+    if (offset) {
+        // lseek() moves both files' read/write position to the first byte we still need.
+        lseek(src_fd, offset, SEEK_SET);
+        lseek(dst_fd, offset, SEEK_SET);
+        op_progress_add(cw->progress, offset, 0);
+    }
+
+    gboolean done;
+    if (use_direct_io(e, src_fd, dst_fd, offset)) {
+        done = direct_copy(src_fd, dst_fd, offset, chunk_copied, &fc);
+    } else if (cw->options.verify || !copy_in_kernel(src_fd, dst_fd, &fc, &done)) {
+        // This is the main I/O loop. It continues as long as read() successfully reads data.
+        // The read() system call fills our bucket with data from the source file.
+        while ((nread = read(src_fd, buf, sizeof(buf))) > 0) {
+            // The write() system call pours the data from our bucket into the destination file.
             // If we couldn't write everything, something is wrong (e.g., disk is full).
-            close(src_fd); close(dst_fd); return FALSE;
+            if (write(dst_fd, buf, nread) != nread) { nread = -1; break; }
+            if (!chunk_copied((const guchar *)buf, nread, &fc)) break;
         }
+        // Success only if the last read returned 0 (meaning we reached the end of the file).
+        done = (nread == 0);
+    }
+    offset = fc.offset;
+
+    // Whatever the copy loop thought, a copy that stopped before the source's size is not done.
+    if (done && offset != (guint64)e->st.st_size) done = FALSE;
+    // A resumed file may have had bytes past the last checkpoint; cut those off.
+    if (done && ftruncate(dst_fd, offset) != 0) done = FALSE;
+    if (done && cw->options.preserve_metadata) {
+        copy_metadata(dst_fd, -1, NULL, &e->st);
+    } else if (done && cw->options.sync) {
+        // A sync decides what changed by modification time, so the copy must carry the source's.
+        struct timespec times[2] = { { 0, UTIME_OMIT }, e->st.st_mtim };
+        futimens(dst_fd, times);
     }
+    // Verification has to read what is on the disk, so the data must get there first.
+    gboolean verified = TRUE;
+    if (done && cw->options.verify) verified = (fdatasync(dst_fd) == 0);
     // We're done, so we give back the file descriptors to the OS.
     close(src_fd); close(dst_fd);
-    return nread == 0; // Success if the last read returned 0 (meaning we reached the end of the file).
+
+    if (done && cw->options.verify && verified) {
+        // Read the copy back through a fresh descriptor and compare checksums.
+        guint64 digest;
+        int check_fd = openat(dst_dir_fd, e->name, O_RDONLY | O_CLOEXEC);
+        verified = check_fd != -1 && checksum_file_uncached(check_fd, &digest) && digest == checksum_digest(&fc.checksum);
+        if (check_fd != -1) close(check_fd);
+    }
+    if (!verified) {
+        // A corrupt copy must not survive, nor be continued by a resumed run.
+        unlinkat(dst_dir_fd, e->name, 0);
+        g_free(rel_path);
+        return FALSE;
+    }
+
+    if (!done) {
+        // A half-written copy is useless, unless the journal can continue it next time
+        // (a cancelled copy is never resumed, so it is always removed).
+        if (!cw->journal || op_progress_is_cancelled(cw->progress)) unlinkat(dst_dir_fd, e->name, 0);
+        g_free(rel_path);
+        return FALSE;
+    }
+    if (cw->journal) copy_journal_file_done(cw->journal, rel_path, &e->st);
+    op_progress_add(cw->progress, 0, 1);
+    g_free(rel_path);
+    return TRUE;
+}
+
+/**
+ * @brief Re-creates a symbolic link at the destination instead of copying what it points to.
+ */
+static gboolean copy_symlink(int src_dir_fd, const gchar *src_name, int dst_dir_fd, const gchar *dst_name) {
+    gchar target[4096], existing[4096];
+    // readlinkat() reads the text stored inside the link; it does not add a terminating '\0'.
+    ssize_t len = readlinkat(src_dir_fd, src_name, target, sizeof(target) - 1);
+    if (len == -1) return FALSE;
+    target[len] = '\0';
+    if (symlinkat(target, dst_dir_fd, dst_name) == 0) return TRUE;
+    if (errno != EEXIST) return FALSE;
+    // Something already has this name. If it is the same link, there is nothing to do;
+    // otherwise replace it (but never a directory, which is handled by the caller).
+    ssize_t existing_len = readlinkat(dst_dir_fd, dst_name, existing, sizeof(existing) - 1);
+    if (existing_len == len && memcmp(existing, target, len) == 0) return TRUE;
+    if (unlinkat(dst_dir_fd, dst_name, 0) != 0) return FALSE;
+    return symlinkat(target, dst_dir_fd, dst_name) == 0;
+}
+
+/**
+ * @brief Creates `e->name` at the destination as a hard link to an already-copied file.
+ * @param first_copy The earlier copy, relative to the destination folder.
+ */
+static gboolean link_to_copy(CopyWalk *cw, const gchar *first_copy, int dest_parent_fd, TreeWalkEntry *e) {
+    // linkat() adds a second name for existing data; no bytes are copied at all.
+    int rc = linkat(cw->dest_dir_fd, first_copy, dest_parent_fd, e->name, 0);
+    if (rc != 0 && errno == EEXIST) {
+        // Copying over an older copy (or resuming): if the name already is a link to the
+        // right data we are done, otherwise replace whatever holds the name now.
+        struct stat first_st, existing_st;
+        if (fstatat(cw->dest_dir_fd, first_copy, &first_st, AT_SYMLINK_NOFOLLOW) == 0
+            && fstatat(dest_parent_fd, e->name, &existing_st, AT_SYMLINK_NOFOLLOW) == 0
+            && first_st.st_dev == existing_st.st_dev && first_st.st_ino == existing_st.st_ino) rc = 0;
+        else if (unlinkat(dest_parent_fd, e->name, 0) == 0) rc = linkat(cw->dest_dir_fd, first_copy, dest_parent_fd, e->name, 0);
+    }
+    // If linking fails (e.g. the file system's link limit was reached), the caller falls back to copying.
+    if (rc != 0) return FALSE;
+    op_progress_add(cw->progress, e->st.st_size, 1);
+    return TRUE;
+}
+
+// Per-directory state for the copy walk. The matching destination directory itself is the
+// walk's mirror_fd (see treewalk.h), so the walker can park it on deep trees.
+typedef struct {
+    GHashTable *seen;   // With sync_delete_extraneous: the names this directory has in the source.
+} CopyDir;
+
+/**
+ * @brief Compares two files byte by byte, stopping at the first difference.
+ * Both files are local, so reading them side by side is cheaper than hashing each one and
+ * comparing the hashes: it gives the same answer and can stop early.
+ */
+static gboolean same_content(int a_dir_fd, const gchar *a_name, int b_dir_fd, const gchar *b_name) {
+    gchar buf_a[65536], buf_b[65536];
+    int a = openat(a_dir_fd, a_name, O_RDONLY | O_CLOEXEC);
+    int b = openat(b_dir_fd, b_name, O_RDONLY | O_CLOEXEC);
+    gboolean same = (a != -1 && b != -1);
+    while (same) {
+        ssize_t na = read(a, buf_a, sizeof(buf_a));
+        ssize_t nb = (na > 0) ? read(b, buf_b, na) : 0;
+        if (na < 0 || na != nb || memcmp(buf_a, buf_b, na) != 0) same = FALSE;
+        if (na <= 0) break;
+    }
+    if (a != -1) close(a);
+    if (b != -1) close(b);
+    return same;
+}
+
+/**
+ * @brief Sync mode: decides whether the destination already holds an identical copy of a file.
+ */
+static gboolean dest_is_up_to_date(CopyWalk *cw, TreeWalkEntry *e, int dest_parent_fd) {
+    struct stat dst;
+    if (fstatat(dest_parent_fd, e->name, &dst, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(dst.st_mode)) return FALSE;
+    if (dst.st_size != e->st.st_size) return FALSE;
+    // Like rsync, the quick check trusts a matching size and modification time (to the second).
+    if (!cw->options.sync_compare_content) return dst.st_mtime == e->st.st_mtime;
+    if (!same_content(e->parent_fd, e->name, dest_parent_fd, e->name)) return FALSE;
+    // Same bytes: just fix the timestamp so the quick check recognises the file next time.
+    if (dst.st_mtime != e->st.st_mtime) {
+        struct timespec times[2] = { { 0, UTIME_OMIT }, e->st.st_mtim };
+        utimensat(dest_parent_fd, e->name, times, AT_SYMLINK_NOFOLLOW);
+    }
+    return TRUE;
+}
+
+/**
+ * @brief Sync mode: makes room when the destination has a directory where the source has a
+ * file, or the other way round. A symbolic link in the destination also makes way for a file
+ * or directory: writing "into" it would change whatever it points to, possibly outside the
+ * destination. Returns FALSE if the conflicting item could not be removed.
+ */
+static gboolean clear_type_conflict(int dest_parent_fd, TreeWalkEntry *e) {
+    struct stat dst;
+    if (fstatat(dest_parent_fd, e->name, &dst, AT_SYMLINK_NOFOLLOW) != 0) return TRUE;
+    if (S_ISDIR(dst.st_mode) == S_ISDIR(e->st.st_mode)
+        && (!S_ISLNK(dst.st_mode) || S_ISLNK(e->st.st_mode))) return TRUE;
+    return tree_walk_at(dest_parent_fd, e->name, unlink_cb, NULL);
+}
+
+/**
+ * @brief Sync mode: removes every item in a destination directory whose name was not seen
+ * in the matching source directory.
+ */
+static gboolean delete_extraneous(CopyDir *dir, int dir_fd) {
+    gboolean ok = TRUE;
+    // The walk below keeps using dir_fd, so the directory stream gets its own duplicate.
+    DIR *d = fdopendir(dup(dir_fd));
+    if (!d) return FALSE;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+        if (g_hash_table_contains(dir->seen, de->d_name)) continue;
+        if (!tree_walk_at(dir_fd, de->d_name, unlink_cb, NULL)) ok = FALSE;
+    }
+    closedir(d);
+    return ok;
+}
+
+/**
+ * @brief Sync mode: brings a big, changed file up to date by rewriting only its changed blocks.
+ * @return FALSE if there is no old version to update, or the update failed; the caller then
+ * copies the whole file.
+ */
+static gboolean delta_copy_file(CopyWalk *cw, TreeWalkEntry *e, int dest_parent_fd) {
+    struct stat dst;
+    if (e->st.st_size < DELTA_MIN_SIZE || fstatat(dest_parent_fd, e->name, &dst, AT_SYMLINK_NOFOLLOW) != 0
+        || !S_ISREG(dst.st_mode) || dst.st_size == 0) return FALSE;
+    int src_fd = openat(e->parent_fd, e->name, O_RDONLY | O_CLOEXEC);
+    if (src_fd == -1) return FALSE;
+    gboolean ok = delta_update_file(src_fd, &e->st, dest_parent_fd, e->name, cw->options.verify, cw->progress);
+    close(src_fd);
+    if (!ok) return FALSE;
+    if (cw->journal) {
+        gchar *rel_path = tree_walk_entry_relpath(e);
+        copy_journal_file_done(cw->journal, rel_path, &e->st);
+        g_free(rel_path);
+    }
+    op_progress_add(cw->progress, 0, 1);
+    return TRUE;
+}
+
+/**
+ * @brief Copies one regular file, taking the copy options into account.
+ */
+static gboolean copy_regular_file(CopyWalk *cw, TreeWalkEntry *e, int dest_parent_fd) {
+    // A file with more than one name may already have been copied under another name.
+    // If so, give the copy an extra name too (linkat) instead of copying the data again.
+    gboolean multi_link = cw->links && e->st.st_nlink > 1;
+    InodeKey key = { e->st.st_dev, e->st.st_ino };
+    if (multi_link) {
+        const gchar *first_copy = g_hash_table_lookup(cw->links, &key);
+        if (first_copy && link_to_copy(cw, first_copy, dest_parent_fd, e)) return TRUE;
+    }
+
+    gboolean ok;
+    if (cw->options.sync && dest_is_up_to_date(cw, e, dest_parent_fd)) {
+        op_progress_add(cw->progress, e->st.st_size, 1);
+        ok = TRUE;
+    } else if (cw->options.sync && cw->options.sync_delta && delta_copy_file(cw, e, dest_parent_fd)) {
+        ok = TRUE;
+    } else {
+        // A cancelled delta update leaves the old file as it was; don't start a full copy.
+        ok = !op_progress_is_cancelled(cw->progress) && copy_file_content(cw, e, dest_parent_fd);
+    }
+
+    // Remember where this data now lives at the destination, for later names of the same file.
+    // The destination mirrors the source, so the entry's relative path is valid below dest_dir_fd.
+    if (ok && multi_link && !g_hash_table_contains(cw->links, &key))
+        g_hash_table_insert(cw->links, g_memdup2(&key, sizeof(key)), tree_walk_entry_relpath(e));
+    return ok;
+}
+
+/**
+ * @brief The tree-walk callback that mirrors each visited item into the destination.
+ */
+static TreeWalkResult copy_cb(TreeWalkEntry *e, gpointer user_data) {
+    CopyWalk *cw = user_data;
+    // The directory our copy should go into: the destination folder for the top-level item,
+    // or the copy of the parent directory for everything below it.
+    CopyDir *parent = e->parent_data;
+    int dest_parent_fd = parent ? e->parent_mirror_fd : cw->dest_dir_fd;
+
+    // Sync mode remembers which names the source has, so that the rest can be deleted later.
+    if (e->event != TREE_WALK_DIR_POST && parent && parent->seen)
+        g_hash_table_add(parent->seen, g_strdup(e->name));
+    if (e->event != TREE_WALK_DIR_POST && cw->options.sync && !clear_type_conflict(dest_parent_fd, e))
+        return TREE_WALK_FAILED;
+
+    switch (e->event) {
+    case TREE_WALK_DIR_PRE: {
+        if (op_progress_is_cancelled(cw->progress)) return TREE_WALK_STOP;
+        // Make a new folder at the destination (it's fine if it already exists)...
+        if (mkdirat(dest_parent_fd, e->name, e->st.st_mode & 07777) != 0 && errno != EEXIST) return TREE_WALK_FAILED;
+        // ...and have the walker keep it open so its children can be created relative to it.
+        e->mirror_fd = openat(dest_parent_fd, e->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (e->mirror_fd == -1) return TREE_WALK_FAILED;
+        CopyDir *dir = g_new0(CopyDir, 1);
+        if (cw->options.sync && cw->options.sync_delete_extraneous)
+            dir->seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        e->dir_data = dir;
+        op_progress_add(cw->progress, 0, 1);
+        return TREE_WALK_CONTINUE;
+    }
+    case TREE_WALK_DIR_POST: {
+        CopyDir *dir = e->dir_data;
+        TreeWalkResult result = TREE_WALK_CONTINUE;
+        // Only a directory that was read completely knows every name the source has; after a
+        // cancel, deleting "extraneous" items could remove things the source still has.
+        if (dir->seen && !op_progress_is_cancelled(cw->progress) && !delete_extraneous(dir, e->mirror_fd)) result = TREE_WALK_FAILED;
+        if (dir->seen) g_hash_table_destroy(dir->seen);
+        // Now that the children are written, the folder's timestamps won't change any more.
+        if (cw->options.preserve_metadata && e->mirror_fd != -1) copy_metadata(e->mirror_fd, -1, NULL, &e->st);
+        g_free(dir);
+        return result;
+    }
+    case TREE_WALK_FILE:
+    default:
+        if (S_ISLNK(e->st.st_mode)) {
+            if (!copy_symlink(e->parent_fd, e->name, dest_parent_fd, e->name)) return TREE_WALK_FAILED;
+            if (cw->options.preserve_metadata) copy_metadata(-1, dest_parent_fd, e->name, &e->st);
+            op_progress_add(cw->progress, 0, 1);
+            return TREE_WALK_CONTINUE;
+        }
+        if (copy_regular_file(cw, e, dest_parent_fd)) return TREE_WALK_CONTINUE;
+        return op_progress_is_cancelled(cw->progress) ? TREE_WALK_STOP : TREE_WALK_FAILED;
+    }
 }
 
 /**
  * @brief Copies an item (file or directory) from a source to a destination.
- * This function uses recursion to handle directories.
+ * The tree walker visits every item below the source; copy_cb recreates each one.
  */
 gboolean copy_item(const gchar *src_path, const gchar *dest_dir) {
+    return copy_item_with_options(src_path, dest_dir, NULL, NULL);
+}
+
+gboolean copy_can_resume(const gchar *src_path, const gchar *dest_dir) {
+    gchar *journal_path = copy_journal_path(src_path, dest_dir);
+    gboolean exists = g_file_test(journal_path, G_FILE_TEST_EXISTS);
+    g_free(journal_path);
+    return exists;
+}
+
+gboolean copy_item_with_options(const gchar *src_path, const gchar *dest_dir, const CopyOptions *options, OpProgress *progress) {
+    CopyWalk cw;
+    memset(&cw, 0, sizeof(cw));
+    if (options) cw.options = *options;
+    cw.progress = progress;
+    cw.dest_dir_fd = open(dest_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cw.dest_dir_fd == -1) return FALSE;
+    gchar *journal_path = NULL;
+    if (options && (options->journal || options->resume)) {
+        journal_path = copy_journal_path(src_path, dest_dir);
+        cw.journal = copy_journal_open(journal_path, options->resume, cw.dest_dir_fd);
+    }
+    if (options && options->preserve_hardlinks)
+        cw.links = g_hash_table_new_full(inode_key_hash, inode_key_equal, g_free, g_free);
+
+    // Remember whether the top-level item already existed at the destination, so that a
+    // cancelled copy only cleans up what it created itself.
     gchar *base = g_path_get_basename(src_path);
-    gchar *dest_path = g_build_filename(dest_dir, base, NULL);
-    gboolean result = TRUE;
     struct stat st;
-    stat(src_path, &st); // First, we use stat() to check if the source is a file or a folder.
-
-    if (S_ISDIR(st.st_mode)) { // If it's a folder...
-        mkdir(dest_path, st.st_mode); // ...make a new empty folder at the destination.
-        DIR *d = opendir(src_path);   // Then, open the source folder to see what's inside.
-        if (d) {
-            struct dirent *dir;
-            while ((dir = readdir(d)) != NULL) { // Loop through every item inside.
-                if (strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0) continue;
-                gchar *new_src = g_build_filename(src_path, dir->d_name, NULL);
-                // This is RECURSION! The function calls itself to copy the item it found inside.
-                if (!copy_item(new_src, dest_path)) result = FALSE;
-                g_free(new_src);
-            }
-            closedir(d);
-        }
-    } else { // If it's just a file...
-        // ...we just call our helper to copy its data.
-        result = copy_file_content(src_path, dest_path);
+    gboolean existed = (fstatat(cw.dest_dir_fd, base, &st, AT_SYMLINK_NOFOLLOW) == 0);
+
+    gboolean result = tree_walk(src_path, copy_cb, &cw);
+    if (!result && !existed && op_progress_is_cancelled(progress)) {
+        gchar *dest_path = g_build_filename(dest_dir, base, NULL);
+        delete_item(dest_path);
+        g_free(dest_path);
     }
-    g_free(base); g_free(dest_path);
+    // The journal is only kept when the copy failed (e.g. the disk filled up), so that it can
+    // be resumed. A finished or deliberately cancelled copy doesn't need it any more.
+    copy_journal_close(cw.journal, result || op_progress_is_cancelled(progress));
+    g_free(journal_path);
+    if (cw.links) g_hash_table_destroy(cw.links);
+    g_free(base);
+    close(cw.dest_dir_fd);
     return result;
 }
 
+/**
+ * @brief Moves an item to another file system, where rename() can't reach: copy, make the
+ * copy durable, put it in place, and only then delete the original.
+ */
+static gboolean move_across_devices(const gchar *src_path, int dest_dir_fd, const gchar *dest_dir, const gchar *base,
+                                    OpProgress *progress) {
+    struct stat st;
+    if (fstatat(dest_dir_fd, base, &st, AT_SYMLINK_NOFOLLOW) == 0) { errno = EEXIST; return FALSE; }
+
+    // Copy into a hidden staging folder next to the destination, so a half-finished move
+    // never shows up under the real name.
+    gchar *staging = g_build_filename(dest_dir, ".filemanager-move-XXXXXX", NULL);
+    if (!g_mkdtemp(staging)) { g_free(staging); return FALSE; }
+    CopyOptions options = { .preserve_hardlinks = TRUE, .preserve_metadata = TRUE };
+    gboolean ok = copy_item_with_options(src_path, staging, &options, progress);
+
+    int staging_fd = ok ? open(staging, O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+    if (ok && staging_fd != -1) {
+#ifdef __linux__
+        // syncfs() flushes everything just written to the destination file system in one call.
+        ok = (syncfs(staging_fd) == 0);
+#else
+        sync();
+#endif
+        // Move the finished copy to its real name, and make that rename durable too.
+        ok = ok && rename_noreplace(staging_fd, base, dest_dir_fd, base) == 0 && fsync(dest_dir_fd) == 0;
+    } else {
+        ok = FALSE;
+    }
+    if (staging_fd != -1) close(staging_fd);
+    // After a successful move the staging folder is empty; otherwise this removes the partial copy.
+    delete_item(staging);
+    g_free(staging);
+
+    // Only now, with the copy safely on disk, may the original go.
+    return ok && delete_item(src_path);
+}
+
 /**
  * @brief Moves an item to a new directory.
  */
 gboolean move_item(const gchar *src_path, const gchar *dest_dir) {
+    return move_item_with_progress(src_path, dest_dir, NULL);
+}
+
+gboolean move_item_with_progress(const gchar *src_path, const gchar *dest_dir, OpProgress *progress) {
+    int dest_dir_fd = open(dest_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dest_dir_fd == -1) return FALSE;
     gchar *base = g_path_get_basename(src_path);
-    gchar *dest_path = g_build_filename(dest_dir, base, NULL);
-    // We can just use the rename() system call. If the destination is in a different
-    // folder on the same disk, the kernel just updates pointers. It's an instant, atomic operation.
-    gboolean success = (rename(src_path, dest_path) == 0);
-    g_free(base); g_free(dest_path);
+    // Within one file system, rename() just updates directory entries: instant and atomic.
+    gboolean success = (rename_noreplace(AT_FDCWD, src_path, dest_dir_fd, base) == 0);
+    // EXDEV means the destination is on another file system, so the data has to be copied.
+    if (!success && errno == EXDEV) success = move_across_devices(src_path, dest_dir_fd, dest_dir, base, progress);
+    g_free(base);
+    close(dest_dir_fd);
     return success;
 }
 
+// The state the zip walk needs.
+typedef struct {
+    ZipWriter *writer;
+    OpProgress *progress;
+} ZipWalk;
+
 /**
- * @brief A recursive helper function to add files and directories to a zip archive.
+ * @brief The tree-walk callback that adds each visited item to the archive.
+ * The entry's relative path doubles as its name inside the zip, e.g. "Photos/2024/a.jpg".
  */
-static void add_to_zip_recursive(zip_t *zip, const gchar *base_path_in_fs, const gchar *parent_path_in_zip) {
-    DIR *d = opendir(base_path_in_fs);
-    if (!d) return;
-    struct dirent *dir;
-    while ((dir = readdir(d)) != NULL) {
-        if (strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0) continue;
-        gchar *full_fs_path = g_build_filename(base_path_in_fs, dir->d_name, NULL);
-        gchar *full_zip_path = g_strconcat(parent_path_in_zip, dir->d_name, NULL);
-        struct stat st;
-        stat(full_fs_path, &st);
-        if (S_ISDIR(st.st_mode)) { // If the item is a folder...
-            zip_dir_add(zip, full_zip_path, ZIP_FL_ENC_UTF_8); // ...add an empty folder entry to the zip.
-            gchar *zip_dir_path = g_strconcat(full_zip_path, "/", NULL);
-            // And then, RECURSION! Call this function again to add the contents of that folder.
-            add_to_zip_recursive(zip, full_fs_path, zip_dir_path);
-            g_free(zip_dir_path);
-        } else { // If the item is a file...
-            // ...we get the file's data as a "source"...
-            zip_source_t *source = zip_source_file(zip, full_fs_path, 0, 0);
-            // ...and add the source data to the zip archive.
-            zip_file_add(zip, full_zip_path, source, ZIP_FL_ENC_UTF_8);
-        }
-        g_free(full_fs_path); g_free(full_zip_path);
+static TreeWalkResult zip_cb(TreeWalkEntry *e, gpointer user_data) {
+    ZipWalk *zw = user_data;
+    if (e->event == TREE_WALK_DIR_POST) return TREE_WALK_CONTINUE;
+    if (op_progress_is_cancelled(zw->progress)) return TREE_WALK_STOP;
+
+    struct stat st = e->st;
+    // Symlinks are followed for zipping, but only to regular files; a link to a folder
+    // could lead the walk into a cycle. A link that leads nowhere (its target was deleted,
+    // or it loops) is left out like any other link that isn't to a file.
+    if (S_ISLNK(st.st_mode) && fstatat(e->parent_fd, e->name, &st, 0) != 0) return TREE_WALK_CONTINUE;
+    if (e->event == TREE_WALK_FILE && !S_ISREG(st.st_mode)) return TREE_WALK_CONTINUE;
+
+    gchar *zip_path = tree_walk_entry_relpath(e);
+    gboolean ok;
+    if (e->event == TREE_WALK_DIR_PRE) { // If the item is a folder...
+        // ...add an empty folder entry to the zip. The walker will then visit its contents.
+        ok = zip_writer_add_dir(zw->writer, zip_path, &st);
+    } else { // If the item is a file...
+        // ...open it while its folder is at hand; the writer's threads compress it from there.
+        ok = zip_writer_add_file(zw->writer, e->parent_fd, e->name, zip_path, &st);
     }
-    closedir(d);
+    g_free(zip_path);
+    return ok ? TREE_WALK_CONTINUE : TREE_WALK_FAILED;
+}
+
+/**
+ * @brief Adds `src_path` (and, for a folder, everything inside it) to a new archive, then
+ * finishes the archive, or discards it if the walk was cancelled. Frees the writer.
+ */
+static gboolean zip_walk(const gchar *src_path, ZipWriter *writer, ZipStats *stats, OpProgress *progress) {
+    ZipWalk zw;
+    zw.writer = writer;
+    zw.progress = progress;
+    // The walker visits the item (and, for a folder, everything inside it) and zip_cb adds
+    // each one to the archive.
+    gboolean ok = tree_walk(src_path, zip_cb, &zw);
+    if (op_progress_is_cancelled(progress)) {
+        zip_writer_discard(writer);
+        return FALSE;
+    }
+    // Finally, we wait for the last blocks and write the archive's table of contents.
+    return zip_writer_finish(writer, stats) && ok;
 }
 
 /**
  * @brief Compresses a file or directory into a .zip archive.
  */
 gboolean zip_item(const gchar *src_path, const gchar *dest_zip_path) {
-    int error;
-    // We open a new, empty zip file for writing.
-    zip_t *zip = zip_open(dest_zip_path, ZIP_CREATE | ZIP_TRUNCATE, &error);
-    if (!zip) return FALSE;
+    return zip_item_with_progress(src_path, dest_zip_path, NULL);
+}
+
+gboolean zip_item_with_progress(const gchar *src_path, const gchar *dest_zip_path, OpProgress *progress) {
+    return zip_item_with_options(src_path, dest_zip_path, NULL, NULL, progress);
+}
+
+gboolean zip_item_with_options(const gchar *src_path, const gchar *dest_zip_path, const ZipOptions *options, ZipStats *stats, OpProgress *progress) {
+    ZipOptions defaults = {0};
+    if (!options) options = &defaults;
+    // The tar formats have a writer of their own (see tarball.h).
+    if (options->format != ARCHIVE_ZIP) return tar_create(src_path, dest_zip_path, options, stats, progress);
+    // We start a new, empty archive. It is written under a temporary name and only
+    // renamed into place once it is complete, so a failed or cancelled zip leaves nothing behind.
+    ZipWriter *writer = zip_writer_new(dest_zip_path, options->threads, options->level, progress);
+    if (!writer) return FALSE;
+    // When updating, the old archive stays readable (under its name, or just through our open
+    // file once the new one replaces it) until the new one is finished.
+    ZipIndex *previous = options->update ? zip_index_open(dest_zip_path) : NULL;
+    if (previous) zip_writer_set_previous(writer, previous);
+    gboolean ok = zip_walk(src_path, writer, stats, progress);
+    zip_index_free(previous);
+    return ok;
+}
+
+gboolean zip_item_to_fd(const gchar *src_path, int fd, const ZipOptions *options, ZipStats *stats, OpProgress *progress) {
+    ZipOptions defaults = {0};
+    if (!options) options = &defaults;
+    // A tar stream would need its own writer; only zip archives can be streamed for now.
+    if (options->format != ARCHIVE_ZIP) return FALSE;
+    ZipWriter *writer = zip_writer_new_for_fd(fd, options->threads, options->level, progress);
+    if (!writer) return FALSE;
+    return zip_walk(src_path, writer, stats, progress);
+}
+
+/**
+ * @brief Extracts a .zip archive into a folder.
+ */
+gboolean unzip_item(const gchar *zip_path, const gchar *dest_dir) {
+    return unzip_item_with_progress(zip_path, dest_dir, NULL);
+}
+
+gboolean unzip_item_with_progress(const gchar *zip_path, const gchar *dest_dir, OpProgress *progress) {
+    if (tar_is_archive_name(zip_path)) return tar_extract(zip_path, dest_dir, progress);
+    // The archive's entries are extracted on one thread per CPU (see zipreader.h).
+    return zip_extract(zip_path, dest_dir, 0, progress);
+}
+
+gboolean test_archive_with_progress(const gchar *zip_path, GPtrArray *corrupt, OpProgress *progress) {
+    // Like extracting, one thread per CPU, but nothing is written.
+    return zip_test(zip_path, 0, corrupt, progress);
+}
+
+gboolean is_extractable_archive(const gchar *path) {
     struct stat st;
-    stat(src_path, &st);
-    if (S_ISDIR(st.st_mode)) { // If we're zipping a folder...
-        gchar *base = g_path_get_basename(src_path);
-        gchar *base_zip_path = g_strconcat(base, "/", NULL);
-        // First, add the main folder entry to the zip.
-        zip_dir_add(zip, base, ZIP_FL_ENC_UTF_8);
-        // Then, call our recursive helper to add everything inside it.
-        add_to_zip_recursive(zip, src_path, base_zip_path);
-        g_free(base); g_free(base_zip_path);
-    } else { // If it's just a file...
-        // ...we just add the single file to the zip.
-        zip_source_t *source = zip_source_file(zip, src_path, 0, 0);
-        zip_file_add(zip, g_path_get_basename(src_path), source, ZIP_FL_ENC_UTF_8);
-    }
-    // Finally, we close the zip file, which finalizes the archive and writes it to disk.
-    return (zip_close(zip) == 0);
-}
\ No newline at end of file
+    if (is_browsable_archive(path)) return TRUE;
+    return tar_is_archive_name(path) && stat(path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+const gchar* archive_extension(const ZipOptions *options) {
+    if (!options || options->format == ARCHIVE_ZIP) return ".zip";
+    if (options->level == ZIP_LEVEL_STORE) return ".tar";
+    return options->format == ARCHIVE_TAR_XZ ? ".tar.xz" : ".tar.zst";
+}
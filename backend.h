@@ -32,6 +32,76 @@ typedef struct {
     gboolean is_dir;        // A simple TRUE/FALSE flag for efficient checking if the item is a directory.
 } FileInfo;
 
+// Live progress counters shared between a running operation (on a worker thread) and
+// whoever is watching it (usually the UI). All access goes through the op_progress_*
+// functions below, which take the lock, so it is safe to read while the operation runs.
+typedef struct {
+    GMutex lock;
+    guint64 bytes_total;    // How many bytes the operation expects to process (0 if unknown).
+    guint64 bytes_done;     // How many bytes have been processed so far.
+    guint files_total;      // How many items the operation expects to process.
+    guint files_done;       // How many items are finished.
+    gint cancelled;         // Set by op_progress_cancel(); the operation stops as soon as it notices.
+} OpProgress;
+
+// Optional behaviour for copy_item_with_options(). A zeroed struct (or NULL) means a plain copy.
+typedef struct {
+    gboolean journal;   // Keep an on-disk checkpoint journal so the copy can be resumed if interrupted.
+    gboolean resume;    // Continue an interrupted copy: skip files its journal marks as done and
+                        // continue partly copied ones from their last checkpoint.
+    gboolean preserve_hardlinks;    // Files that are hard links of each other in the source become
+                                    // hard links of each other in the copy, instead of separate copies.
+    gboolean sync;                  // Incremental update: only copy files that are new or changed
+                                    // (different size or modification time) at the destination.
+    gboolean sync_compare_content;  // With sync: decide by comparing the files' bytes instead of
+                                    // trusting matching modification times.
+    gboolean sync_delete_extraneous;// With sync: remove destination items that no longer exist in the source.
+    gboolean sync_delta;            // With sync: update big changed files block by block (see delta.h)
+                                    // instead of copying them whole.
+    gboolean verify;                // Checksum the data while copying it, then read each copied file
+                                    // back from the disk and check it arrived intact.
+    gboolean preserve_metadata;     // Give each copy the original's owner, permissions and timestamps.
+} CopyOptions;
+
+// A ZipOptions level that stores every file as it is, without compressing anything.
+#define ZIP_LEVEL_STORE (-1)
+
+// The kinds of archive zip_item_with_options() can make.
+typedef enum {
+    ARCHIVE_ZIP,        // .zip with deflate: opens everywhere, but slow and weak compression.
+    ARCHIVE_TAR_ZSTD,   // .tar.zst: much faster than deflate and smaller, for the same CPU time.
+    ARCHIVE_TAR_XZ      // .tar.xz: the smallest, but the slowest to make.
+} ArchiveFormat;
+
+// Optional behaviour for zip_item_with_options(). A zeroed struct (or NULL) means the defaults.
+// In a zip, files that are already compressed (photos, videos, archives...) are always stored
+// as they are: deflating them costs a lot of CPU and saves next to nothing.
+typedef struct {
+    int level;      // From 1 (fastest) to 9 (smallest); 0 means the format's default. For a zip
+                    // this is the deflate level; for the tar formats it is spread over zstd's
+                    // levels 1 to 19, or used as the xz preset. ZIP_LEVEL_STORE stores every
+                    // file uncompressed (for the tar formats: a plain .tar).
+    int threads;    // Compressing threads; 0 means one per CPU.
+    ArchiveFormat format;
+    gboolean long_distance; // tar.zst only: also find repeats far apart (up to 128 MiB), which
+                            // pays off for big folders holding many similar files.
+    gboolean update;        // zip only: if the archive already exists, copy the data of files that
+                            // haven't changed (same size, modification time and CRC-32) from it
+                            // instead of compressing them again.
+} ZipOptions;
+
+// What a finished zip achieved, filled in by zip_item_with_options().
+typedef struct {
+    guint64 bytes_in;           // File data read from the source.
+    guint64 bytes_out;          // The same data as stored in the archive (compressed or not).
+    guint files_stored;         // Files stored uncompressed...
+    guint64 bytes_stored;       // ...and how many bytes they hold.
+    gdouble cpu_seconds;        // CPU time spent deflating, summed over all threads.
+    gdouble cpu_seconds_saved;  // Estimated CPU time the stored files would have cost to deflate
+                                // (0 if nothing was deflated to estimate it from).
+    guint files_reused;         // Unchanged files copied from the previous archive (update mode).
+} ZipStats;
+
 // --- Function Declarations (The Public API) ---
 // The following lines are function prototypes. They do not contain code, but instead
 // promise the compiler that these functions exist somewhere else (in backend.c).
@@ -40,8 +110,21 @@ typedef struct {
 // --- Functions for Getting Information ---
 
 // Retrieves a list of all files and folders within a specified directory.
+// Zip archives can be browsed like folders: `path` may be an archive ("/a/b.zip") or a folder
+// inside one ("/a/b.zip/docs"), and the items listed then have paths inside the archive too.
 GList* get_directory_contents(const gchar *path);
 
+// TRUE if `path` is a zip archive on disk that get_directory_contents() can list.
+gboolean is_browsable_archive(const gchar *path);
+
+// Extracts the file at a path inside an archive (e.g. "/a/b.zip/docs/c.txt") into a new
+// temporary folder. Returns the extracted file's path, or NULL if it couldn't be extracted.
+gchar* extract_archive_member(const gchar *member_path);
+
+// Deletes every file extract_archive_member() extracted, together with its temporary folder.
+// An application that still has one open can keep reading it until it closes it.
+void remove_extracted_members(void);
+
 // A helper function to properly free all the memory allocated for a single FileInfo struct.
 // This is crucial for preventing memory leaks.
 void free_file_info(gpointer data);
@@ -70,12 +153,69 @@ gboolean delete_item(const gchar *path);
 // Copies a file or directory tree to a new location.
 gboolean copy_item(const gchar *src_path, const gchar *dest_dir);
 
-// Moves a file or directory to a new location.
+// Moves a file or directory to a new location. Never replaces an existing item of the same name.
 gboolean move_item(const gchar *src_path, const gchar *dest_dir);
 
 // Compresses a file or directory into a .zip archive.
 gboolean zip_item(const gchar *src_path, const gchar *dest_zip_path);
 
+// Extracts a .zip archive into a folder. Existing files are never replaced.
+// .tar, .tar.zst and .tar.xz archives are extracted the same way.
+gboolean unzip_item(const gchar *zip_path, const gchar *dest_dir);
+
+// TRUE if `path` names an archive unzip_item() can extract.
+gboolean is_extractable_archive(const gchar *path);
+
+// The file name extension for an archive made with `options` (NULL for the defaults), e.g. ".tar.zst".
+const gchar* archive_extension(const ZipOptions *options);
+
+
+// --- Progress reporting and cancellation ---
+// These are the same operations as above, but they report into an OpProgress as they go
+// and stop early (returning FALSE) once it is cancelled. `progress` may be NULL.
+
+// Sets up and tears down an OpProgress.
+void op_progress_init(OpProgress *progress);
+void op_progress_clear(OpProgress *progress);
+
+// Records that `bytes` more bytes and `files` more items are done.
+void op_progress_add(OpProgress *progress, guint64 bytes, guint files);
+
+// Takes back `bytes` that were recorded as done, for work that failed and will be redone.
+void op_progress_take_back(OpProgress *progress, guint64 bytes);
+
+// Asks the operation to stop. Safe to call from any thread.
+void op_progress_cancel(OpProgress *progress);
+gboolean op_progress_is_cancelled(OpProgress *progress);
+
+// Walks a file or folder and adds its total size and item count to the progress totals.
+void measure_item(const gchar *path, OpProgress *progress);
+
+// A cancelled copy removes whatever it had created at the destination. `options` may be NULL.
+gboolean copy_item_with_options(const gchar *src_path, const gchar *dest_dir, const CopyOptions *options, OpProgress *progress);
+
+// TRUE if an earlier journaled copy of src_path into dest_dir was interrupted and can be resumed.
+gboolean copy_can_resume(const gchar *src_path, const gchar *dest_dir);
+gboolean delete_item_with_progress(const gchar *path, OpProgress *progress);
+// Moving to another file system copies the item, flushes it to disk, and only then deletes
+// the original. A cancelled move leaves the original untouched.
+gboolean move_item_with_progress(const gchar *src_path, const gchar *dest_dir, OpProgress *progress);
+// A cancelled zip leaves no archive behind.
+gboolean zip_item_with_progress(const gchar *src_path, const gchar *dest_zip_path, OpProgress *progress);
+// The same with a choice of compression. `options` and `stats` may be NULL.
+gboolean zip_item_with_options(const gchar *src_path, const gchar *dest_zip_path, const ZipOptions *options, ZipStats *stats, OpProgress *progress);
+// The same, but streams a .zip archive to the open file descriptor `fd` (a pipe, socket or file)
+// without ever seeking it (see zip_writer_new_for_fd() in zipwriter.h). `fd` stays open.
+// options->format must be ARCHIVE_ZIP and options->update is ignored: there is no earlier
+// archive to update.
+gboolean zip_item_to_fd(const gchar *src_path, int fd, const ZipOptions *options, ZipStats *stats, OpProgress *progress);
+// Progress counts bytes of the archive. A cancelled extraction removes what it had created.
+gboolean unzip_item_with_progress(const gchar *zip_path, const gchar *dest_dir, OpProgress *progress);
+// Checks every file in a .zip archive without extracting it (see zip_test() in zipreader.h).
+// The paths of damaged files are added to `corrupt` (if not NULL). Progress counts bytes of
+// the archive. Returns FALSE if any file is damaged or the archive can't be read at all.
+gboolean test_archive_with_progress(const gchar *zip_path, GPtrArray *corrupt, OpProgress *progress);
+
 
 // This ends the include guard block that was started at the top of the file.
 #endif // BACKEND_H
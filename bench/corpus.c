@@ -0,0 +1,79 @@
+/**
+ * @file corpus.c
+ * @brief Writes and removes the benchmark corpus (see corpus.h).
+ */
+
+#include "corpus.h"
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SMALL_FILES 200
+#define BIG_FILE_SIZE (6 * 1024 * 1024)
+
+/**
+ * @brief Fills `buf` with words picked by `rand`, which deflates about as well as source code.
+ */
+static void fill_text(GRand *rand, gchar *buf, gsize len) {
+    static const gchar *words[] = { "file", "folder", "copy", "move", "archive", "delete", "size",
+                                    "return", "static", "const", "gchar", "if", "else", "while",
+                                    "for", "the", "path", "list", "info", "progress", "\n", "    " };
+    gsize pos = 0;
+    while (pos < len) {
+        const gchar *word = words[g_rand_int_range(rand, 0, G_N_ELEMENTS(words))];
+        for (const gchar *c = word; *c && pos < len; c++) buf[pos++] = *c;
+        if (pos < len) buf[pos++] = ' ';
+    }
+}
+
+/**
+ * @brief Fills `buf` with fixed-size records of small, slowly changing numbers and a short tag,
+ * the way program and database files look to a compressor.
+ */
+static void fill_binary(GRand *rand, gchar *buf, gsize len) {
+    guint32 counter = g_rand_int(rand);
+    for (gsize pos = 0; pos < len; pos++) {
+        if (pos % 16 == 0) counter += g_rand_int_range(rand, 0, 64);
+        switch (pos % 16) {
+            case 0: case 1: case 2: case 3: buf[pos] = (gchar)(counter >> (8 * (pos % 4))); break;
+            case 4: case 5: buf[pos] = (gchar)g_rand_int_range(rand, 0, 4); break;
+            case 6: case 7: buf[pos] = 0; break;
+            default: buf[pos] = "REC_DATA"[pos % 8]; break;
+        }
+    }
+}
+
+static void fill_random(GRand *rand, gchar *buf, gsize len) {
+    for (gsize pos = 0; pos < len; pos++) buf[pos] = (gchar)g_rand_int(rand);
+}
+
+guint64 bench_corpus_write(const gchar *dir, gboolean mixed) {
+    if (mkdir(dir, 0755) != 0) return 0;
+    // A fixed seed: every run and every machine gets the same files.
+    GRand *rand = g_rand_new_with_seed(40);
+    gchar *buf = g_malloc(BIG_FILE_SIZE);
+    guint64 total = 0;
+    for (guint i = 0; i < BENCH_CORPUS_FILES; i++) {
+        gsize len = i < SMALL_FILES ? (gsize)g_rand_int_range(rand, 4096, 256 * 1024) : BIG_FILE_SIZE;
+        // In the mixed variant, files 2, 6, 10... hold binary records and 3, 7, 11... random bytes.
+        if (mixed && i % 4 == 2) fill_binary(rand, buf, len);
+        else if (mixed && i % 4 == 3) fill_random(rand, buf, len);
+        else fill_text(rand, buf, len);
+        gchar *file = g_strdup_printf("%s/file-%03u.txt", dir, i);
+        gboolean ok = g_file_set_contents(file, buf, len, NULL);
+        g_free(file);
+        if (!ok) { total = 0; break; }
+        total += len;
+    }
+    g_free(buf);
+    g_rand_free(rand);
+    return total;
+}
+
+void bench_corpus_remove(const gchar *dir) {
+    for (guint i = 0; i < BENCH_CORPUS_FILES; i++) {
+        gchar *file = g_strdup_printf("%s/file-%03u.txt", dir, i);
+        unlink(file);
+        g_free(file);
+    }
+    rmdir(dir);
+}
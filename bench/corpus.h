@@ -0,0 +1,30 @@
+/**
+ * @file corpus.h
+ * @brief The fixed set of files the archive benchmarks compress and extract.
+ *
+ * 200 files of 4 KiB to 256 KiB and 8 of 6 MiB (about 74 MiB in all, the big ones spanning
+ * several ZIP_BLOCK_SIZE blocks), filled with text made from a fixed seed, so every run on
+ * every machine works on the same bytes.
+ *
+ * The mixed variant has the same sizes and names, but only half of the files hold text. A
+ * quarter hold binary records (like program or database files), which deflate less well, and a
+ * quarter hold random bytes, which stand for photos and other already compressed data.
+ */
+
+#ifndef BENCH_CORPUS_H
+#define BENCH_CORPUS_H
+
+#include <glib.h>
+
+// The number of files in the corpus; they are named file-000.txt, file-001.txt, ...
+#define BENCH_CORPUS_FILES 208
+
+// Creates the folder `dir` and writes the corpus into it, the mixed variant if `mixed` is TRUE.
+// Returns the number of bytes written, or 0 if the folder already exists or anything couldn't
+// be written.
+guint64 bench_corpus_write(const gchar *dir, gboolean mixed);
+
+// Deletes the files bench_corpus_write() wrote and the folder itself.
+void bench_corpus_remove(const gchar *dir);
+
+#endif // BENCH_CORPUS_H
@@ -0,0 +1,98 @@
+/**
+ * @file deflate_backends.c
+ * @brief Times the deflate backends of zipdeflate.h on one thread over the same mixed corpus,
+ * to show how many MB/s one core compresses with zlib and with the best backend of the build.
+ *
+ * Usage: bench/deflate_backends SCRATCH_DIR [LEVEL...]
+ *
+ * It writes the mixed benchmark corpus (see corpus.h) to SCRATCH_DIR/deflate-corpus, reads it
+ * into memory, and then compresses every file with each backend at each LEVEL (default 1, 6 and
+ * 9). Files bigger than ZIP_BLOCK_SIZE are compressed block by block, each block on its own, so
+ * every call is the whole-buffer case the zip writer hands to the backend. Only the compressing
+ * is timed, never the reading. Built without libdeflate, the best backend is zlib itself and
+ * both rows show the same thing.
+ */
+
+#include "corpus.h"
+#include "zipdeflate.h"
+#include "zipwriter.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    gchar *data;
+    gsize len;
+} CorpusFile;
+
+/**
+ * @brief Compresses every file of the corpus and prints one line of results.
+ */
+static gboolean time_backend(const ZipDeflateBackend *backend, int level, CorpusFile *files, guint n_files) {
+    guchar *out = g_malloc(backend->bound(ZIP_BLOCK_SIZE));
+    guint64 bytes_in = 0, bytes_out = 0;
+    gint64 start = g_get_monotonic_time();
+    for (guint i = 0; i < n_files; i++) {
+        for (gsize pos = 0; pos < files[i].len; pos += ZIP_BLOCK_SIZE) {
+            gsize len = MIN((gsize)ZIP_BLOCK_SIZE, files[i].len - pos);
+            gsize n = backend->compress((const guchar *)files[i].data + pos, len, out, backend->bound(ZIP_BLOCK_SIZE), level);
+            if (n == 0) {
+                g_free(out);
+                return FALSE;
+            }
+            bytes_in += len;
+            bytes_out += n;
+        }
+    }
+    double seconds = (g_get_monotonic_time() - start) / (double)G_USEC_PER_SEC;
+    printf("%-12s %6d %10.1f %10.1f %9.1f%%\n", backend->name, level, bytes_in / 1e6 / seconds,
+           seconds * 1000, 100.0 * bytes_out / bytes_in);
+    g_free(out);
+    return TRUE;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s SCRATCH_DIR [LEVEL...]\n", argv[0]);
+        return 2;
+    }
+    gchar *corpus = g_build_filename(argv[1], "deflate-corpus", NULL);
+    if (bench_corpus_write(corpus, TRUE) == 0) {
+        fprintf(stderr, "could not write the corpus to %s\n", corpus);
+        return 1;
+    }
+    CorpusFile files[BENCH_CORPUS_FILES];
+    guint64 total = 0;
+    for (guint i = 0; i < BENCH_CORPUS_FILES; i++) {
+        gchar *path = g_strdup_printf("%s/file-%03u.txt", corpus, i);
+        gboolean ok = g_file_get_contents(path, &files[i].data, &files[i].len, NULL);
+        g_free(path);
+        if (!ok) {
+            fprintf(stderr, "could not read the corpus back from %s\n", corpus);
+            return 1;
+        }
+        total += files[i].len;
+    }
+    bench_corpus_remove(corpus);
+
+    int default_levels[] = { 1, 6, 9 };
+    guint n_levels = argc > 2 ? (guint)argc - 2 : G_N_ELEMENTS(default_levels);
+    const ZipDeflateBackend *backends[] = { zip_deflate_zlib(), zip_deflate_best() };
+
+    printf("one thread, mixed corpus of %.1f MB in %d files\n", total / 1e6, BENCH_CORPUS_FILES);
+    printf("%-12s %6s %10s %10s %10s\n", "backend", "level", "MB/s", "ms", "size");
+    int status = 0;
+    for (guint l = 0; l < n_levels && status == 0; l++) {
+        int level = argc > 2 ? atoi(argv[l + 2]) : default_levels[l];
+        for (guint b = 0; b < G_N_ELEMENTS(backends); b++) {
+            if (!time_backend(backends[b], level, files, BENCH_CORPUS_FILES)) {
+                fprintf(stderr, "%s failed to compress at level %d\n", backends[b]->name, level);
+                status = 1;
+                break;
+            }
+        }
+    }
+
+    for (guint i = 0; i < BENCH_CORPUS_FILES; i++) g_free(files[i].data);
+    g_free(corpus);
+    return status;
+}
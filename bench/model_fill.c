@@ -0,0 +1,115 @@
+/**
+ * @file model_fill.c
+ * @brief Times what refreshing the file list costs for big folders: reading the folder with
+ * get_directory_contents() and filling the list store the way refresh_view() does.
+ *
+ * Usage: bench/model_fill SCRATCH_DIR [COUNT...]
+ *
+ * For each COUNT (default 10000 and 100000) it creates a folder of that many empty files in
+ * SCRATCH_DIR, lists it, fills a fresh GtkListStore from the list and deletes the folder again.
+ * A list store is a plain data object and needs no window, so this runs without a display. When a
+ * display is available it also times filling the store while it is attached to a tree view, which
+ * is what refreshing cost before the view was detached during the fill.
+ */
+
+#include "backend.h"
+#include <fcntl.h>
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Creates SCRATCH_DIR/model-fill-N with `count` empty files. Returns its path, or NULL.
+ */
+static gchar* make_folder(const gchar *scratch, guint count) {
+    gchar *folder = g_strdup_printf("%s/model-fill-%u", scratch, count);
+    if (mkdir(folder, 0755) != 0) {
+        g_free(folder);
+        return NULL;
+    }
+    for (guint i = 0; i < count; i++) {
+        gchar *file = g_strdup_printf("%s/file-%06u.txt", folder, i);
+        int fd = open(file, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd >= 0) close(fd);
+        g_free(file);
+    }
+    return folder;
+}
+
+static void remove_folder(const gchar *folder, GList *files) {
+    for (GList *l = files; l != NULL; l = l->next) unlink(((FileInfo *)l->data)->path);
+    rmdir(folder);
+}
+
+/**
+ * @brief Fills `store` from `files` exactly as refresh_view() does and returns the time it took
+ * in milliseconds.
+ */
+static double fill_store(GtkListStore *store, GList *files) {
+    gint64 start = g_get_monotonic_time();
+    for (GList *l = files; l != NULL; l = l->next) {
+        FileInfo *info = (FileInfo *)l->data;
+        gtk_list_store_insert_with_values(store, NULL, -1, 0, info->name, 1, info->size_formatted, 2, info->type, 3, info->modified, 4, info->path, 5, info->is_dir, -1);
+    }
+    return (g_get_monotonic_time() - start) / 1000.0;
+}
+
+static GtkListStore* new_store(void) {
+    // The same columns as the store in main.c.
+    return gtk_list_store_new(6, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_BOOLEAN);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s SCRATCH_DIR [COUNT...]\n", argv[0]);
+        return 2;
+    }
+    // Without a display there is no tree view to attach to, and only the detached fill is timed.
+    gboolean have_display = gtk_init_check(&argc, &argv);
+
+    guint default_counts[] = { 10000, 100000 };
+    guint n_counts = argc > 2 ? (guint)argc - 2 : G_N_ELEMENTS(default_counts);
+
+    printf("%-10s %12s %12s %12s\n", "entries", "list ms", "fill ms", "attached ms");
+    for (guint i = 0; i < n_counts; i++) {
+        guint count = argc > 2 ? (guint)atoi(argv[i + 2]) : default_counts[i];
+        gchar *folder = make_folder(argv[1], count);
+        if (!folder) {
+            fprintf(stderr, "could not create a folder of %u files in %s\n", count, argv[1]);
+            return 1;
+        }
+
+        gint64 start = g_get_monotonic_time();
+        GList *files = get_directory_contents(folder);
+        double list_ms = (g_get_monotonic_time() - start) / 1000.0;
+
+        GtkListStore *store = new_store();
+        double fill_ms = fill_store(store, files);
+        g_object_unref(store);
+
+        printf("%-10u %12.1f %12.1f", count, list_ms, fill_ms);
+        if (have_display) {
+            store = new_store();
+            GtkWidget *view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(store));
+            // A widget outside any window is "floating"; sinking it makes the reference ours.
+            g_object_ref_sink(view);
+            // Same columns as the real view, so the view has rows to measure.
+            const gchar *titles[] = { "Name", "Size", "Type", "Modified" };
+            for (gint c = 0; c < 4; c++)
+                gtk_tree_view_append_column(GTK_TREE_VIEW(view),
+                    gtk_tree_view_column_new_with_attributes(titles[c], gtk_cell_renderer_text_new(), "text", c, NULL));
+            printf(" %12.1f", fill_store(store, files));
+            gtk_widget_destroy(view);
+            g_object_unref(view);
+            g_object_unref(store);
+        }
+        printf("\n");
+
+        remove_folder(folder, files);
+        g_list_free_full(files, free_file_info);
+        g_free(folder);
+    }
+    return 0;
+}
@@ -0,0 +1,103 @@
+/**
+ * @file rmtree_bench.c
+ * @brief Times deleting the same folder tree with io_uring, with worker threads alone, on one
+ * thread, and with the C library's nftw(), so the methods can be compared on a given disk.
+ *
+ * Usage: bench/rmtree_bench SCRATCH_DIR [FILES] [FOLDERS]
+ *
+ * Before each run it creates SCRATCH_DIR/rmtree-bench holding FOLDERS folders (default 100) with
+ * FILES empty files spread over them (default 100000), then deletes it and prints the time. The
+ * disk cache is warm for every method, so the numbers compare the deleting, not the disk.
+ * Deleting on a spinning disk always uses one thread and no io_uring (see rmtree.c), so run it
+ * on an SSD or a tmpfs to see the difference between the methods.
+ */
+
+#define _XOPEN_SOURCE 700
+#include "rmtree.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TREE_NAME "rmtree-bench"
+
+/**
+ * @brief Creates the test tree under `scratch`. Returns FALSE if any of it couldn't be made.
+ */
+static gboolean make_tree(const gchar *scratch, guint files, guint folders) {
+    gchar *root = g_build_filename(scratch, TREE_NAME, NULL);
+    gboolean ok = mkdir(root, 0755) == 0;
+    for (guint d = 0; ok && d < folders; d++) {
+        gchar *folder = g_strdup_printf("%s/d%u", root, d);
+        ok = mkdir(folder, 0755) == 0;
+        // Folder d gets files d, d + folders, d + 2 * folders, ...
+        for (guint f = d; ok && f < files; f += folders) {
+            gchar *file = g_strdup_printf("%s/f%u", folder, f);
+            int fd = open(file, O_WRONLY | O_CREAT | O_EXCL, 0644);
+            ok = fd >= 0;
+            if (fd >= 0) close(fd);
+            g_free(file);
+        }
+        g_free(folder);
+    }
+    g_free(root);
+    return ok;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st; (void)type; (void)ftw;
+    return remove(path);
+}
+
+typedef enum { WITH_URING, WITH_THREADS, SEQUENTIAL, WITH_NFTW } Method;
+
+static const gchar *method_names[] = { "io_uring", "threads", "one thread", "nftw" };
+
+static gboolean delete_tree(Method method, const gchar *scratch) {
+    if (method == WITH_NFTW) {
+        gchar *root = g_build_filename(scratch, TREE_NAME, NULL);
+        // FTW_DEPTH visits a folder after its contents, which is the order deleting needs.
+        gboolean ok = nftw(root, remove_entry, 64, FTW_DEPTH | FTW_PHYS) == 0;
+        g_free(root);
+        return ok;
+    }
+    int parent_fd = open(scratch, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (parent_fd < 0) return FALSE;
+    gboolean ok;
+    switch (method) {
+        case WITH_URING: ok = rmtree_at(parent_fd, TREE_NAME, NULL); break;
+        case WITH_THREADS: ok = rmtree_at_without_uring(parent_fd, TREE_NAME, NULL); break;
+        default: ok = rmtree_at_sequential(parent_fd, TREE_NAME, NULL); break;
+    }
+    close(parent_fd);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s SCRATCH_DIR [FILES] [FOLDERS]\n", argv[0]);
+        return 2;
+    }
+    const gchar *scratch = argv[1];
+    guint files = argc > 2 ? (guint)atoi(argv[2]) : 100000;
+    guint folders = argc > 3 ? MAX((guint)atoi(argv[3]), 1) : 100;
+
+    printf("%u files in %u folders\n", files, folders);
+    printf("%-12s %10s\n", "method", "ms");
+    for (Method method = WITH_URING; method <= WITH_NFTW; method++) {
+        if (!make_tree(scratch, files, folders)) {
+            fprintf(stderr, "could not create the test tree in %s: %s\n", scratch, strerror(errno));
+            return 1;
+        }
+        gint64 start = g_get_monotonic_time();
+        gboolean ok = delete_tree(method, scratch);
+        gint64 elapsed = g_get_monotonic_time() - start;
+        printf("%-12s %10.1f%s\n", method_names[method], elapsed / 1000.0, ok ? "" : "  (failed)");
+        if (!ok) return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,80 @@
+/**
+ * @file unzip_throughput.c
+ * @brief Times extracting the same zip archive with 1, 2, 4, ... threads, to show how the
+ * parallel zip reader scales with the number of cores.
+ *
+ * Usage: bench/unzip_throughput SCRATCH_DIR [MAX_THREADS]
+ *
+ * It writes the benchmark corpus (see corpus.h) to SCRATCH_DIR/unzip-corpus, zips it once into
+ * SCRATCH_DIR/unzip-throughput.zip, and then extracts that archive into SCRATCH_DIR/unzip-out
+ * once per thread count, deleting the extracted files between runs. Throughput is counted in
+ * extracted (uncompressed) bytes. MAX_THREADS defaults to twice the number of CPUs.
+ */
+
+#include "backend.h"
+#include "corpus.h"
+#include "rmtree.h"
+#include "zipreader.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s SCRATCH_DIR [MAX_THREADS]\n", argv[0]);
+        return 2;
+    }
+    gint max_threads = argc > 2 ? atoi(argv[2]) : 2 * (gint)g_get_num_processors();
+    gchar *corpus = g_build_filename(argv[1], "unzip-corpus", NULL);
+    gchar *zip_path = g_build_filename(argv[1], "unzip-throughput.zip", NULL);
+    gchar *out = g_build_filename(argv[1], "unzip-out", NULL);
+
+    guint64 corpus_bytes = bench_corpus_write(corpus, FALSE);
+    if (corpus_bytes == 0) {
+        fprintf(stderr, "could not write the corpus to %s\n", corpus);
+        return 1;
+    }
+    ZipOptions options = { 0 };
+    options.format = ARCHIVE_ZIP;
+    unlink(zip_path);
+    gboolean zipped = zip_item_with_options(corpus, zip_path, &options, NULL, NULL);
+    bench_corpus_remove(corpus);
+    if (!zipped) {
+        fprintf(stderr, "could not zip the corpus into %s\n", zip_path);
+        return 1;
+    }
+
+    int scratch_fd = open(argv[1], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    printf("%u CPUs, %.1f MiB in %d files\n", g_get_num_processors(), corpus_bytes / 1048576.0, BENCH_CORPUS_FILES);
+    printf("%-8s %10s %10s %10s\n", "threads", "ms", "MiB/s", "speedup");
+    double baseline_ms = 0;
+    int status = 0;
+    for (gint threads = 1; threads <= MAX(max_threads, 1); threads *= 2) {
+        if (mkdir(out, 0755) != 0) {
+            fprintf(stderr, "could not create %s\n", out);
+            status = 1;
+            break;
+        }
+        gint64 start = g_get_monotonic_time();
+        gboolean ok = zip_extract(zip_path, out, threads, NULL);
+        double ms = (g_get_monotonic_time() - start) / 1000.0;
+        // The next run must find an empty folder: the reader never replaces existing files.
+        rmtree_at(scratch_fd, "unzip-out", NULL);
+        if (!ok) {
+            fprintf(stderr, "extracting %s failed with %d threads\n", zip_path, threads);
+            status = 1;
+            break;
+        }
+        if (threads == 1) baseline_ms = ms;
+        printf("%-8d %10.1f %10.1f %9.2fx\n", threads, ms, corpus_bytes / 1048576.0 / (ms / 1000.0), baseline_ms / ms);
+    }
+
+    close(scratch_fd);
+    unlink(zip_path);
+    g_free(out);
+    g_free(zip_path);
+    g_free(corpus);
+    return status;
+}
@@ -0,0 +1,62 @@
+/**
+ * @file zip_scaling.c
+ * @brief Times zipping the same folder with 1, 2, 4, ... compressing threads, to show how the
+ * parallel zip writer scales with the number of cores.
+ *
+ * Usage: bench/zip_scaling SCRATCH_DIR [MAX_THREADS] [SOURCE]
+ *
+ * Without SOURCE it first writes the benchmark corpus (see corpus.h) to
+ * SCRATCH_DIR/zip-scaling-corpus, so every run compresses the same bytes. Each run writes
+ * SCRATCH_DIR/zip-scaling.zip at the default level. MAX_THREADS defaults to twice the number of
+ * CPUs. The one-thread run is the serial baseline the others compare to.
+ */
+
+#include "backend.h"
+#include "corpus.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s SCRATCH_DIR [MAX_THREADS] [SOURCE]\n", argv[0]);
+        return 2;
+    }
+    gint max_threads = argc > 2 ? atoi(argv[2]) : 2 * (gint)g_get_num_processors();
+    gchar *corpus = argc > 3 ? g_strdup(argv[3]) : g_build_filename(argv[1], "zip-scaling-corpus", NULL);
+    gchar *zip_path = g_build_filename(argv[1], "zip-scaling.zip", NULL);
+
+    if (argc <= 3 && bench_corpus_write(corpus, FALSE) == 0) {
+        fprintf(stderr, "could not write the corpus to %s\n", corpus);
+        return 1;
+    }
+
+    printf("%u CPUs\n", g_get_num_processors());
+    printf("%-8s %10s %10s %10s %10s\n", "threads", "ms", "MiB/s", "speedup", "cpu s");
+    double baseline_ms = 0;
+    for (gint threads = 1; threads <= MAX(max_threads, 1); threads *= 2) {
+        ZipOptions options = { 0 };
+        options.threads = threads;
+        options.format = ARCHIVE_ZIP;
+        ZipStats stats = { 0 };
+        unlink(zip_path);
+
+        gint64 start = g_get_monotonic_time();
+        gboolean ok = zip_item_with_options(corpus, zip_path, &options, &stats, NULL);
+        double ms = (g_get_monotonic_time() - start) / 1000.0;
+        if (!ok) {
+            fprintf(stderr, "zipping %s failed with %d threads\n", corpus, threads);
+            return 1;
+        }
+        if (threads == 1) baseline_ms = ms;
+        printf("%-8d %10.1f %10.1f %9.2fx %10.2f\n", threads, ms, stats.bytes_in / 1048576.0 / (ms / 1000.0),
+               baseline_ms / ms, stats.cpu_seconds);
+    }
+
+    unlink(zip_path);
+    if (argc <= 3) bench_corpus_remove(corpus);
+    g_free(zip_path);
+    g_free(corpus);
+    return 0;
+}
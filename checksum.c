@@ -0,0 +1,146 @@
+/**
+ * @file checksum.c
+ * @brief Implementation of the XXH64 checksum, following the published XXH64 specification.
+ */
+
+#include "checksum.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// The five 64-bit primes the algorithm is built on.
+#define PRIME1 11400714785074694791ULL
+#define PRIME2 14029467366897019727ULL
+#define PRIME3 1609587929392839161ULL
+#define PRIME4 9650029242287828579ULL
+#define PRIME5 2870177450012600261ULL
+
+// How much is read at a time when checksumming a whole file.
+#define FILE_CHUNK (1024 * 1024)
+
+static inline guint64 rotl64(guint64 x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// The input is defined as little-endian; memcpy avoids unaligned loads.
+static inline guint64 read64(const guchar *p) {
+    guint64 v;
+    memcpy(&v, p, sizeof(v));
+    return GUINT64_FROM_LE(v);
+}
+
+static inline guint32 read32(const guchar *p) {
+    guint32 v;
+    memcpy(&v, p, sizeof(v));
+    return GUINT32_FROM_LE(v);
+}
+
+// Mixes one 8-byte lane into an accumulator.
+static inline guint64 mix_round(guint64 acc, guint64 input) {
+    acc += input * PRIME2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME1;
+}
+
+// Folds one accumulator into the final hash.
+static inline guint64 merge_round(guint64 acc, guint64 val) {
+    acc ^= mix_round(0, val);
+    return acc * PRIME1 + PRIME4;
+}
+
+void checksum_init(Checksum *state) {
+    memset(state, 0, sizeof(*state));
+    state->v[0] = state->seed + PRIME1 + PRIME2;
+    state->v[1] = state->seed + PRIME2;
+    state->v[2] = state->seed;
+    state->v[3] = state->seed - PRIME1;
+}
+
+void checksum_update(Checksum *state, const void *data, gsize len) {
+    const guchar *p = data, *end = p + len;
+    state->total_len += len;
+
+    // Not enough for a whole stripe yet: just remember the bytes.
+    if (state->mem_size + len < 32) {
+        memcpy(state->mem + state->mem_size, p, len);
+        state->mem_size += len;
+        return;
+    }
+    // Complete the stripe left over from the previous call.
+    if (state->mem_size > 0) {
+        memcpy(state->mem + state->mem_size, p, 32 - state->mem_size);
+        p += 32 - state->mem_size;
+        for (int i = 0; i < 4; i++) state->v[i] = mix_round(state->v[i], read64(state->mem + i * 8));
+        state->mem_size = 0;
+    }
+    // The hot loop: four independent lanes, so the CPU can work on them in parallel.
+    guint64 v0 = state->v[0], v1 = state->v[1], v2 = state->v[2], v3 = state->v[3];
+    while (end - p >= 32) {
+        v0 = mix_round(v0, read64(p));
+        v1 = mix_round(v1, read64(p + 8));
+        v2 = mix_round(v2, read64(p + 16));
+        v3 = mix_round(v3, read64(p + 24));
+        p += 32;
+    }
+    state->v[0] = v0; state->v[1] = v1; state->v[2] = v2; state->v[3] = v3;
+    memcpy(state->mem, p, end - p);
+    state->mem_size = end - p;
+}
+
+guint64 checksum_digest(const Checksum *state) {
+    guint64 h;
+    if (state->total_len >= 32) {
+        h = rotl64(state->v[0], 1) + rotl64(state->v[1], 7) + rotl64(state->v[2], 12) + rotl64(state->v[3], 18);
+        for (int i = 0; i < 4; i++) h = merge_round(h, state->v[i]);
+    } else {
+        h = state->seed + PRIME5;
+    }
+    h += state->total_len;
+
+    // Mix in the bytes that did not fill a whole stripe.
+    const guchar *p = state->mem, *end = p + state->mem_size;
+    for (; end - p >= 8; p += 8) {
+        h ^= mix_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME1 + PRIME4;
+    }
+    if (end - p >= 4) {
+        h ^= (guint64)read32(p) * PRIME1;
+        h = rotl64(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= (*p) * PRIME5;
+        h = rotl64(h, 11) * PRIME1;
+    }
+
+    // The final "avalanche" makes every input bit affect every output bit.
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+gboolean checksum_file_uncached(int fd, guint64 *digest) {
+#if defined(__APPLE__)
+    // macOS: ask the kernel not to serve (or keep) this file's data in its cache.
+    fcntl(fd, F_NOCACHE, 1);
+#elif defined(POSIX_FADV_DONTNEED)
+    // Linux and others: throw away the cached pages of the (already flushed) file, so the
+    // reads below have to fetch the data from the disk again.
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    Checksum state;
+    checksum_init(&state);
+    guchar *buf = g_malloc(FILE_CHUNK);
+    ssize_t n;
+    off_t offset = 0;
+    while ((n = pread(fd, buf, FILE_CHUNK, offset)) > 0) {
+        checksum_update(&state, buf, n);
+        offset += n;
+    }
+    g_free(buf);
+    *digest = checksum_digest(&state);
+    return n == 0;
+}
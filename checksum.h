@@ -0,0 +1,37 @@
+/**
+ * @file checksum.h
+ * @brief A fast 64-bit checksum (XXH64) for verifying copies.
+ *
+ * Verifying a copy means checking that the destination holds exactly the bytes that were
+ * read from the source. A cryptographic hash (SHA-256) is much slower than the disk on
+ * fast SSDs; XXH64 processes several gigabytes per second and still makes an accidental
+ * match between two different files practically impossible.
+ *
+ * The checksum is computed incrementally: feed it the data in pieces of any size with
+ * checksum_update(), then read the result with checksum_digest().
+ */
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <glib.h>
+
+// The running state of one checksum. Treat the fields as private.
+typedef struct {
+    guint64 total_len;  // Bytes fed in so far.
+    guint64 v[4];       // Four independent accumulators, one per 8-byte lane of a 32-byte stripe.
+    guint64 seed;
+    guchar mem[32];     // Bytes that don't yet fill a whole stripe.
+    guint mem_size;
+} Checksum;
+
+void checksum_init(Checksum *state);
+void checksum_update(Checksum *state, const void *data, gsize len);
+guint64 checksum_digest(const Checksum *state);
+
+// Reads an open file from the start and computes its checksum, bypassing the page cache
+// where the system allows it, so the bytes come from the disk rather than from memory.
+// The file's data must already have been flushed (fdatasync()). Returns FALSE on a read error.
+gboolean checksum_file_uncached(int fd, guint64 *digest);
+
+#endif // CHECKSUM_H
@@ -0,0 +1,205 @@
+/**
+ * @file copyjournal.c
+ * @brief Implementation of the append-only copy checkpoint journal.
+ *
+ * File layout: an 8-byte magic string, followed by records. Each record is a fixed-size
+ * JournalRecord header immediately followed by the relative path (no terminating '\0').
+ * A record is only written once the data it describes has been flushed to disk, so the
+ * journal never claims more than what actually survived a crash.
+ */
+
+#include "copyjournal.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+// macOS calls the nanosecond timestamp fields by a different name.
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#endif
+
+#define JOURNAL_MAGIC "FMCPYJ01"
+#define JOURNAL_MAGIC_LEN 8
+
+// The two kinds of records.
+#define RECORD_COMPLETE   'C'   // The whole file is on disk.
+#define RECORD_CHECKPOINT 'P'   // The first `offset` bytes are on disk.
+
+// Completed small files are recorded in batches: after this much data, this many files,
+// or this much time, whichever comes first, we flush the destination and write the batch.
+#define BATCH_MAX_BYTES (64 * 1024 * 1024)
+#define BATCH_MAX_FILES 1000
+#define BATCH_MAX_AGE_US (2 * G_USEC_PER_SEC)
+
+// The fixed-size part of a record. All fields are naturally aligned, so there is no padding.
+typedef struct {
+    guint32 type;
+    guint32 path_len;
+    guint64 size;           // The source file's size when the record was written...
+    gint64 mtime_sec;       // ...and its modification time, so changed files are not trusted.
+    gint64 mtime_nsec;
+    guint64 offset;         // Bytes known to be on disk (equal to size for RECORD_COMPLETE).
+} JournalRecord;
+
+struct CopyJournal {
+    int fd;                 // The journal file, opened with O_APPEND.
+    gchar *path;
+    int dest_fd;            // Any fd on the destination file system (not owned).
+    GHashTable *records;    // Records from an earlier run: relative path -> JournalRecord*.
+    GString *batch;         // Serialised "complete" records waiting for the next flush.
+    guint batch_files;
+    guint64 batch_bytes;
+    gint64 batch_started_us;
+};
+
+gchar* copy_journal_path(const gchar *src_path, const gchar *dest_dir) {
+    // One journal per (source, destination) pair, named after a hash of the two paths.
+    gchar *key = g_strconcat(src_path, "\n", dest_dir, NULL);
+    gchar *digest = g_compute_checksum_for_string(G_CHECKSUM_SHA1, key, -1);
+    gchar *dir = g_build_filename(g_get_user_state_dir(), "filemanager", "copy-journals", NULL);
+    g_mkdir_with_parents(dir, 0700);
+    gchar *name = g_strconcat(digest, ".journal", NULL);
+    gchar *path = g_build_filename(dir, name, NULL);
+    g_free(key); g_free(digest); g_free(dir); g_free(name);
+    return path;
+}
+
+/**
+ * @brief Reads all complete records of an existing journal into journal->records.
+ * @return FALSE if the file is missing or is not a journal at all.
+ */
+static gboolean load_records(CopyJournal *journal) {
+    gchar *contents = NULL;
+    gsize length = 0;
+    if (!g_file_get_contents(journal->path, &contents, &length, NULL)) return FALSE;
+    if (length < JOURNAL_MAGIC_LEN || memcmp(contents, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN) != 0) {
+        g_free(contents);
+        return FALSE;
+    }
+    gsize pos = JOURNAL_MAGIC_LEN;
+    // Later records for the same file replace earlier ones. A record cut short by a crash
+    // fails the length check and ends the loop.
+    while (pos + sizeof(JournalRecord) <= length) {
+        JournalRecord rec;
+        memcpy(&rec, contents + pos, sizeof(rec));
+        if (pos + sizeof(rec) + rec.path_len > length) break;
+        gchar *rel_path = g_strndup(contents + pos + sizeof(rec), rec.path_len);
+        g_hash_table_replace(journal->records, rel_path, g_memdup2(&rec, sizeof(rec)));
+        pos += sizeof(rec) + rec.path_len;
+    }
+    g_free(contents);
+    return TRUE;
+}
+
+CopyJournal* copy_journal_open(const gchar *journal_path, gboolean resume, int dest_fd) {
+    CopyJournal *journal = g_new0(CopyJournal, 1);
+    journal->path = g_strdup(journal_path);
+    journal->dest_fd = dest_fd;
+    journal->records = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    journal->batch = g_string_new(NULL);
+    journal->batch_started_us = g_get_monotonic_time();
+
+    if (resume && load_records(journal)) {
+        journal->fd = open(journal_path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    } else {
+        // Start a fresh journal: truncate whatever was there and write the magic string.
+        journal->fd = open(journal_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+        if (journal->fd != -1 && write(journal->fd, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN) != JOURNAL_MAGIC_LEN) {
+            close(journal->fd);
+            journal->fd = -1;
+        }
+    }
+    // Without a journal file the copy still works; it just can't be resumed later.
+    return journal;
+}
+
+/**
+ * @brief Serialises one record (header + path) onto the end of a buffer.
+ */
+static void append_record(GString *buf, guint32 type, const gchar *rel_path, const struct stat *src_st, guint64 offset) {
+    JournalRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.type = type;
+    rec.path_len = strlen(rel_path);
+    rec.size = src_st->st_size;
+    rec.mtime_sec = src_st->st_mtim.tv_sec;
+    rec.mtime_nsec = src_st->st_mtim.tv_nsec;
+    rec.offset = offset;
+    g_string_append_len(buf, (const gchar *)&rec, sizeof(rec));
+    g_string_append_len(buf, rel_path, rec.path_len);
+}
+
+/**
+ * @brief Appends serialised records to the journal with a single write() call.
+ */
+static void write_records(CopyJournal *journal, GString *buf) {
+    if (journal->fd == -1 || buf->len == 0) return;
+    if (write(journal->fd, buf->str, buf->len) != (ssize_t)buf->len) {
+        // A journal we can't write to is worse than none: stop using it.
+        close(journal->fd);
+        journal->fd = -1;
+    }
+}
+
+/**
+ * @brief Makes all batched files durable, then records them as complete. If the flush
+ * fails, the batch is dropped unrecorded and a resumed copy simply copies those files again.
+ */
+static void flush_batch(CopyJournal *journal) {
+    if (journal->batch->len > 0) {
+#ifdef __linux__
+        // syncfs() flushes everything written to the destination file system in one call,
+        // which is far cheaper than an fsync() per small file.
+        gboolean durable = syncfs(journal->dest_fd) == 0;
+#else
+        sync();
+        gboolean durable = TRUE;
+#endif
+        if (durable) write_records(journal, journal->batch);
+        g_string_truncate(journal->batch, 0);
+    }
+    journal->batch_files = 0;
+    journal->batch_bytes = 0;
+    journal->batch_started_us = g_get_monotonic_time();
+}
+
+gboolean copy_journal_lookup(CopyJournal *journal, const gchar *rel_path, const struct stat *src_st,
+                             gboolean *complete, guint64 *offset) {
+    JournalRecord *rec = g_hash_table_lookup(journal->records, rel_path);
+    if (!rec) return FALSE;
+    // If the source changed since the record was written, the copied bytes can't be trusted.
+    if (rec->size != (guint64)src_st->st_size || rec->mtime_sec != src_st->st_mtim.tv_sec
+        || rec->mtime_nsec != src_st->st_mtim.tv_nsec) return FALSE;
+    *complete = (rec->type == RECORD_COMPLETE);
+    *offset = rec->offset;
+    return TRUE;
+}
+
+void copy_journal_checkpoint(CopyJournal *journal, const gchar *rel_path, const struct stat *src_st, guint64 offset) {
+    GString *buf = g_string_new(NULL);
+    append_record(buf, RECORD_CHECKPOINT, rel_path, src_st, offset);
+    write_records(journal, buf);
+    g_string_free(buf, TRUE);
+}
+
+void copy_journal_file_done(CopyJournal *journal, const gchar *rel_path, const struct stat *src_st) {
+    append_record(journal->batch, RECORD_COMPLETE, rel_path, src_st, src_st->st_size);
+    journal->batch_files++;
+    journal->batch_bytes += src_st->st_size;
+    if (journal->batch_files >= BATCH_MAX_FILES || journal->batch_bytes >= BATCH_MAX_BYTES
+        || g_get_monotonic_time() - journal->batch_started_us >= BATCH_MAX_AGE_US)
+        flush_batch(journal);
+}
+
+void copy_journal_close(CopyJournal *journal, gboolean remove) {
+    if (!journal) return;
+    if (!remove) flush_batch(journal);
+    if (journal->fd != -1) close(journal->fd);
+    if (remove) unlink(journal->path);
+    g_hash_table_destroy(journal->records);
+    g_string_free(journal->batch, TRUE);
+    g_free(journal->path);
+    g_free(journal);
+}
@@ -0,0 +1,50 @@
+/**
+ * @file copyjournal.h
+ * @brief An on-disk checkpoint journal that lets an interrupted copy pick up where it stopped.
+ *
+ * While a journaled copy runs, it appends small records to a journal file:
+ *   - "complete" records for files that are fully copied and safely on disk, and
+ *   - "checkpoint" records for big files, saying how many bytes are safely on disk so far.
+ * Every record also stores the source file's size and modification time, so a file that
+ * changed since the interrupted run is copied again instead of being trusted.
+ *
+ * The journal only ever grows by appending. If the machine crashes in the middle of writing
+ * a record, the incomplete record at the end is simply ignored on the next run.
+ */
+
+#ifndef COPYJOURNAL_H
+#define COPYJOURNAL_H
+
+#include <glib.h>
+#include <sys/stat.h>
+
+typedef struct CopyJournal CopyJournal;
+
+// The journal file used for copying src_path into dest_dir. It lives in the user's state
+// directory (not in the destination), so it never shows up in the copied tree.
+gchar* copy_journal_path(const gchar *src_path, const gchar *dest_dir);
+
+// Opens a journal. With `resume`, the existing records are loaded first and new records are
+// appended; otherwise the journal starts out empty. `dest_fd` is any fd on the destination
+// file system; it is used to flush copied data to disk before it is recorded as done.
+CopyJournal* copy_journal_open(const gchar *journal_path, gboolean resume, int dest_fd);
+
+// Looks up what an earlier run recorded for `rel_path`, if the source still matches `src_st`.
+// Returns FALSE if there is no usable record. Otherwise *complete says whether the file was
+// finished, and *offset how many bytes of it are known to be on disk.
+gboolean copy_journal_lookup(CopyJournal *journal, const gchar *rel_path, const struct stat *src_st,
+                             gboolean *complete, guint64 *offset);
+
+// Records that the first `offset` bytes of a file are on disk. The caller must have called
+// fdatasync() on the destination file first.
+void copy_journal_checkpoint(CopyJournal *journal, const gchar *rel_path, const struct stat *src_st, guint64 offset);
+
+// Records that a file is completely copied. Small files are batched: their records are
+// written after the next flush of the destination file system.
+void copy_journal_file_done(CopyJournal *journal, const gchar *rel_path, const struct stat *src_st);
+
+// Closes the journal, flushing batched records first. With `remove`, the journal file is
+// deleted (used once the copy has finished or was deliberately cancelled).
+void copy_journal_close(CopyJournal *journal, gboolean remove);
+
+#endif // COPYJOURNAL_H
@@ -0,0 +1,277 @@
+/**
+ * @file delta.c
+ * @brief Implementation of rsync-style delta updates for big files.
+ *
+ * Both files are memory-mapped, so the checksum window can slide over the source one byte
+ * at a time without any buffering logic. Because the old and the new file are both local,
+ * a weak checksum hit is confirmed by comparing the actual bytes: rsync needs a second,
+ * strong hash only because its two files live on different machines.
+ */
+
+#include "delta.h"
+#include "checksum.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>   // Provides FICLONE for sharing an existing file's blocks.
+#endif
+
+// macOS calls the nanosecond timestamp fields by a different name.
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#endif
+
+// Block sizes are powers of two between these bounds, so blocks line up with file system blocks.
+#define DELTA_MIN_BLOCK (4 * 1024)
+#define DELTA_MAX_BLOCK (1024 * 1024)
+// Changed bytes are written out at least this often, which also bounds how long a cancel takes.
+#define LITERAL_FLUSH (1024 * 1024)
+#define NO_BLOCK G_MAXUINT32
+
+// Everything one delta update works with.
+typedef struct {
+    const guchar *src;      // The new contents (the mapped source file).
+    gsize src_len;
+    const guchar *old;      // The old contents (the mapped destination file).
+    int old_fd;
+    gsize block;            // The block size used to index the old file.
+    guint32 n_blocks;       // Number of complete blocks in the old file.
+    guint32 *weaks;         // The rolling checksum of each old block.
+    guint32 *next;          // Chains old blocks that share a checksum: next[i] is the next one, or NO_BLOCK.
+    GHashTable *heads;      // Checksum -> (first block with that checksum) + 1.
+    int out_fd;             // The temporary file the new version is built in.
+    guint64 out_pos;        // How much of the new version has been produced.
+    gboolean cloned;        // The temporary file started out sharing the old file's blocks.
+    OpProgress *progress;
+    guint64 reported;       // Bytes added to `progress` so far, taken back if the update fails.
+} DeltaUpdate;
+
+/**
+ * @brief Reports `bytes` more of the new version as done.
+ */
+static void report_progress(DeltaUpdate *d, guint64 bytes) {
+    op_progress_add(d->progress, bytes, 0);
+    d->reported += bytes;
+}
+
+/**
+ * @brief Picks the block size: roughly the square root of the file size, like rsync
+ * (a 1 GiB file gets 32 KiB blocks). Bigger blocks mean a smaller index, smaller blocks
+ * mean less data rewritten around each change.
+ */
+static gsize choose_block_size(guint64 size) {
+    gsize block = DELTA_MIN_BLOCK;
+    while (block < DELTA_MAX_BLOCK && (guint64)block * block < size) block *= 2;
+    return block;
+}
+
+/**
+ * @brief Computes rsync's rolling checksum of a block from scratch.
+ * `a` is the plain sum of the bytes and `b` the sum weighted by distance from the end;
+ * only their low 16 bits matter, so unsigned overflow is harmless.
+ */
+static void block_sum(const guchar *p, gsize len, guint32 *a, guint32 *b) {
+    guint32 sa = 0, sb = 0;
+    for (gsize i = 0; i < len; i++) {
+        sa += p[i];
+        sb += (guint32)(len - i) * p[i];
+    }
+    *a = sa;
+    *b = sb;
+}
+
+static guint32 weak_value(guint32 a, guint32 b) {
+    return (a & 0xffff) | (b << 16);
+}
+
+/**
+ * @brief Reads the old file block by block and indexes every complete block by its checksum.
+ */
+static void build_index(DeltaUpdate *d, gsize old_len) {
+    d->n_blocks = old_len / d->block;
+    d->weaks = g_new(guint32, MAX(d->n_blocks, 1));
+    d->next = g_new(guint32, MAX(d->n_blocks, 1));
+    d->heads = g_hash_table_new(g_direct_hash, g_direct_equal);
+    // Walking backwards leaves every chain in ascending block order.
+    for (guint32 i = d->n_blocks; i-- > 0;) {
+        guint32 a, b;
+        block_sum(d->old + (gsize)i * d->block, d->block, &a, &b);
+        d->weaks[i] = weak_value(a, b);
+        gpointer key = GUINT_TO_POINTER(d->weaks[i]);
+        d->next[i] = GPOINTER_TO_UINT(g_hash_table_lookup(d->heads, key)) - 1;
+        g_hash_table_insert(d->heads, key, GUINT_TO_POINTER(i + 1));
+    }
+}
+
+/**
+ * @brief Looks for an old block with exactly the bytes of the window at `pos`.
+ * @return The block's index, or NO_BLOCK.
+ */
+static guint32 find_block(DeltaUpdate *d, gsize pos, guint32 weak) {
+    const guchar *window = d->src + pos;
+    // Try the block at the same offset first: in a cloned output it is already in place.
+    if (pos % d->block == 0 && pos / d->block < d->n_blocks) {
+        guint32 same = pos / d->block;
+        if (d->weaks[same] == weak && memcmp(window, d->old + pos, d->block) == 0) return same;
+    }
+    guint32 i = GPOINTER_TO_UINT(g_hash_table_lookup(d->heads, GUINT_TO_POINTER(weak))) - 1;
+    for (; i != NO_BLOCK; i = d->next[i])
+        if (memcmp(window, d->old + (gsize)i * d->block, d->block) == 0) return i;
+    return NO_BLOCK;
+}
+
+/**
+ * @brief Writes changed bytes of the source to the new version.
+ */
+static gboolean emit_literal(DeltaUpdate *d, gsize from, gsize len) {
+    while (len > 0) {
+        ssize_t n = pwrite(d->out_fd, d->src + from, MIN(len, (gsize)LITERAL_FLUSH), d->out_pos);
+        if (n <= 0) return FALSE;
+        from += n; len -= n; d->out_pos += n;
+        report_progress(d, n);
+    }
+    return !op_progress_is_cancelled(d->progress);
+}
+
+/**
+ * @brief Puts an unchanged old block at the current position of the new version.
+ */
+static gboolean emit_block(DeltaUpdate *d, guint32 index) {
+    off_t from = (off_t)index * d->block, to = d->out_pos;
+    gsize len = d->block;
+    // A clone of the old file already holds this block at this offset: nothing to write.
+    if (!(d->cloned && (guint64)from == d->out_pos)) {
+#ifdef __linux__
+        // copy_file_range() copies inside the kernel, and on file systems with shared extents
+        // (btrfs, XFS) it just points the new file at the old block instead of copying it.
+        while (len > 0) {
+            ssize_t n = copy_file_range(d->old_fd, &from, d->out_fd, &to, len, 0);
+            if (n <= 0) break;
+            len -= n;
+        }
+#endif
+        // Without copy_file_range() (or if it refused), write the bytes from the mapping.
+        if (len > 0 && pwrite(d->out_fd, d->old + from, len, to) != (ssize_t)len) return FALSE;
+    }
+    d->out_pos += d->block;
+    report_progress(d, d->block);
+    return TRUE;
+}
+
+/**
+ * @brief Slides a block-sized window over the source, producing the new version as a
+ * sequence of old blocks and changed bytes.
+ */
+static gboolean build_new_version(DeltaUpdate *d) {
+    gsize pos = 0, literal_start = 0, B = d->block;
+    guint32 a = 0, b = 0;
+    gboolean have_sum = FALSE;
+
+    while (pos + B <= d->src_len) {
+        if (!have_sum) { block_sum(d->src + pos, B, &a, &b); have_sum = TRUE; }
+        guint32 index = find_block(d, pos, weak_value(a, b));
+        if (index != NO_BLOCK) {
+            if (!emit_literal(d, literal_start, pos - literal_start) || !emit_block(d, index)) return FALSE;
+            pos += B;
+            literal_start = pos;
+            have_sum = FALSE;
+            continue;
+        }
+        if (pos - literal_start >= LITERAL_FLUSH) {
+            if (!emit_literal(d, literal_start, pos - literal_start)) return FALSE;
+            literal_start = pos;
+        }
+        // Roll the window one byte forward: drop the first byte, add the next one.
+        if (pos + B < d->src_len) {
+            a = a - d->src[pos] + d->src[pos + B];
+            b = b - (guint32)B * d->src[pos] + a;
+        }
+        pos++;
+    }
+    // Whatever is left after the last matched block (including a short tail) is new data.
+    return emit_literal(d, literal_start, d->src_len - literal_start);
+}
+
+/**
+ * @brief Checks that the (flushed) new version on disk matches the source.
+ * The source is mapped and has just been scanned, so checksumming it reads from memory.
+ */
+static gboolean verify_new_version(DeltaUpdate *d) {
+    Checksum checksum;
+    checksum_init(&checksum);
+    checksum_update(&checksum, d->src, d->src_len);
+    guint64 digest;
+    return checksum_file_uncached(d->out_fd, &digest) && digest == checksum_digest(&checksum);
+}
+
+gboolean delta_update_file(int src_fd, const struct stat *src_st, int dst_dir_fd, const gchar *dst_name,
+                           gboolean verify, OpProgress *progress) {
+    DeltaUpdate d;
+    memset(&d, 0, sizeof(d));
+    d.progress = progress;
+    d.src_len = src_st->st_size;
+    d.out_fd = -1;
+
+    struct stat old_st;
+    d.old_fd = openat(dst_dir_fd, dst_name, O_RDONLY | O_CLOEXEC);
+    if (d.old_fd == -1) return FALSE;
+    if (fstat(d.old_fd, &old_st) != 0 || !S_ISREG(old_st.st_mode) || old_st.st_size == 0 || d.src_len == 0) {
+        close(d.old_fd);
+        return FALSE;
+    }
+    gsize old_len = old_st.st_size;
+    d.block = choose_block_size(MAX(d.src_len, old_len));
+
+    d.src = mmap(NULL, d.src_len, PROT_READ, MAP_PRIVATE, src_fd, 0);
+    d.old = mmap(NULL, old_len, PROT_READ, MAP_PRIVATE, d.old_fd, 0);
+    gchar *tmp_name = g_strconcat(".", dst_name, ".fmdelta", NULL);
+    gboolean ok = (d.src != MAP_FAILED && d.old != MAP_FAILED);
+    if (ok) {
+        // The source is read front to back; the old file is read front to back once for the
+        // index and then jumped around in.
+        madvise((void *)d.src, d.src_len, MADV_SEQUENTIAL);
+        // A temporary file left behind by a crash is useless: start over.
+        unlinkat(dst_dir_fd, tmp_name, 0);
+        d.out_fd = openat(dst_dir_fd, tmp_name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        ok = (d.out_fd != -1);
+    }
+    if (ok) {
+#ifdef FICLONE
+        // Where the file system supports it, start the new version as a clone of the old one:
+        // it shares all of the old blocks, and only changed blocks are actually written.
+        d.cloned = (ioctl(d.out_fd, FICLONE, d.old_fd) == 0);
+#endif
+        build_index(&d, old_len);
+        ok = build_new_version(&d);
+    }
+    if (ok) {
+        // Give the new version the old file's permissions and the source's modification time,
+        // make sure it is on disk, and only then let it replace the old file. The rename itself
+        // is only on disk once the directory is synced too; before that, a crash could bring
+        // back the old name pointing at the old file, or lose the new one.
+        struct timespec times[2] = { { 0, UTIME_OMIT }, src_st->st_mtim };
+        ok = ftruncate(d.out_fd, d.src_len) == 0 && fchmod(d.out_fd, old_st.st_mode & 07777) == 0
+             && futimens(d.out_fd, times) == 0 && fdatasync(d.out_fd) == 0
+             && (!verify || verify_new_version(&d))
+             && renameat(dst_dir_fd, tmp_name, dst_dir_fd, dst_name) == 0
+             && fsync(dst_dir_fd) == 0;
+    }
+    if (!ok && d.out_fd != -1) unlinkat(dst_dir_fd, tmp_name, 0);
+    // The caller copies the whole file after a failure, which reports all its bytes again.
+    if (!ok) op_progress_take_back(progress, d.reported);
+
+    if (d.out_fd != -1) close(d.out_fd);
+    if (d.src != MAP_FAILED && d.src) munmap((void *)d.src, d.src_len);
+    if (d.old != MAP_FAILED && d.old) munmap((void *)d.old, old_len);
+    if (d.heads) g_hash_table_destroy(d.heads);
+    g_free(d.weaks);
+    g_free(d.next);
+    g_free(tmp_name);
+    close(d.old_fd);
+    return ok;
+}
@@ -0,0 +1,36 @@
+/**
+ * @file delta.h
+ * @brief Block-level "delta" updates of big files, in the style of rsync.
+ *
+ * When a big file changed only a little (a VM disk, a database), copying all of it again
+ * wastes time and wears out the destination disk. A delta update instead:
+ *   1. splits the old destination file into fixed-size blocks and indexes each block by a
+ *      cheap "rolling" checksum,
+ *   2. slides a window over the source file, using the same checksum to find every block
+ *      the destination already has (even if it moved to a different offset), and
+ *   3. builds the new version from those old blocks plus the bytes that really changed.
+ *
+ * The new version is built in a temporary file next to the destination and renamed over it
+ * at the end, so a crash leaves either the complete old file or the complete new one.
+ */
+
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <glib.h>
+#include <sys/stat.h>
+#include "backend.h"
+
+// Files smaller than this are simply copied: a delta would not save anything noticeable.
+#define DELTA_MIN_SIZE (16 * 1024 * 1024)
+
+// Updates the existing regular file `dst_name` (in the directory `dst_dir_fd`) to match the
+// source file `src_fd`, whose metadata is `src_st`. The destination ends up with the
+// source's contents and modification time, and keeps its own permissions. With `verify`, the
+// new version is read back from the disk and checked before it replaces the old file.
+// Returns FALSE if the update failed or was cancelled; the destination is then unchanged, and
+// the bytes it reported to `progress` are taken back.
+gboolean delta_update_file(int src_fd, const struct stat *src_st, int dst_dir_fd, const gchar *dst_name,
+                           gboolean verify, OpProgress *progress);
+
+#endif // DELTA_H
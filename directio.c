@@ -0,0 +1,150 @@
+/**
+ * @file directio.c
+ * @brief Implementation of the double-buffered direct I/O copy.
+ *
+ * Two aligned buffers take turns: while the calling thread writes one of them, a reader
+ * thread fills the other. Each buffer is either "empty" (the reader may fill it) or "full"
+ * (the writer may drain it), and a mutex/condition pair hands them back and forth.
+ */
+
+#include "directio.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+// Size of each of the two buffers (a multiple of DIRECT_IO_ALIGN).
+#define DIRECT_IO_CHUNK (4 * 1024 * 1024)
+
+// The state shared by the reader thread and the writer.
+typedef struct {
+    int src_fd;
+    guint64 offset;         // Where the reader reads next.
+    guchar *buf[2];
+    gssize len[2];          // Bytes in a full buffer: 0 at the end of the file, -1 on a read error.
+    gboolean full[2];
+    gboolean stop;          // Set by the writer when it gives up early.
+    GMutex lock;
+    GCond cond;
+} DirectPipe;
+
+gboolean direct_io_enable(int fd, gboolean enable) {
+#if defined(__APPLE__)
+    // macOS has no O_DIRECT; F_NOCACHE gives the same "don't keep this in the cache" behaviour.
+    return fcntl(fd, F_NOCACHE, enable ? 1 : 0) == 0;
+#elif defined(O_DIRECT)
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1) return FALSE;
+    flags = enable ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+    return fcntl(fd, F_SETFL, flags) == 0;
+#else
+    return FALSE;
+#endif
+}
+
+/**
+ * @brief Fills `buf` with up to `len` bytes from `offset`. A single pread() may return less
+ * than asked for in the middle of a file (NFS, FUSE and CIFS do, and so can direct I/O), so
+ * it keeps reading until the buffer is full or the file ends.
+ * @return The bytes read (fewer than `len` only at the end of the file), or -1 on an error.
+ */
+static gssize read_chunk(int fd, guchar *buf, gsize len, guint64 offset) {
+    gsize done = 0;
+    while (done < len) {
+        gssize n = pread(fd, buf + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        done += n;
+    }
+    return done;
+}
+
+/**
+ * @brief The reader thread: fills the buffers in turn until the end of the file.
+ */
+static gpointer reader_thread(gpointer data) {
+    DirectPipe *pipe = data;
+    for (int i = 0;; i ^= 1) {
+        g_mutex_lock(&pipe->lock);
+        while (pipe->full[i] && !pipe->stop) g_cond_wait(&pipe->cond, &pipe->lock);
+        gboolean stop = pipe->stop;
+        g_mutex_unlock(&pipe->lock);
+        if (stop) break;
+
+        // The read happens without the lock held, so the writer can work at the same time.
+        // Only the last chunk of the file comes back short.
+        gssize n = read_chunk(pipe->src_fd, pipe->buf[i], DIRECT_IO_CHUNK, pipe->offset);
+        if (n > 0) pipe->offset += n;
+
+        g_mutex_lock(&pipe->lock);
+        pipe->len[i] = n < 0 ? -1 : n;
+        pipe->full[i] = TRUE;
+        g_cond_broadcast(&pipe->cond);
+        g_mutex_unlock(&pipe->lock);
+        // A short read means we reached the end; an error ends the copy as well.
+        if (n < DIRECT_IO_CHUNK) break;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Writes one chunk. Only whole blocks can be written with direct I/O, so an
+ * unaligned tail (the last few bytes of the file) is written after switching it off.
+ */
+static gboolean write_chunk(int dst_fd, const guchar *data, gsize len, guint64 offset) {
+    gsize aligned = len - len % DIRECT_IO_ALIGN;
+    if (aligned > 0 && pwrite(dst_fd, data, aligned, offset) != (gssize)aligned) return FALSE;
+    if (aligned == len) return TRUE;
+    return direct_io_enable(dst_fd, FALSE)
+           && pwrite(dst_fd, data + aligned, len - aligned, offset + aligned) == (gssize)(len - aligned);
+}
+
+gboolean direct_copy(int src_fd, int dst_fd, guint64 offset, DirectCopyFunc func, gpointer user_data) {
+    DirectPipe pipe;
+    memset(&pipe, 0, sizeof(pipe));
+    pipe.src_fd = src_fd;
+    pipe.offset = offset;
+    // Direct I/O needs buffers that start on a block boundary; g_malloc() doesn't promise that.
+    if (posix_memalign((void **)&pipe.buf[0], DIRECT_IO_ALIGN, DIRECT_IO_CHUNK) != 0) return FALSE;
+    if (posix_memalign((void **)&pipe.buf[1], DIRECT_IO_ALIGN, DIRECT_IO_CHUNK) != 0) {
+        free(pipe.buf[0]);
+        return FALSE;
+    }
+    g_mutex_init(&pipe.lock);
+    g_cond_init(&pipe.cond);
+    GThread *reader = g_thread_new("direct-io-reader", reader_thread, &pipe);
+
+    gboolean ok = TRUE;
+    for (int i = 0;; i ^= 1) {
+        g_mutex_lock(&pipe.lock);
+        while (!pipe.full[i]) g_cond_wait(&pipe.cond, &pipe.lock);
+        gssize n = pipe.len[i];
+        g_mutex_unlock(&pipe.lock);
+
+        if (n <= 0) { ok = (n == 0); break; }
+        if (!write_chunk(dst_fd, pipe.buf[i], n, offset) || !func(pipe.buf[i], n, user_data)) { ok = FALSE; break; }
+        offset += n;
+        if (n < DIRECT_IO_CHUNK) break;   // That was the last chunk.
+
+        // Hand the buffer back to the reader.
+        g_mutex_lock(&pipe.lock);
+        pipe.full[i] = FALSE;
+        g_cond_broadcast(&pipe.cond);
+        g_mutex_unlock(&pipe.lock);
+    }
+
+    // Wake the reader if it is waiting for a buffer, and wait for it to finish.
+    g_mutex_lock(&pipe.lock);
+    pipe.stop = TRUE;
+    g_cond_broadcast(&pipe.cond);
+    g_mutex_unlock(&pipe.lock);
+    g_thread_join(reader);
+
+    g_mutex_clear(&pipe.lock);
+    g_cond_clear(&pipe.cond);
+    free(pipe.buf[0]);
+    free(pipe.buf[1]);
+    return ok;
+}
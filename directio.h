@@ -0,0 +1,38 @@
+/**
+ * @file directio.h
+ * @brief Copying huge files around the page cache (O_DIRECT).
+ *
+ * Normally every byte we copy passes through the kernel's page cache. For a file of a few
+ * hundred gigabytes that pushes everything else out of memory, and other programs on the
+ * machine suddenly have to read their data from disk again. With direct I/O the data goes
+ * straight between the disk and our own buffers instead.
+ *
+ * Direct I/O has strict rules: buffers, file offsets and transfer sizes must be multiples
+ * of the disk's block size. This module takes care of that, and keeps both disks busy by
+ * reading the next chunk on a helper thread while the current one is being written.
+ */
+
+#ifndef DIRECTIO_H
+#define DIRECTIO_H
+
+#include <glib.h>
+
+// Files at least this big are copied with direct I/O.
+#define DIRECT_IO_MIN_SIZE (1024ULL * 1024 * 1024)
+
+// Direct I/O offsets must be multiples of this (a safe value for 512-byte and 4 KiB disks).
+#define DIRECT_IO_ALIGN 4096
+
+// Switches direct I/O on or off for an open file. Returns FALSE if the file system doesn't
+// support it (tmpfs, for example); the file is then left as it was.
+gboolean direct_io_enable(int fd, gboolean enable);
+
+// Called after each chunk has been written. Return FALSE to stop the copy (e.g. on cancel).
+typedef gboolean (*DirectCopyFunc)(const guchar *data, gsize len, gpointer user_data);
+
+// Copies src_fd to dst_fd from `offset` (a multiple of DIRECT_IO_ALIGN) to the end of the
+// source. Both files must have direct I/O enabled. Returns TRUE if the end was reached,
+// FALSE on an I/O error or when `func` asked to stop.
+gboolean direct_copy(int src_fd, int dst_fd, guint64 offset, DirectCopyFunc func, gpointer user_data);
+
+#endif // DIRECTIO_H
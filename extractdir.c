@@ -0,0 +1,142 @@
+/**
+ * @file extractdir.c
+ * @brief Implementation of the extraction destination (see extractdir.h).
+ */
+
+#include "extractdir.h"
+#include "rmtree.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+// What extract_dir_make() found for each folder path.
+#define DIR_CREATED 1       // We made it, so everything inside it is ours too.
+#define DIR_EXISTED 2       // It was already there.
+
+struct ExtractDir {
+    int fd;                 // The destination folder.
+    GHashTable *dirs;       // Folder path -> DIR_CREATED or DIR_EXISTED. Read-only once workers run.
+    GMutex lock;            // Protects `roots`.
+    GPtrArray *roots;       // Created items whose folder was already there: what a cancel removes.
+};
+
+gchar* archive_entry_path(const gchar *name, gsize len) {
+    if (len == 0 || name[0] == '/' || name[0] == '\\' || memchr(name, '\0', len)) return NULL;
+    // The clean path is never longer than the name. This runs for every entry of archives
+    // that can have hundreds of thousands, so it works on the characters directly.
+    gchar *path = g_malloc(len + 1);
+    gsize out = 0;
+    for (gsize start = 0; start < len;) {
+        gsize end = start;
+        while (end < len && name[end] != '/' && name[end] != '\\') end++;
+        gsize part_len = end - start;
+        const gchar *part = name + start;
+        start = end + 1;
+        if (part_len == 0 || (part_len == 1 && part[0] == '.')) continue;
+        if (part_len == 2 && part[0] == '.' && part[1] == '.') { g_free(path); return NULL; }
+        if (out > 0) path[out++] = '/';
+        memcpy(path + out, part, part_len);
+        out += part_len;
+    }
+    path[out] = '\0';
+    if (out == 0) { g_free(path); return NULL; }
+    return path;
+}
+
+ExtractDir* extract_dir_new(const gchar *dest_dir) {
+    int fd = open(dest_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) return NULL;
+    ExtractDir *dir = g_new0(ExtractDir, 1);
+    dir->fd = fd;
+    dir->dirs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    g_hash_table_insert(dir->dirs, g_strdup(""), GINT_TO_POINTER(DIR_EXISTED));
+    g_mutex_init(&dir->lock);
+    dir->roots = g_ptr_array_new_with_free_func(g_free);
+    return dir;
+}
+
+void extract_dir_free(ExtractDir *dir) {
+    if (!dir) return;
+    close(dir->fd);
+    g_hash_table_destroy(dir->dirs);
+    g_mutex_clear(&dir->lock);
+    g_ptr_array_free(dir->roots, TRUE);
+    g_free(dir);
+}
+
+gchar* extract_dir_split(const gchar *path, const gchar **base) {
+    const gchar *slash = strrchr(path, '/');
+    *base = slash ? slash + 1 : path;
+    return slash ? g_strndup(path, slash - path) : g_strdup("");
+}
+
+int extract_dir_open(ExtractDir *dir, const gchar *path) {
+    int fd = fcntl(dir->fd, F_DUPFD_CLOEXEC, 0);
+    gchar **parts = g_strsplit(path, "/", -1);
+    for (gchar **part = parts; fd != -1 && *part; part++) {
+        if (**part == '\0') continue;
+        int next = openat(fd, *part, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        close(fd);
+        fd = next;
+    }
+    g_strfreev(parts);
+    return fd;
+}
+
+static gboolean created_by_us(ExtractDir *dir, const gchar *path) {
+    return GPOINTER_TO_INT(g_hash_table_lookup(dir->dirs, path)) == DIR_CREATED;
+}
+
+void extract_dir_created(ExtractDir *dir, const gchar *path) {
+    const gchar *base;
+    gchar *parent = extract_dir_split(path, &base);
+    // Inside a folder we created, the folder itself is already on the list.
+    if (!created_by_us(dir, parent)) {
+        g_mutex_lock(&dir->lock);
+        g_ptr_array_add(dir->roots, g_strdup(path));
+        g_mutex_unlock(&dir->lock);
+    }
+    g_free(parent);
+}
+
+gboolean extract_dir_make(ExtractDir *dir, const gchar *path, guint32 mode) {
+    if (g_hash_table_contains(dir->dirs, path)) return TRUE;
+    const gchar *base;
+    gchar *parent = extract_dir_split(path, &base);
+    int parent_fd = extract_dir_make(dir, parent, 0) ? extract_dir_open(dir, parent) : -1;
+    gboolean ok = FALSE;
+    if (parent_fd != -1) {
+        if (mkdirat(parent_fd, base, mode ? (mode & 0777) | 0700 : 0777) == 0) {
+            extract_dir_created(dir, path);
+            g_hash_table_insert(dir->dirs, g_strdup(path), GINT_TO_POINTER(DIR_CREATED));
+            ok = TRUE;
+        } else if (errno == EEXIST) {
+            // A folder that is already there is used as it is, but only a real one, not a symlink.
+            int fd = openat(parent_fd, base, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (fd != -1) {
+                close(fd);
+                g_hash_table_insert(dir->dirs, g_strdup(path), GINT_TO_POINTER(DIR_EXISTED));
+                ok = TRUE;
+            }
+        }
+        close(parent_fd);
+    }
+    g_free(parent);
+    return ok;
+}
+
+void extract_dir_remove_created(ExtractDir *dir) {
+    for (guint i = 0; i < dir->roots->len; i++) {
+        const gchar *base;
+        gchar *parent = extract_dir_split(g_ptr_array_index(dir->roots, i), &base);
+        int parent_fd = extract_dir_open(dir, parent);
+        if (parent_fd != -1) {
+            rmtree_at(parent_fd, base, NULL);
+            close(parent_fd);
+        }
+        g_free(parent);
+    }
+    g_ptr_array_set_size(dir->roots, 0);
+}
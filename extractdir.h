@@ -0,0 +1,51 @@
+/**
+ * @file extractdir.h
+ * @brief The destination folder of an extraction, shared by the zip and tar readers.
+ *
+ * Archives are made by strangers, so the destination is handled carefully. Folders are opened
+ * one path component at a time without following symlinks, so a symlink already in the
+ * destination can't redirect a file somewhere else, and folders that are already there are
+ * used as they are. Everything the extraction creates itself is remembered, so a cancelled
+ * extraction can remove exactly that and leave what was there before untouched.
+ *
+ * Paths are relative to the destination, with "/" between components, and must already be
+ * checked (see archive_entry_path()).
+ */
+
+#ifndef EXTRACTDIR_H
+#define EXTRACTDIR_H
+
+#include <glib.h>
+
+typedef struct ExtractDir ExtractDir;
+
+// Checks an entry name from an archive and returns it as a clean relative path, or NULL if it
+// is unsafe. Backslashes count as separators, "." and empty components are dropped, and
+// absolute paths and ".." are refused: those are how a malicious archive writes outside the
+// destination ("zip slip"). Must be freed with g_free().
+gchar* archive_entry_path(const gchar *name, gsize len);
+
+// Opens the folder `dest_dir` to extract into. Returns NULL if it can't be opened.
+ExtractDir* extract_dir_new(const gchar *dest_dir);
+void extract_dir_free(ExtractDir *dir);
+
+// Makes sure the folder `path` exists, creating it and its parents as needed. `mode` holds the
+// permissions the archive gives it (0 for the default); we always keep write access to our own
+// folders. Call this from one thread only, before any worker uses extract_dir_open().
+gboolean extract_dir_make(ExtractDir *dir, const gchar *path, guint32 mode);
+
+// Opens the folder `path` ("" for the destination itself), never following a symlink.
+// Returns its fd, or -1. Safe to call from any thread.
+int extract_dir_open(ExtractDir *dir, const gchar *path);
+
+// Records that the item `path` was created by the extraction. Safe to call from any thread.
+void extract_dir_created(ExtractDir *dir, const gchar *path);
+
+// Removes everything the extraction created (after a cancel or a failure).
+void extract_dir_remove_created(ExtractDir *dir);
+
+// Splits a path into its folder ("" at the top, must be freed) and its last component,
+// which points into `path`.
+gchar* extract_dir_split(const gchar *path, const gchar **base);
+
+#endif // EXTRACTDIR_H
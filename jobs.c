@@ -0,0 +1,272 @@
+/**
+ * @file jobs.c
+ * @brief Runs backend operations on worker threads and tracks their progress.
+ *
+ * Every job gets its own thread. The thread first measures the work (total bytes and items)
+ * so the UI can show a percentage and an ETA (renames and deletes skip this, see job_thread),
+ * then calls the matching backend function with the job's OpProgress. The backend updates
+ * that OpProgress as it goes; job_get_snapshot() reads it under its lock, so the UI thread
+ * never waits on file I/O.
+ */
+
+#include "jobs.h"
+#include "backend.h"
+#include "scheduler.h"
+#include <string.h>
+#include <sys/stat.h>
+
+struct Job {
+    gint ref_count;         // Atomic reference count.
+    JobKind kind;
+    gchar *src_path;
+    gchar *dest_path;       // Destination folder (copy/move/unzip) or archive path (zip); NULL for delete.
+    gchar *description;
+    CopyOptions copy_options;   // Only used by JOB_COPY.
+    ZipOptions zip_options;     // Only used by JOB_ZIP.
+    ZipStats zip_stats;         // Filled in by a JOB_ZIP before it finishes.
+    GPtrArray *corrupt;         // Damaged files found by a JOB_TEST (gchar*); NULL for other jobs.
+    OpProgress progress;    // Shared with the backend function running on the worker thread.
+    gint state;             // A JobState, read and written atomically.
+
+    // Throughput estimation. Only touched by job_get_snapshot(), under rate_lock.
+    GMutex rate_lock;
+    gint64 sample_us;       // When we last took a throughput sample...
+    guint64 sample_bytes;   // ...and how many bytes were done at that moment.
+    gdouble rate;           // Exponentially smoothed bytes per second.
+};
+
+/**
+ * @brief Collects the devices (st_dev) a job reads from and writes to.
+ * @return How many entries of `devices` were filled in.
+ */
+static guint job_devices(Job *job, dev_t devices[2]) {
+    guint n = 0;
+    struct stat st;
+    if (lstat(job->src_path, &st) == 0) devices[n++] = st.st_dev;
+    if (job->dest_path) {
+        // For a zip, the archive does not exist yet; the folder it goes into does.
+        gchar *dest_dir = (job->kind == JOB_ZIP) ? g_path_get_dirname(job->dest_path) : g_strdup(job->dest_path);
+        if (stat(dest_dir, &st) == 0) devices[n++] = st.st_dev;
+        g_free(dest_dir);
+    }
+    return n;
+}
+
+/**
+ * @brief The function every worker thread runs: measure, wait for the scheduler, then do the real work.
+ */
+static gpointer job_thread(gpointer data) {
+    Job *job = data;
+    gboolean ok = FALSE;
+
+    dev_t devices[2];
+    guint n_devices = job_devices(job, devices);
+    // A move within one device is a single rename(); only a move to another device copies data.
+    gboolean copies_data = (job->kind != JOB_MOVE) || (n_devices == 2 && devices[0] != devices[1]);
+
+    // Measuring first gives the UI a meaningful "x of y" and an ETA. For a rename, walking
+    // the whole tree first would only slow it down. A delete isn't measured either: the walk
+    // would read every item's metadata once just to count it, and then the delete reads it all
+    // again. Its progress shows how many items are gone, without a total.
+    if (copies_data && job->kind != JOB_DELETE) measure_item(job->src_path, &job->progress);
+
+    // Ask the scheduler for a turn on the job's devices. Small jobs count as interactive.
+    // Without a measurement, a delete is small if it is a single file or link, and bulk if it
+    // is a folder, whose size we don't know.
+    IoClass io_class;
+    if (!copies_data) {
+        io_class = IO_CLASS_INTERACTIVE;
+    } else if (job->kind == JOB_DELETE) {
+        struct stat st;
+        io_class = (lstat(job->src_path, &st) == 0 && !S_ISDIR(st.st_mode)) ? IO_CLASS_INTERACTIVE : IO_CLASS_BULK;
+    } else {
+        g_mutex_lock(&job->progress.lock);
+        io_class = io_class_for_size(job->progress.bytes_total, job->progress.files_total);
+        g_mutex_unlock(&job->progress.lock);
+    }
+    IoTicket *ticket = io_scheduler_acquire(devices, n_devices, io_class, &job->progress);
+    if (!ticket) {
+        // Cancelled while still waiting: nothing was touched, so there is nothing to clean up.
+        g_atomic_int_set(&job->state, JOB_CANCELLED);
+        job_unref(job);
+        return NULL;
+    }
+    g_atomic_int_set(&job->state, JOB_RUNNING);
+
+    switch (job->kind) {
+    case JOB_COPY:   ok = copy_item_with_options(job->src_path, job->dest_path, &job->copy_options, &job->progress); break;
+    case JOB_MOVE:   ok = move_item_with_progress(job->src_path, job->dest_path, &job->progress); break;
+    case JOB_DELETE: ok = delete_item_with_progress(job->src_path, &job->progress); break;
+    case JOB_ZIP:    ok = zip_item_with_options(job->src_path, job->dest_path, &job->zip_options, &job->zip_stats, &job->progress); break;
+    case JOB_UNZIP:  ok = unzip_item_with_progress(job->src_path, job->dest_path, &job->progress); break;
+    case JOB_TEST:   ok = test_archive_with_progress(job->src_path, job->corrupt, &job->progress); break;
+    }
+
+    io_scheduler_release(ticket);
+
+    JobState state = ok ? JOB_SUCCEEDED : JOB_FAILED;
+    if (op_progress_is_cancelled(&job->progress)) state = JOB_CANCELLED;
+    g_atomic_int_set(&job->state, state);
+    // The worker's reference is released last; the job may be freed right here.
+    job_unref(job);
+    return NULL;
+}
+
+/**
+ * @brief Creates a job and gives it a description. job_launch() then starts it.
+ */
+static Job* job_new(JobKind kind, const gchar *src_path, const gchar *dest_path) {
+    static const gchar *verbs[] = { "Copying", "Moving", "Deleting", "Compressing", "Extracting", "Testing" };
+    Job *job = g_new0(Job, 1);
+    job->ref_count = 2; // One for the caller, one for the worker thread.
+    job->kind = kind;
+    job->src_path = g_strdup(src_path);
+    job->dest_path = g_strdup(dest_path);
+    gchar *base = g_path_get_basename(src_path);
+    job->description = g_strdup_printf("%s '%s'", verbs[kind], base);
+    g_free(base);
+    op_progress_init(&job->progress);
+    job->state = JOB_QUEUED;
+    g_mutex_init(&job->rate_lock);
+    job->sample_us = g_get_monotonic_time();
+    return job;
+}
+
+/**
+ * @brief Launches a job's worker thread.
+ */
+static Job* job_launch(Job *job) {
+    // We don't need to join the thread later: it signals completion through job->state.
+    g_thread_unref(g_thread_new("file-job", job_thread, job));
+    return job;
+}
+
+Job* job_start_copy(const gchar *src_path, const gchar *dest_dir, const CopyOptions *options) {
+    Job *job = job_new(JOB_COPY, src_path, dest_dir);
+    if (options) job->copy_options = *options;
+    return job_launch(job);
+}
+
+Job* job_start_move(const gchar *src_path, const gchar *dest_dir) { return job_launch(job_new(JOB_MOVE, src_path, dest_dir)); }
+Job* job_start_delete(const gchar *path) { return job_launch(job_new(JOB_DELETE, path, NULL)); }
+
+Job* job_start_zip(const gchar *src_path, const gchar *dest_zip_path, const ZipOptions *options) {
+    Job *job = job_new(JOB_ZIP, src_path, dest_zip_path);
+    if (options) job->zip_options = *options;
+    return job_launch(job);
+}
+
+Job* job_start_unzip(const gchar *zip_path, const gchar *dest_dir) { return job_launch(job_new(JOB_UNZIP, zip_path, dest_dir)); }
+
+Job* job_start_test(const gchar *zip_path) {
+    Job *job = job_new(JOB_TEST, zip_path, NULL);
+    job->corrupt = g_ptr_array_new_with_free_func(g_free);
+    return job_launch(job);
+}
+
+Job* job_ref(Job *job) {
+    g_atomic_int_inc(&job->ref_count);
+    return job;
+}
+
+void job_unref(Job *job) {
+    if (!g_atomic_int_dec_and_test(&job->ref_count)) return;
+    op_progress_clear(&job->progress);
+    g_mutex_clear(&job->rate_lock);
+    g_free(job->src_path); g_free(job->dest_path); g_free(job->description);
+    if (job->corrupt) g_ptr_array_free(job->corrupt, TRUE);
+    g_free(job);
+}
+
+const gchar* job_get_description(Job *job) { return job->description; }
+JobKind job_get_kind(Job *job) { return job->kind; }
+
+void job_cancel(Job *job) { op_progress_cancel(&job->progress); }
+
+/**
+ * @brief The summary of a finished JOB_TEST: either all is well, or which files are damaged.
+ */
+static gchar* test_summary(Job *job, JobState state) {
+    // How many damaged files are named before the rest are just counted.
+    const guint max_named = 3;
+    if (state == JOB_CANCELLED) return NULL;
+    gchar *base = g_path_get_basename(job->src_path);
+    GString *text = g_string_new(NULL);
+    guint n = job->corrupt->len;
+    if (state == JOB_SUCCEEDED) {
+        g_string_append_printf(text, "Tested '%s' — no problems found", base);
+    } else if (n == 0) {
+        // Nothing was checked: the table of contents itself is unreadable.
+        g_string_append_printf(text, "Tested '%s' — it can't be read as a zip archive", base);
+    } else {
+        g_string_append_printf(text, "Tested '%s' — %u damaged file%s: ", base, n, n == 1 ? "" : "s");
+        for (guint i = 0; i < MIN(n, max_named); i++)
+            g_string_append_printf(text, "%s%s", i > 0 ? ", " : "", (const gchar *)g_ptr_array_index(job->corrupt, i));
+        if (n > max_named) g_string_append_printf(text, " and %u more", n - max_named);
+    }
+    g_free(base);
+    return g_string_free(text, FALSE);
+}
+
+gchar* job_get_summary(Job *job) {
+    // The results are written before the state changes to finished (an atomic operation,
+    // which also makes the writes visible to us), and never touched again.
+    if (job->kind == JOB_TEST) {
+        JobState state = g_atomic_int_get(&job->state);
+        return job_state_is_finished(state) ? test_summary(job, state) : NULL;
+    }
+    if (job->kind != JOB_ZIP || g_atomic_int_get(&job->state) != JOB_SUCCEEDED) return NULL;
+    const ZipStats *stats = &job->zip_stats;
+    gchar *base = g_path_get_basename(job->src_path);
+    gchar *in = g_format_size(stats->bytes_in), *out = g_format_size(stats->bytes_out);
+    GString *text = g_string_new(NULL);
+    g_string_append_printf(text, "Compressed '%s' — %s to %s", base, in, out);
+    if (stats->bytes_in > 0) g_string_append_printf(text, " (%.0f%%)", 100.0 * stats->bytes_out / stats->bytes_in);
+    if (stats->files_reused > 0)
+        g_string_append_printf(text, ", %u unchanged file%s kept as %s", stats->files_reused,
+                               stats->files_reused == 1 ? "" : "s", stats->files_reused == 1 ? "it was" : "they were");
+    if (stats->files_stored > 0)
+        g_string_append_printf(text, ", %u file%s stored as %s", stats->files_stored,
+                               stats->files_stored == 1 ? "" : "s", stats->files_stored == 1 ? "it is" : "they are");
+    if (stats->cpu_seconds_saved >= 1) {
+        gint64 saved = (gint64)stats->cpu_seconds_saved;
+        g_string_append_printf(text, ", about %" G_GINT64_FORMAT ":%02d of CPU time saved", saved / 60, (int)(saved % 60));
+    }
+    g_free(base); g_free(in); g_free(out);
+    return g_string_free(text, FALSE);
+}
+
+gboolean job_state_is_finished(JobState state) {
+    return state == JOB_SUCCEEDED || state == JOB_FAILED || state == JOB_CANCELLED;
+}
+
+void job_get_snapshot(Job *job, JobSnapshot *snapshot) {
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->state = g_atomic_int_get(&job->state);
+
+    // Copy the counters out in one go so they are consistent with each other.
+    g_mutex_lock(&job->progress.lock);
+    snapshot->bytes_done = job->progress.bytes_done;
+    snapshot->bytes_total = job->progress.bytes_total;
+    snapshot->files_done = job->progress.files_done;
+    snapshot->files_total = job->progress.files_total;
+    g_mutex_unlock(&job->progress.lock);
+
+    // Throughput: sample at most every quarter second and smooth the samples, so the
+    // number shown to the user doesn't jump around with every chunk.
+    g_mutex_lock(&job->rate_lock);
+    gint64 now = g_get_monotonic_time();
+    gint64 elapsed = now - job->sample_us;
+    if (elapsed >= G_USEC_PER_SEC / 4 && snapshot->bytes_done >= job->sample_bytes) {
+        gdouble instant = (gdouble)(snapshot->bytes_done - job->sample_bytes) * G_USEC_PER_SEC / elapsed;
+        job->rate = (job->rate == 0) ? instant : 0.7 * job->rate + 0.3 * instant;
+        job->sample_us = now;
+        job->sample_bytes = snapshot->bytes_done;
+    }
+    snapshot->bytes_per_second = job->rate;
+    g_mutex_unlock(&job->rate_lock);
+
+    snapshot->eta_seconds = -1;
+    if (snapshot->bytes_per_second > 0 && snapshot->bytes_total >= snapshot->bytes_done)
+        snapshot->eta_seconds = (gint64)((snapshot->bytes_total - snapshot->bytes_done) / snapshot->bytes_per_second);
+}
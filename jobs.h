@@ -0,0 +1,83 @@
+/**
+ * @file jobs.h
+ * @brief Background jobs: long-running file operations that run on worker threads.
+ *
+ * Copying, deleting or zipping a big folder can take minutes. If the UI called the backend
+ * directly, the window would freeze until the operation finished. Instead, the UI starts a
+ * "job". The job runs the backend function on its own thread and keeps live progress
+ * counters that the UI can poll at any time (a "snapshot") without blocking.
+ */
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <glib.h>
+#include "backend.h"
+
+// The kind of operation a job performs.
+typedef enum {
+    JOB_COPY,
+    JOB_MOVE,
+    JOB_DELETE,
+    JOB_ZIP,
+    JOB_UNZIP,
+    JOB_TEST         // Checks a zip archive without extracting it.
+} JobKind;
+
+// Where a job is in its life cycle.
+typedef enum {
+    JOB_QUEUED,      // Counting its files, then waiting for the I/O scheduler to admit it.
+    JOB_RUNNING,     // Working.
+    JOB_SUCCEEDED,   // Finished, everything went fine.
+    JOB_FAILED,      // Finished, but at least one item could not be processed.
+    JOB_CANCELLED    // Stopped early because job_cancel() was called.
+} JobState;
+
+// A consistent copy of a job's progress at one moment in time.
+typedef struct {
+    JobState state;
+    guint64 bytes_done;
+    guint64 bytes_total;
+    guint files_done;
+    guint files_total;
+    gdouble bytes_per_second;   // Smoothed throughput, 0 until there is enough data.
+    gint64 eta_seconds;         // Estimated seconds remaining, or -1 if unknown.
+} JobSnapshot;
+
+// A Job is reference counted: the worker thread holds one reference and the caller the other.
+typedef struct Job Job;
+
+// Each of these starts the operation on a new worker thread and returns immediately.
+// The operation itself begins once the I/O scheduler (scheduler.h) admits it.
+// The returned job must eventually be released with job_unref().
+Job* job_start_copy(const gchar *src_path, const gchar *dest_dir, const CopyOptions *options);
+Job* job_start_move(const gchar *src_path, const gchar *dest_dir);
+Job* job_start_delete(const gchar *path);
+Job* job_start_zip(const gchar *src_path, const gchar *dest_zip_path, const ZipOptions *options);
+Job* job_start_unzip(const gchar *zip_path, const gchar *dest_dir);
+Job* job_start_test(const gchar *zip_path);
+
+Job* job_ref(Job *job);
+void job_unref(Job *job);
+
+// A short human-readable description, e.g. "Copying 'Photos'". Owned by the job.
+const gchar* job_get_description(Job *job);
+JobKind job_get_kind(Job *job);
+
+// A line describing what a finished job achieved, e.g. "Compressed 'Photos' — 1.2 GB to
+// 1.1 GB (92%), 310 files stored as they are, about 2:10 of CPU time saved", or "Tested
+// 'a.zip' — 2 damaged files: docs/x.txt, y.png", or NULL if the job has nothing to report (or
+// hasn't finished). Free with g_free().
+gchar* job_get_summary(Job *job);
+
+// TRUE once the job has succeeded, failed or been cancelled.
+gboolean job_state_is_finished(JobState state);
+
+// Fills `snapshot` with the job's current progress. Safe to call from any thread.
+void job_get_snapshot(Job *job, JobSnapshot *snapshot);
+
+// Asks the job to stop as soon as possible (even in the middle of a file). The job cleans up
+// its partial output and then reports JOB_CANCELLED.
+void job_cancel(Job *job);
+
+#endif // JOBS_H
@@ -15,6 +15,9 @@
 // to use the functions declared in `backend.h` without needing to know their
 // internal implementation details.
 #include "backend.h"
+// The background job engine, so long operations don't freeze the window.
+#include "jobs.h"
+#include "purge.h"
 
 // --- Global Application State ---
 // These variables are declared globally, meaning they are accessible from any function
@@ -37,6 +40,30 @@ GtkEntry *path_entry;       // A pointer to the text entry box at the top, used
 GtkWidget *context_menu;    // A pointer to the right-click context menu widget.
 GtkWidget *paste_menu_item; // A specific pointer to the "Paste" item within the context menu. This allows us
                             // to enable or disable it based on whether the clipboard is empty.
+GtkWidget *undo_delete_menu_item; // The "Undo Delete" item; enabled while the last delete can still be undone.
+gchar *last_delete_token = NULL;  // Identifies the last delete for purge_restore() (see purge.h).
+GtkWidget *verify_menu_item;// The "Verify Copies" check item; when ticked, pasted copies are read back and checked.
+GtkWidget *extract_menu_item; // The "Extract Here" item; enabled when the selected item is an archive (.zip, .tar.zst...).
+GtkWidget *test_menu_item;  // The "Test Archive" item; enabled when the selected item is a .zip archive.
+GtkWidget *jobs_box;        // A vertical box under the file list with one progress row per running job.
+
+// --- Background Job Tracking ---
+// Every running job gets a row in `jobs_box` with a progress bar and a Cancel button.
+// A timer polls all jobs a few times per second and updates their rows.
+
+typedef struct {
+    Job *job;
+    GtkWidget *row;         // The horizontal box holding the widgets below.
+    GtkProgressBar *bar;
+    GtkWidget *cancel;
+    gint64 remove_at_us;    // Once the job has finished: when its row goes away (0 before that).
+} JobRow;
+
+// How long a finished job's row stays up when the job has a summary to show (see job_get_summary()).
+#define JOB_SUMMARY_SECONDS 8
+
+GList *job_rows = NULL;     // The JobRow structs of all jobs that are still on screen.
+guint job_poll_id = 0;      // The id of the polling timer, or 0 when no timer is running.
 
 // --- Forward Declarations ---
 // In C, a function must be declared before it is used. Since many of our functions
@@ -48,12 +75,16 @@ static void on_row_activated(GtkTreeView *tv, GtkTreePath *path, GtkTreeViewColu
 static gboolean on_button_press(GtkWidget *widget, GdkEventButton *event, gpointer user_data);
 static void on_rename(GtkMenuItem *item, gpointer data);
 static void on_delete(GtkMenuItem *item, gpointer data);
+static void on_undo_delete(GtkMenuItem *item, gpointer data);
 static void on_copy(GtkMenuItem *item, gpointer data);
 static void on_cut(GtkMenuItem *item, gpointer data);
 static void on_paste(GtkMenuItem *item, gpointer data);
 static void on_zip(GtkMenuItem *item, gpointer data);
+static void on_extract(GtkMenuItem *item, gpointer data);
+static void on_test_archive(GtkMenuItem *item, gpointer data);
 static void on_create_folder(GtkMenuItem *item, gpointer data);
 static void on_create_file(GtkMenuItem *item, gpointer data);
+static void track_job(Job *job);
 
 // --- Helper to get selected path ---
 /**
@@ -90,10 +121,15 @@ static void create_context_menu() {
     GtkWidget *create_file_item = gtk_menu_item_new_with_label("New File");
     GtkWidget *rename_item = gtk_menu_item_new_with_label("Rename");
     GtkWidget *delete_item = gtk_menu_item_new_with_label("Delete");
+    undo_delete_menu_item = gtk_menu_item_new_with_label("Undo Delete");
     GtkWidget *copy_item = gtk_menu_item_new_with_label("Copy");
     GtkWidget *cut_item = gtk_menu_item_new_with_label("Cut");
     paste_menu_item = gtk_menu_item_new_with_label("Paste");
-    GtkWidget *zip_item = gtk_menu_item_new_with_label("Compress (ZIP)");
+    GtkWidget *zip_item = gtk_menu_item_new_with_label("Compress");
+    extract_menu_item = gtk_menu_item_new_with_label("Extract Here");
+    test_menu_item = gtk_menu_item_new_with_label("Test Archive");
+    // A check item keeps its on/off state between uses; it has no callback of its own.
+    verify_menu_item = gtk_check_menu_item_new_with_label("Verify Copies");
 
     // This is the core of event-driven programming. `g_signal_connect` tells GTK:
     // "When the 'activate' signal occurs on this widget (i.e., the user clicks it),
@@ -103,10 +139,13 @@ static void create_context_menu() {
     g_signal_connect(create_file_item, "activate", G_CALLBACK(on_create_file), NULL);
     g_signal_connect(rename_item, "activate", G_CALLBACK(on_rename), NULL);
     g_signal_connect(delete_item, "activate", G_CALLBACK(on_delete), NULL);
+    g_signal_connect(undo_delete_menu_item, "activate", G_CALLBACK(on_undo_delete), NULL);
     g_signal_connect(copy_item, "activate", G_CALLBACK(on_copy), NULL);
     g_signal_connect(cut_item, "activate", G_CALLBACK(on_cut), NULL);
     g_signal_connect(paste_menu_item, "activate", G_CALLBACK(on_paste), NULL);
     g_signal_connect(zip_item, "activate", G_CALLBACK(on_zip), NULL);
+    g_signal_connect(extract_menu_item, "activate", G_CALLBACK(on_extract), NULL);
+    g_signal_connect(test_menu_item, "activate", G_CALLBACK(on_test_archive), NULL);
 
     // We now add all the created items to the menu widget in the desired order,
     // using separators to create logical groups.
@@ -115,12 +154,16 @@ static void create_context_menu() {
     gtk_menu_shell_append(GTK_MENU_SHELL(context_menu), gtk_separator_menu_item_new());
     gtk_menu_shell_append(GTK_MENU_SHELL(context_menu), rename_item);
     gtk_menu_shell_append(GTK_MENU_SHELL(context_menu), delete_item);
+    gtk_menu_shell_append(GTK_MENU_SHELL(context_menu), undo_delete_menu_item);
     gtk_menu_shell_append(GTK_MENU_SHELL(context_menu), gtk_separator_menu_item_new());
     gtk_menu_shell_append(GTK_MENU_SHELL(context_menu), copy_item);
     gtk_menu_shell_append(GTK_MENU_SHELL(context_menu), cut_item);
     gtk_menu_shell_append(GTK_MENU_SHELL(context_menu), paste_menu_item);
+    gtk_menu_shell_append(GTK_MENU_SHELL(context_menu), verify_menu_item);
     gtk_menu_shell_append(GTK_MENU_SHELL(context_menu), gtk_separator_menu_item_new());
     gtk_menu_shell_append(GTK_MENU_SHELL(context_menu), zip_item);
+    gtk_menu_shell_append(GTK_MENU_SHELL(context_menu), extract_menu_item);
+    gtk_menu_shell_append(GTK_MENU_SHELL(context_menu), test_menu_item);
     // This function makes the menu widget and all its children ready to be displayed when called.
     gtk_widget_show_all(context_menu);
 }
@@ -190,6 +233,10 @@ static void activate(GtkApplication *app, gpointer user_data) {
     tree_view = GTK_TREE_VIEW(gtk_tree_view_new_with_model(GTK_TREE_MODEL(store)));
     gtk_container_add(GTK_CONTAINER(scrolled_window), GTK_WIDGET(tree_view));
 
+    // Create the (initially empty) area where running jobs show their progress.
+    jobs_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 2);
+    gtk_box_pack_start(GTK_BOX(main_box), jobs_box, FALSE, FALSE, 0);
+
     // Create the visible columns for the list (Name, Size, etc.).
     const char *cols[] = {"Name", "Size", "Type", "Modified"};
     for (int i=0; i<4; i++) {
@@ -206,6 +253,9 @@ static void activate(GtkApplication *app, gpointer user_data) {
     // Call our function to build the right-click menu and prepare it.
     create_context_menu();
 
+    // Finish purging anything deleted during the last run (see on_delete).
+    purge_init();
+
     // Set the application's starting path to the user's home directory.
     current_path = g_strdup(g_get_home_dir());
     // Call refresh_view() for the first time to load the initial list of files.
@@ -219,7 +269,13 @@ static void activate(GtkApplication *app, gpointer user_data) {
  * @brief Reloads and displays the contents of the `current_path` directory.
  */
 void refresh_view() {
-    // First, clear out all the old items from the data model to prevent duplicates.
+    // While the model is attached, every row added makes the tree view react (signals, row
+    // measuring, redraw requests), which takes seconds for a folder of 100,000 files. So the
+    // model is taken out of the view first and put back once it is complete; the view then
+    // lays out all the rows in one go. We hold a reference so the store survives being detached.
+    g_object_ref(store);
+    gtk_tree_view_set_model(tree_view, NULL);
+    // Clear out all the old items from the data model to prevent duplicates.
     gtk_list_store_clear(store);
     // Update the path entry box to show the correct current path.
     gtk_entry_set_text(path_entry, current_path);
@@ -228,12 +284,12 @@ void refresh_view() {
     // Loop through the linked list of FileInfo structs returned by the backend.
     for (GList *l = files; l != NULL; l = l->next) {
         FileInfo *info = (FileInfo *)l->data;
-        GtkTreeIter iter;
-        // Add a new, empty row to our data model.
-        gtk_list_store_append(store, &iter);
-        // Fill the new row with the data from the FileInfo struct, column by column.
-        gtk_list_store_set(store, &iter, 0, info->name, 1, info->size_formatted, 2, info->type, 3, info->modified, 4, info->path, 5, info->is_dir, -1);
+        // Add a row at the end (-1) and fill it, column by column, in a single call; an append
+        // followed by a set would announce the row twice.
+        gtk_list_store_insert_with_values(store, NULL, -1, 0, info->name, 1, info->size_formatted, 2, info->type, 3, info->modified, 4, info->path, 5, info->is_dir, -1);
     }
+    gtk_tree_view_set_model(tree_view, GTK_TREE_MODEL(store));
+    g_object_unref(store);
     // CRITICAL MEMORY MANAGEMENT: The backend allocated memory for the list. We must free it now
     // to prevent a memory leak. `g_list_free_full` calls our `free_file_info` on each item.
     g_list_free_full(files, free_file_info);
@@ -249,17 +305,21 @@ static void on_row_activated(GtkTreeView *tv, GtkTreePath *path, GtkTreeViewColu
         gboolean is_dir; gchar *file_path;
         // Get the data for that row from our model.
         gtk_tree_model_get(GTK_TREE_MODEL(store), &iter, 5, &is_dir, 4, &file_path, -1);
-        if (is_dir) { // If the item was a folder...
+        if (is_dir || is_browsable_archive(file_path)) { // If the item was a folder (or a zip archive)...
             // ...update the current path and refresh the view to navigate into it.
             g_free(current_path);
             current_path = file_path;
             refresh_view();
         } else { // If the item was a file...
-            // ...we build a command like "open '/path/to/file.txt'" and ask the OS to run it.
-            // This will open the file with its default application.
-            gchar *command = g_strconcat("open ", "\"", file_path, "\"", NULL);
-            system(command);
-            g_free(command);
+            // A file inside an archive has to be extracted before another application can open it.
+            gchar *extracted = extract_archive_member(file_path);
+            // ...we turn its path into a URI ("file:///path/to/file.txt") and hand it straight to
+            // the file's default application. This never goes through a shell: a file name (and
+            // one from an archive can be anything) could otherwise smuggle in shell commands.
+            gchar *uri = g_filename_to_uri(extracted ? extracted : file_path, NULL, NULL);
+            if (uri) g_app_info_launch_default_for_uri(uri, NULL, NULL);
+            g_free(uri);
+            g_free(extracted);
             g_free(file_path);
         }
     }
@@ -274,6 +334,14 @@ static gboolean on_button_press(GtkWidget *widget, GdkEventButton *event, gpoint
         // Before showing the menu, we check if there's anything on our clipboard.
         // If there is, we enable the "Paste" menu item. If not, we disable it.
         gtk_widget_set_sensitive(paste_menu_item, clipboard_path != NULL);
+        // "Undo Delete" only works until the purger has started on the deleted item.
+        gtk_widget_set_sensitive(undo_delete_menu_item, last_delete_token != NULL && purge_can_restore(last_delete_token));
+        // "Extract Here" only makes sense for an archive.
+        gchar *selected = get_selected_path();
+        gtk_widget_set_sensitive(extract_menu_item, selected && is_extractable_archive(selected));
+        // Only zip archives can be tested; they have a checksum for every file.
+        gtk_widget_set_sensitive(test_menu_item, selected && is_browsable_archive(selected));
+        g_free(selected);
         // This function shows the context menu at the current mouse pointer's location.
         gtk_menu_popup_at_pointer(GTK_MENU(context_menu), (GdkEvent*)event);
         return TRUE; // We have handled this event completely.
@@ -312,10 +380,28 @@ static void on_delete(GtkMenuItem *item, gpointer data) {
     if (!path) return;
     GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(gtk_widget_get_toplevel(GTK_WIDGET(tree_view))), GTK_DIALOG_MODAL, GTK_MESSAGE_QUESTION, GTK_BUTTONS_YES_NO, "Delete '%s' permanently?", g_path_get_basename(path));
     if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_YES) {
-        delete_item(path);
+        // Normally the item is just renamed out of sight, which is instant however big it is;
+        // the disk space is freed in the background a little later.
+        gchar *token = purge_stage(path);
+        if (token) {
+            g_free(last_delete_token);
+            last_delete_token = token;
+            refresh_view();
+        } else {
+            // It could not be staged: the deletion runs as a job; the view refreshes when it finishes.
+            track_job(job_start_delete(path));
+        }
     }
     gtk_widget_destroy(dialog);
     g_free(path);
+}
+
+static void on_undo_delete(GtkMenuItem *item, gpointer data) {
+    if (!last_delete_token) return;
+    purge_restore(last_delete_token);
+    // Either the item is back or it can't be brought back any more; in both cases we are done with it.
+    g_free(last_delete_token);
+    last_delete_token = NULL;
     refresh_view();
 }
 
@@ -331,27 +417,135 @@ static void on_cut(GtkMenuItem *item, gpointer data) {
     clipboard_op = g_strdup("move");
 }
 
+/**
+ * @brief Asks how to paste an item over an existing item of the same name.
+ * "Update Changed" turns the copy into a sync that only copies new and changed files.
+ * @return FALSE if the user cancelled the paste.
+ */
+static gboolean ask_sync_options(const gchar *name, CopyOptions *options) {
+    GtkWidget *dialog = gtk_dialog_new_with_buttons("Item Already Exists", GTK_WINDOW(gtk_widget_get_toplevel(GTK_WIDGET(tree_view))), GTK_DIALOG_MODAL, "_Update Changed", GTK_RESPONSE_ACCEPT, "Copy _All", GTK_RESPONSE_APPLY, "_Cancel", GTK_RESPONSE_CANCEL, NULL);
+    GtkWidget *content = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
+    gchar *message = g_strdup_printf("'%s' already exists in this folder.", name);
+    GtkWidget *delete_check = gtk_check_button_new_with_label("Also remove files that are no longer in the original");
+    GtkWidget *compare_check = gtk_check_button_new_with_label("Compare file contents (slower, ignores timestamps)");
+    gtk_box_pack_start(GTK_BOX(content), gtk_label_new(message), FALSE, FALSE, 6);
+    gtk_box_pack_start(GTK_BOX(content), delete_check, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(content), compare_check, FALSE, FALSE, 0);
+    gtk_widget_show_all(dialog);
+
+    gint response = gtk_dialog_run(GTK_DIALOG(dialog));
+    if (response == GTK_RESPONSE_ACCEPT) {
+        options->sync = TRUE;
+        options->sync_delta = TRUE;
+        options->sync_delete_extraneous = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(delete_check));
+        options->sync_compare_content = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(compare_check));
+    }
+    gtk_widget_destroy(dialog);
+    g_free(message);
+    return response == GTK_RESPONSE_ACCEPT || response == GTK_RESPONSE_APPLY;
+}
+
 static void on_paste(GtkMenuItem *item, gpointer data) {
     if (!clipboard_path) return;
     if (g_strcmp0(clipboard_op, "copy") == 0) {
-        copy_item(clipboard_path, current_path);
+        // Background copies keep a checkpoint journal and keep hard-linked files linked.
+        // If an earlier copy of the same item into this folder was interrupted, offer to
+        // continue it instead of starting over.
+        CopyOptions options = { .journal = TRUE, .preserve_hardlinks = TRUE };
+        options.verify = gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(verify_menu_item));
+        if (copy_can_resume(clipboard_path, current_path)) {
+            GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(gtk_widget_get_toplevel(GTK_WIDGET(tree_view))), GTK_DIALOG_MODAL, GTK_MESSAGE_QUESTION, GTK_BUTTONS_YES_NO, "An earlier copy of '%s' into this folder did not finish. Resume it?", g_path_get_basename(clipboard_path));
+            options.resume = (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_YES);
+            gtk_widget_destroy(dialog);
+        }
+        // Pasting over an existing copy can update it instead of copying everything again.
+        gchar *name = g_path_get_basename(clipboard_path);
+        gchar *dest_path = g_build_filename(current_path, name, NULL);
+        gboolean proceed = options.resume || !g_file_test(dest_path, G_FILE_TEST_EXISTS) || ask_sync_options(name, &options);
+        g_free(name); g_free(dest_path);
+        if (!proceed) return;
+        track_job(job_start_copy(clipboard_path, current_path, &options));
     } else if (g_strcmp0(clipboard_op, "move") == 0) {
-        move_item(clipboard_path, current_path);
+        track_job(job_start_move(clipboard_path, current_path));
         // After a move, the clipboard should be cleared.
         g_free(clipboard_path); clipboard_path = NULL;
         g_free(clipboard_op); clipboard_op = NULL;
     }
-    refresh_view();
+}
+
+/**
+ * @brief Asks for the archive format and how strongly to compress a new archive.
+ * In a zip, files that are already compressed (photos, videos...) are stored as they are at any level.
+ * @return FALSE if the user cancelled.
+ */
+static gboolean ask_zip_options(const gchar *name, ZipOptions *options) {
+    static const int levels[] = { ZIP_LEVEL_STORE, 1, 0, 9 };
+    GtkWidget *dialog = gtk_dialog_new_with_buttons("Compress", GTK_WINDOW(gtk_widget_get_toplevel(GTK_WIDGET(tree_view))), GTK_DIALOG_MODAL, "_Compress", GTK_RESPONSE_ACCEPT, "_Cancel", GTK_RESPONSE_CANCEL, NULL);
+    GtkWidget *content = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
+    gchar *message = g_strdup_printf("Compress '%s' into an archive:", name);
+    GtkWidget *format_combo = gtk_combo_box_text_new();
+    // The entries are in the same order as the ArchiveFormat values.
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(format_combo), "ZIP (opens everywhere)");
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(format_combo), "tar.zst (fast, small: good for backups)");
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(format_combo), "tar.xz (smallest, slowest)");
+    gtk_combo_box_set_active(GTK_COMBO_BOX(format_combo), ARCHIVE_ZIP);
+    GtkWidget *long_check = gtk_check_button_new_with_label("Find repeats far apart (tar.zst, big folders of similar files)");
+    GtkWidget *update_check = gtk_check_button_new_with_label("If the ZIP archive exists, only compress files that changed");
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(update_check), TRUE);
+    GtkWidget *level_combo = gtk_combo_box_text_new();
+    // The entries are in the same order as `levels`.
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(level_combo), "Store only (no compression, fastest)");
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(level_combo), "Fast");
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(level_combo), "Normal");
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(level_combo), "Best (smallest, slowest)");
+    gtk_combo_box_set_active(GTK_COMBO_BOX(level_combo), 2);
+    gtk_box_pack_start(GTK_BOX(content), gtk_label_new(message), FALSE, FALSE, 6);
+    gtk_box_pack_start(GTK_BOX(content), format_combo, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(content), level_combo, FALSE, FALSE, 6);
+    gtk_box_pack_start(GTK_BOX(content), long_check, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(content), update_check, FALSE, FALSE, 0);
+    gtk_widget_show_all(dialog);
+
+    gint response = gtk_dialog_run(GTK_DIALOG(dialog));
+    if (response == GTK_RESPONSE_ACCEPT) {
+        options->format = gtk_combo_box_get_active(GTK_COMBO_BOX(format_combo));
+        options->level = levels[gtk_combo_box_get_active(GTK_COMBO_BOX(level_combo))];
+        options->long_distance = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(long_check));
+        options->update = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(update_check));
+    }
+    gtk_widget_destroy(dialog);
+    g_free(message);
+    return response == GTK_RESPONSE_ACCEPT;
 }
 
 static void on_zip(GtkMenuItem *item, gpointer data) {
     gchar *path = get_selected_path();
     if (!path) return;
-    gchar *zip_name = g_strconcat(g_path_get_basename(path), ".zip", NULL);
-    gchar *dest_path = g_build_filename(current_path, zip_name, NULL);
-    zip_item(path, dest_path);
-    g_free(path); g_free(zip_name); g_free(dest_path);
-    refresh_view();
+    gchar *base = g_path_get_basename(path);
+    ZipOptions options = {0};
+    if (ask_zip_options(base, &options)) {
+        gchar *zip_name = g_strconcat(base, archive_extension(&options), NULL);
+        gchar *dest_path = g_build_filename(current_path, zip_name, NULL);
+        track_job(job_start_zip(path, dest_path, &options));
+        g_free(zip_name); g_free(dest_path);
+    }
+    g_free(path); g_free(base);
+}
+
+static void on_extract(GtkMenuItem *item, gpointer data) {
+    gchar *path = get_selected_path();
+    if (!path) return;
+    // The archive's contents go into the folder that is being shown, next to the archive.
+    track_job(job_start_unzip(path, current_path));
+    g_free(path);
+}
+
+static void on_test_archive(GtkMenuItem *item, gpointer data) {
+    gchar *path = get_selected_path();
+    if (!path) return;
+    // The job's row reports the result when it finishes (see job_get_summary()).
+    track_job(job_start_test(path));
+    g_free(path);
 }
 
 static void on_create_folder(GtkMenuItem *item, gpointer data) {
@@ -373,6 +567,125 @@ static void on_create_file(GtkMenuItem *item, gpointer data) {
     refresh_view();
 }
 
+// --- Background Job Progress ---
+
+/**
+ * @brief Callback for a job row's "Cancel" button.
+ */
+static void on_cancel_job(GtkButton *button, gpointer data) {
+    JobRow *jr = data;
+    job_cancel(jr->job);
+    // Grey the button out; the row disappears once the job has cleaned up and stopped.
+    gtk_widget_set_sensitive(GTK_WIDGET(button), FALSE);
+}
+
+/**
+ * @brief Turns a job snapshot into the text shown on its progress bar,
+ * e.g. "Copying 'Photos' — 1.2 GB of 4.0 GB, 85.3 MB/s, 0:42 left".
+ */
+static gchar* describe_progress(Job *job, const JobSnapshot *snap) {
+    GString *text = g_string_new(job_get_description(job));
+    if (snap->state == JOB_QUEUED) {
+        // The job is still counting, or the scheduler is holding it back until its disk is free.
+        g_string_append(text, " — queued");
+    } else if (snap->bytes_total > 0) {
+        gchar *done = g_format_size(snap->bytes_done), *total = g_format_size(snap->bytes_total);
+        g_string_append_printf(text, " — %s of %s", done, total);
+        g_free(done); g_free(total);
+    } else if (snap->files_total > 0) {
+        g_string_append_printf(text, " — %u of %u items", snap->files_done, snap->files_total);
+    } else if (snap->files_done > 0) {
+        // Deletes are not measured beforehand, so there is only a count so far.
+        g_string_append_printf(text, " — %u items", snap->files_done);
+    }
+    if (snap->bytes_per_second > 0) {
+        gchar *rate = g_format_size((guint64)snap->bytes_per_second);
+        g_string_append_printf(text, ", %s/s", rate);
+        g_free(rate);
+    }
+    if (snap->eta_seconds >= 0)
+        g_string_append_printf(text, ", %" G_GINT64_FORMAT ":%02d left", snap->eta_seconds / 60, (int)(snap->eta_seconds % 60));
+    return g_string_free(text, FALSE);
+}
+
+/**
+ * @brief Timer callback: refreshes every job row and removes the rows of finished jobs.
+ * This runs on the GTK main thread, so it is allowed to touch widgets; it only reads
+ * snapshots, so it never waits for the worker threads' disk I/O.
+ */
+static gboolean poll_jobs(gpointer data) {
+    gboolean any_finished = FALSE;
+    GList *l = job_rows;
+    while (l != NULL) {
+        GList *next = l->next;
+        JobRow *jr = l->data;
+        JobSnapshot snap;
+        job_get_snapshot(jr->job, &snap);
+        if (job_state_is_finished(snap.state)) {
+            gint64 now = g_get_monotonic_time();
+            if (jr->remove_at_us == 0) {
+                // The job has just finished (or failed, or was cancelled). If it has something
+                // to report, the row shows that for a while; otherwise it goes away right now.
+                gchar *summary = job_get_summary(jr->job);
+                jr->remove_at_us = now;
+                if (summary) {
+                    gtk_progress_bar_set_fraction(jr->bar, 1.0);
+                    gtk_progress_bar_set_text(jr->bar, summary);
+                    gtk_widget_set_sensitive(jr->cancel, FALSE);
+                    jr->remove_at_us += JOB_SUMMARY_SECONDS * G_USEC_PER_SEC;
+                    g_free(summary);
+                }
+                any_finished = TRUE;
+            }
+            if (now >= jr->remove_at_us) {
+                gtk_widget_destroy(jr->row);
+                job_unref(jr->job);
+                g_free(jr);
+                job_rows = g_list_delete_link(job_rows, l);
+            }
+        } else {
+            gdouble fraction = 0;
+            if (snap.bytes_total > 0) fraction = (gdouble)snap.bytes_done / snap.bytes_total;
+            else if (snap.files_total > 0) fraction = (gdouble)snap.files_done / snap.files_total;
+            // With no total at all (a delete), the bar pulses to show the job is moving.
+            if (snap.state == JOB_RUNNING && snap.bytes_total == 0 && snap.files_total == 0)
+                gtk_progress_bar_pulse(jr->bar);
+            else
+                gtk_progress_bar_set_fraction(jr->bar, MIN(fraction, 1.0));
+            gchar *text = describe_progress(jr->job, &snap);
+            gtk_progress_bar_set_text(jr->bar, text);
+            g_free(text);
+        }
+        l = next;
+    }
+    // A finished job has changed the file system, so show the new state of the folder.
+    if (any_finished) refresh_view();
+    if (job_rows == NULL) { job_poll_id = 0; return G_SOURCE_REMOVE; }
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * @brief Adds a progress row for a freshly started job and makes sure the poll timer runs.
+ * Takes over the caller's reference to the job.
+ */
+static void track_job(Job *job) {
+    JobRow *jr = g_new0(JobRow, 1);
+    jr->job = job;
+    jr->row = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+    jr->bar = GTK_PROGRESS_BAR(gtk_progress_bar_new());
+    gtk_progress_bar_set_show_text(jr->bar, TRUE);
+    gtk_progress_bar_set_text(jr->bar, job_get_description(job));
+    jr->cancel = gtk_button_new_with_label("Cancel");
+    g_signal_connect(jr->cancel, "clicked", G_CALLBACK(on_cancel_job), jr);
+    gtk_box_pack_start(GTK_BOX(jr->row), GTK_WIDGET(jr->bar), TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(jr->row), jr->cancel, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(jobs_box), jr->row, FALSE, FALSE, 0);
+    gtk_widget_show_all(jr->row);
+    job_rows = g_list_append(job_rows, jr);
+    // Five updates per second is smooth enough for a progress bar and costs almost nothing.
+    if (job_poll_id == 0) job_poll_id = g_timeout_add(200, poll_jobs, NULL);
+}
+
 // This is the entry point of our entire application.
 int main(int argc, char **argv) {
     // Create a new GTK application instance. This sets up the connection to the windowing system.
@@ -385,5 +698,7 @@ int main(int argc, char **argv) {
     // When the user closes the window, the loop ends. We clean up our global variables to be good citizens.
     g_object_unref(app);
     g_free(current_path); g_free(clipboard_path); g_free(clipboard_op);
+    // Files taken out of archives to be opened were only ever temporary.
+    remove_extracted_members();
     return status;
 }
@@ -0,0 +1,293 @@
+/**
+ * @file purge.c
+ * @brief Implementation of staged deletes and the background purger.
+ *
+ * Every staged delete gets its own folder "<staging folder>/<id>/" holding the item under its
+ * original name. The purger deletes whole "<id>" folders, so anything found in a staging
+ * folder at startup is simply a purge that did not finish. The staging folders themselves
+ * are listed in a small file in the user's state directory, so they can be found again.
+ */
+
+#include "purge.h"
+#include "rmtree.h"
+#include "saferename.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+// ioprio_set() has no glibc wrapper; these values come from <linux/ioprio.h>.
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
+// One staged item waiting to be purged.
+typedef struct {
+    gchar *token;           // "<staging folder>/<id>", the folder holding the staged item.
+    gchar *staging_dir;
+    gchar *id;
+    gchar *original_path;   // Where the item came from (NULL for leftovers of an earlier run).
+    gint64 due_us;          // When the purger may start on it (monotonic clock).
+} PurgeEntry;
+
+// A statically allocated GMutex/GCond needs no initialisation.
+static GMutex purge_lock;
+static GCond purge_cond;
+static GQueue pending = G_QUEUE_INIT;   // PurgeEntry*, oldest first (so also in due order).
+static GHashTable *staging_dirs = NULL; // Every staging folder ever used: a set of paths.
+static GThread *purger = NULL;
+
+static void purge_entry_free(PurgeEntry *entry) {
+    g_free(entry->token);
+    g_free(entry->staging_dir);
+    g_free(entry->id);
+    g_free(entry->original_path);
+    g_free(entry);
+}
+
+static gchar* registry_path(void) {
+    return g_build_filename(g_get_user_state_dir(), "filemanager", "purge-dirs", NULL);
+}
+
+/**
+ * @brief Loads the list of staging folders (one path per line). Called with the lock held.
+ */
+static void load_registry(void) {
+    if (staging_dirs) return;
+    staging_dirs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    gchar *path = registry_path(), *contents = NULL;
+    if (g_file_get_contents(path, &contents, NULL, NULL)) {
+        gchar **lines = g_strsplit(contents, "\n", -1);
+        for (gchar **line = lines; *line; line++)
+            if (**line) g_hash_table_add(staging_dirs, g_strdup(*line));
+        g_strfreev(lines);
+        g_free(contents);
+    }
+    g_free(path);
+}
+
+/**
+ * @brief Adds a staging folder to the list, if it is new. Called with the lock held.
+ */
+static void remember_staging_dir(const gchar *dir) {
+    if (g_hash_table_contains(staging_dirs, dir)) return;
+    g_hash_table_add(staging_dirs, g_strdup(dir));
+    gchar *path = registry_path();
+    gchar *parent = g_path_get_dirname(path);
+    g_mkdir_with_parents(parent, 0700);
+    gchar *line = g_strconcat(dir, "\n", NULL);
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    gboolean written = (fd != -1 && write(fd, line, strlen(line)) == (ssize_t)strlen(line));
+    if (fd != -1) close(fd);
+    // Deleting still works without the entry, but a restart would not find this folder:
+    // forget it, so the next delete tries to record it again.
+    if (!written) g_hash_table_remove(staging_dirs, dir);
+    g_free(line);
+    g_free(parent);
+    g_free(path);
+}
+
+/**
+ * @brief Finds the top folder of the file system `path` is on: the last folder on the way
+ * up to "/" that is still on device `dev`.
+ */
+static gchar* file_system_top(dev_t dev, const gchar *path) {
+    gchar *dir = g_path_get_dirname(path);
+    for (;;) {
+        gchar *parent = g_path_get_dirname(dir);
+        struct stat st;
+        if (strcmp(parent, dir) == 0 || stat(parent, &st) != 0 || st.st_dev != dev) { g_free(parent); break; }
+        g_free(dir);
+        dir = parent;
+    }
+    return dir;
+}
+
+/**
+ * @brief Checks that a staging folder is usable: a real folder (not a symlink someone could
+ * point elsewhere), owned by us, on the right device.
+ */
+static gboolean is_usable_staging_dir(const gchar *dir, dev_t dev) {
+    struct stat st;
+    return lstat(dir, &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == getuid() && st.st_dev == dev;
+}
+
+/**
+ * @brief Finds (creating it if needed) a staging folder on device `dev`, or returns NULL.
+ * The user's own data folder is tried first. Otherwise a ".filemanager-purge-UID" folder at
+ * the top of the file system is used, like the ".Trash-UID" folders of desktop trash cans.
+ */
+static gchar* staging_dir_for(dev_t dev, const gchar *path) {
+    gchar *dir = g_build_filename(g_get_user_data_dir(), "filemanager", "purge", NULL);
+    g_mkdir_with_parents(dir, 0700);
+    if (is_usable_staging_dir(dir, dev)) return dir;
+    g_free(dir);
+
+    gchar *top = file_system_top(dev, path);
+    gchar *name = g_strdup_printf(".filemanager-purge-%u", (guint)getuid());
+    dir = g_build_filename(top, name, NULL);
+    mkdir(dir, 0700);
+    g_free(top);
+    g_free(name);
+    if (is_usable_staging_dir(dir, dev)) return dir;
+    g_free(dir);
+    return NULL;
+}
+
+/**
+ * @brief Gives the calling thread idle I/O priority: the disk only works on its requests
+ * when nobody else needs it.
+ */
+static void lower_io_priority(void) {
+#if defined(__linux__) && defined(SYS_ioprio_set)
+    // With who = 0, IOPRIO_WHO_PROCESS means the calling thread only.
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#endif
+}
+
+/**
+ * @brief The purger thread: deletes staged items once their undo time has passed.
+ * It lives as long as the program; an unfinished purge is picked up again by purge_init().
+ */
+static gpointer purger_thread(gpointer data) {
+    lower_io_priority();
+    g_mutex_lock(&purge_lock);
+    for (;;) {
+        PurgeEntry *entry = g_queue_peek_head(&pending);
+        if (!entry) { g_cond_wait(&purge_cond, &purge_lock); continue; }
+        if (entry->due_us > g_get_monotonic_time()) {
+            g_cond_wait_until(&purge_cond, &purge_lock, entry->due_us);
+            continue;
+        }
+        // Once taken off the queue the item can no longer be restored.
+        g_queue_pop_head(&pending);
+        g_mutex_unlock(&purge_lock);
+
+        int dir_fd = open(entry->staging_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd != -1) {
+            // Sequential, so every unlink runs on this thread, at its idle I/O priority.
+            // rmtree_at()'s worker threads and io_uring workers would run at normal priority.
+            rmtree_at_sequential(dir_fd, entry->id, NULL);
+            close(dir_fd);
+        }
+        purge_entry_free(entry);
+        g_mutex_lock(&purge_lock);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Queues an entry and makes sure the purger is running. Called with the lock held.
+ */
+static void schedule(PurgeEntry *entry) {
+    g_queue_push_tail(&pending, entry);
+    if (!purger) purger = g_thread_new("purger", purger_thread, NULL);
+    g_cond_signal(&purge_cond);
+}
+
+static PurgeEntry* find_entry(const gchar *token) {
+    for (GList *l = pending.head; l != NULL; l = l->next)
+        if (strcmp(((PurgeEntry *)l->data)->token, token) == 0) return l->data;
+    return NULL;
+}
+
+void purge_init(void) {
+    g_mutex_lock(&purge_lock);
+    load_registry();
+    GHashTableIter iter;
+    gpointer key;
+    g_hash_table_iter_init(&iter, staging_dirs);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        DIR *d = opendir(key);
+        if (!d) continue;
+        struct dirent *de;
+        while ((de = readdir(d)) != NULL) {
+            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+            // Left over from an earlier run: the undo window is long gone, so purge right away.
+            PurgeEntry *entry = g_new0(PurgeEntry, 1);
+            entry->staging_dir = g_strdup(key);
+            entry->id = g_strdup(de->d_name);
+            entry->token = g_build_filename(entry->staging_dir, entry->id, NULL);
+            entry->due_us = g_get_monotonic_time();
+            schedule(entry);
+        }
+        closedir(d);
+    }
+    g_mutex_unlock(&purge_lock);
+}
+
+gchar* purge_stage(const gchar *path) {
+    struct stat st;
+    if (lstat(path, &st) != 0) return NULL;
+    gchar *staging = staging_dir_for(st.st_dev, path);
+    if (!staging) return NULL;
+
+    // Record the staging folder before anything is moved into it, so a crash right after
+    // the rename can't leave an item there that no later run knows about.
+    g_mutex_lock(&purge_lock);
+    load_registry();
+    remember_staging_dir(staging);
+    g_mutex_unlock(&purge_lock);
+
+    gchar *id = g_strdup_printf("%" G_GINT64_FORMAT "-%08x", g_get_real_time(), g_random_int());
+    gchar *token = g_build_filename(staging, id, NULL);
+    gchar *base = g_path_get_basename(path);
+    gchar *staged_path = g_build_filename(token, base, NULL);
+    gboolean ok = (mkdir(token, 0700) == 0);
+    // This is the whole delete as far as the user can tell: one rename(), however big the item.
+    if (ok && rename(path, staged_path) != 0) {
+        rmdir(token);
+        ok = FALSE;
+    }
+    gchar *result = NULL;
+    if (ok) {
+        PurgeEntry *entry = g_new0(PurgeEntry, 1);
+        entry->token = g_strdup(token);
+        entry->staging_dir = g_strdup(staging);
+        entry->id = g_strdup(id);
+        entry->original_path = g_strdup(path);
+        entry->due_us = g_get_monotonic_time() + (gint64)PURGE_UNDO_SECONDS * G_USEC_PER_SEC;
+        g_mutex_lock(&purge_lock);
+        schedule(entry);
+        g_mutex_unlock(&purge_lock);
+        result = g_strdup(token);
+    }
+    g_free(staging); g_free(id); g_free(token); g_free(base); g_free(staged_path);
+    return result;
+}
+
+gboolean purge_can_restore(const gchar *token) {
+    g_mutex_lock(&purge_lock);
+    PurgeEntry *entry = find_entry(token);
+    gboolean result = (entry && entry->original_path);
+    g_mutex_unlock(&purge_lock);
+    return result;
+}
+
+gboolean purge_restore(const gchar *token) {
+    // Holding the lock keeps the purger from taking the entry while we move it back.
+    g_mutex_lock(&purge_lock);
+    PurgeEntry *entry = find_entry(token);
+    gboolean ok = FALSE;
+    if (entry && entry->original_path) {
+        gchar *base = g_path_get_basename(entry->original_path);
+        gchar *staged_path = g_build_filename(entry->token, base, NULL);
+        // Never overwrite something that has appeared under the old name in the meantime.
+        ok = (rename_noreplace(AT_FDCWD, staged_path, AT_FDCWD, entry->original_path) == 0);
+        if (ok) {
+            rmdir(entry->token);
+            g_queue_remove(&pending, entry);
+            purge_entry_free(entry);
+        }
+        g_free(base);
+        g_free(staged_path);
+    }
+    g_mutex_unlock(&purge_lock);
+    return ok;
+}
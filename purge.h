@@ -0,0 +1,38 @@
+/**
+ * @file purge.h
+ * @brief Instant deletes: move the item out of sight now, free the disk space later.
+ *
+ * Deleting a huge tree takes as long as it takes the file system to forget every file in
+ * it. But renaming the tree into a hidden "staging" folder on the same file system is a
+ * single, instant rename(). From the user's point of view the item is gone; a background
+ * "purger" thread then deletes the staged tree at idle I/O priority.
+ *
+ * Staged items wait a short while before they are purged, so a delete can still be undone.
+ * Staged items that were not purged yet when the program exited are purged on the next start.
+ */
+
+#ifndef PURGE_H
+#define PURGE_H
+
+#include <glib.h>
+
+// How long a staged delete can still be undone.
+#define PURGE_UNDO_SECONDS 60
+
+// Finds staged items left behind by an earlier run and schedules them for purging.
+// Call once at startup.
+void purge_init(void);
+
+// Moves `path` into a staging folder on its own file system and schedules it for purging.
+// Returns a token for purge_restore() (free with g_free()), or NULL if the item could not be
+// staged (e.g. no staging folder could be created on its file system); the caller should
+// then delete it the normal way.
+gchar* purge_stage(const gchar *path);
+
+// TRUE if the staged item can still be put back (it has not started being purged).
+gboolean purge_can_restore(const gchar *token);
+
+// Puts a staged item back where it was, unless something else has taken its name since.
+gboolean purge_restore(const gchar *token);
+
+#endif // PURGE_H
@@ -0,0 +1,297 @@
+/**
+ * @file rmtree.c
+ * @brief Implementation of the parallel tree delete.
+ *
+ * Each directory is a DeleteDir with a counter of children that are still being deleted
+ * (plus one while the directory itself is being listed). Files are unlinked straight away;
+ * subdirectories get their own DeleteDir, handed to the thread pool or, when the pool
+ * already has plenty of work queued, processed on the spot. Whoever brings a counter down
+ * to zero removes that directory and then decrements its parent's counter in turn.
+ *
+ * A directory's fd stays open while it has pending children, because they unlink their
+ * entries relative to it. Limiting the queue keeps the number of open directories small.
+ *
+ * Where io_uring is available, a worker doesn't unlink files one by one: it collects up to
+ * URING_BATCH names and submits them in one go. All of a directory's unlinks have completed
+ * before the directory drops its own reference, so it is still never removed too early.
+ *
+ * Every DeleteDir holds a descriptor, and a deep chain of them would hold one per level.
+ * Below MAX_PARALLEL_DEPTH a subtree is therefore handed to the tree walker instead, which
+ * deletes it on the spot within its own descriptor budget.
+ */
+
+#include "rmtree.h"
+#include "scheduler.h"
+#include "uring.h"
+#include "treewalk.h"
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+// Worker threads for an SSD (further limited by the number of CPUs: the work is done by the
+// kernel on our threads, so more threads than CPUs would only take turns).
+#define MAX_WORKERS 8
+// Directories queued per worker before workers start processing subdirectories themselves.
+#define QUEUE_PER_WORKER 4
+// Directory levels deleted in parallel; anything deeper is deleted by the tree walker.
+#define MAX_PARALLEL_DEPTH 16
+// Files unlinked per io_uring submission.
+#define URING_BATCH 128
+
+typedef struct DeleteDir DeleteDir;
+struct DeleteDir {
+    DeleteDir *parent;      // NULL for the top directory of the delete.
+    int parent_fd;          // The parent's fd (the caller's fd for the top directory).
+    gchar *name;
+    int fd;                 // This directory, open until all of its children are gone.
+    int depth;              // 0 for the top directory of the delete.
+    gint pending;           // Children still being deleted, plus 1 while we are listing it.
+};
+
+// What all workers of one delete share.
+typedef struct {
+    GThreadPool *pool;
+    GAsyncQueue *rings;     // Idle io_uring queues (Uring*), or NULL to unlink with plain calls.
+    OpProgress *progress;
+    gint queued;            // Directories waiting in the pool.
+    gint max_queued;
+    gint failed;            // Set when anything could not be deleted.
+    GMutex lock;
+    GCond cond;
+    gboolean finished;      // Set once the top directory has been dealt with.
+} DeleteRun;
+
+/**
+ * @brief Called when one child of `dir` is gone (or when listing `dir` has ended).
+ * If that was the last one, removes the directory and repeats the step for its parent.
+ */
+static void child_done(DeleteRun *run, DeleteDir *dir) {
+    while (dir && g_atomic_int_dec_and_test(&dir->pending)) {
+        if (dir->fd != -1) close(dir->fd);
+        // After a cancel some children may be left, so the directory can't be removed.
+        if (!op_progress_is_cancelled(run->progress)) {
+            if (unlinkat(dir->parent_fd, dir->name, AT_REMOVEDIR) == 0) op_progress_add(run->progress, 0, 1);
+            else g_atomic_int_set(&run->failed, TRUE);
+        }
+        DeleteDir *parent = dir->parent;
+        g_free(dir->name);
+        g_free(dir);
+        if (!parent) {
+            g_mutex_lock(&run->lock);
+            run->finished = TRUE;
+            g_cond_signal(&run->cond);
+            g_mutex_unlock(&run->lock);
+        }
+        dir = parent;
+    }
+}
+
+static DeleteDir* delete_dir_new(DeleteDir *parent, int parent_fd, const gchar *name) {
+    DeleteDir *dir = g_new0(DeleteDir, 1);
+    dir->parent = parent;
+    dir->depth = parent ? parent->depth + 1 : 0;
+    dir->parent_fd = parent_fd;
+    dir->name = g_strdup(name);
+    dir->fd = -1;
+    dir->pending = 1;
+    return dir;
+}
+
+/**
+ * @brief The tree-walk callback for subtrees below MAX_PARALLEL_DEPTH and for sequential
+ * deletes. Like the workers, it unlinks files as it sees them and removes each directory
+ * after its children (DIR_POST).
+ */
+static TreeWalkResult delete_cb(TreeWalkEntry *e, gpointer user_data) {
+    DeleteRun *run = user_data;
+    if (op_progress_is_cancelled(run->progress)) return TREE_WALK_STOP;
+    if (e->event == TREE_WALK_DIR_PRE) return TREE_WALK_CONTINUE;
+    if (unlinkat(e->parent_fd, e->name, e->event == TREE_WALK_DIR_POST ? AT_REMOVEDIR : 0) != 0) return TREE_WALK_FAILED;
+    op_progress_add(run->progress, 0, 1);
+    return TREE_WALK_CONTINUE;
+}
+
+// Marks a name of a batch whose unlink never reported back (it is no errno value).
+#define NO_RESULT 1
+
+// Called for each completed unlink of a batch (user_data is the name's index in the batch).
+static void unlink_done(guint64 user_data, int result, gpointer data) {
+    int *results = data;
+    results[user_data] = result;
+}
+
+/**
+ * @brief Submits the queued unlinks of the directory `dir_fd` and waits for all of them. If
+ * the ring breaks, it is freed and *ring set to NULL, so the rest of the delete uses plain
+ * unlinkat(); the names of this batch it didn't get to are unlinked that way right here.
+ */
+static void flush_unlinks(DeleteRun *run, Uring **ring, int dir_fd, GPtrArray *names) {
+    if (names->len == 0) return;
+    int results[URING_BATCH];
+    for (guint i = 0; i < names->len; i++) results[i] = NO_RESULT;
+    gboolean ring_ok = uring_run(*ring, unlink_done, results);
+    if (!ring_ok) {
+        uring_free(*ring);
+        *ring = NULL;
+    }
+    for (guint i = 0; i < names->len; i++) {
+        int result = results[i];
+        if (result != 0 && !ring_ok) {
+            // An unlink whose result was lost may have happened after all: then the name is
+            // gone already, which is just as good.
+            result = (unlinkat(dir_fd, g_ptr_array_index(names, i), 0) == 0 || errno == ENOENT) ? 0 : -errno;
+        }
+        if (result == 0) op_progress_add(run->progress, 0, 1);
+        else g_atomic_int_set(&run->failed, TRUE);
+    }
+    g_ptr_array_set_size(names, 0);
+}
+
+/**
+ * @brief Lists one directory: unlinks its files and starts on its subdirectories.
+ * `ring` is the worker's io_uring queue (NULL to unlink with plain calls); it is empty on entry
+ * and on return, and may be set to NULL if it stops working.
+ */
+static void delete_dir_contents(DeleteRun *run, DeleteDir *dir, Uring **ring) {
+    // O_NOFOLLOW: if the directory was swapped for a symlink, we must not delete its target.
+    dir->fd = openat(dir->parent_fd, dir->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    // The DIR stream gets its own duplicate, so closing it leaves dir->fd open for the children.
+    DIR *d = (dir->fd != -1) ? fdopendir(dup(dir->fd)) : NULL;
+    if (!d) g_atomic_int_set(&run->failed, TRUE);
+    GPtrArray *names = *ring ? g_ptr_array_new_with_free_func(g_free) : NULL;
+
+    struct dirent *de;
+    while (d && !op_progress_is_cancelled(run->progress) && (de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+        // readdir() usually tells us the type for free; only some file systems need a stat.
+        gboolean is_dir = (de->d_type == DT_DIR);
+        if (de->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = (fstatat(dir->fd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode));
+        }
+        if (!is_dir && *ring) {
+            // readdir() reuses its buffer, so the name must be copied until the batch is done.
+            g_ptr_array_add(names, g_strdup(de->d_name));
+            uring_queue_unlinkat(*ring, dir->fd, g_ptr_array_index(names, names->len - 1), 0, names->len - 1);
+            // (The batch also has to fit flush_unlinks()'s table of results.)
+            if (uring_space(*ring) == 0 || names->len == URING_BATCH) flush_unlinks(run, ring, dir->fd, names);
+            continue;
+        }
+        if (!is_dir) {
+            if (unlinkat(dir->fd, de->d_name, 0) == 0) op_progress_add(run->progress, 0, 1);
+            else g_atomic_int_set(&run->failed, TRUE);
+            continue;
+        }
+
+        if (dir->depth + 1 >= MAX_PARALLEL_DEPTH) {
+            if (!tree_walk_at(dir->fd, de->d_name, delete_cb, run)) g_atomic_int_set(&run->failed, TRUE);
+            continue;
+        }
+        DeleteDir *child = delete_dir_new(dir, dir->fd, de->d_name);
+        g_atomic_int_inc(&dir->pending);
+        // Hand the subdirectory to another worker while the pool has room; otherwise go
+        // into it ourselves, which also bounds how many directories are open at once.
+        if (g_atomic_int_get(&run->queued) < run->max_queued) {
+            g_atomic_int_inc(&run->queued);
+            g_thread_pool_push(run->pool, child, NULL);
+        } else {
+            // The subdirectory borrows our ring, so it must be empty first.
+            if (*ring) flush_unlinks(run, ring, dir->fd, names);
+            delete_dir_contents(run, child, ring);
+        }
+    }
+    if (d) closedir(d);
+    if (names) {
+        // The directory can only go once every unlink in it has completed.
+        if (*ring) flush_unlinks(run, ring, dir->fd, names);
+        g_ptr_array_free(names, TRUE);
+    }
+    // Listing is over: drop the directory's own reference.
+    child_done(run, dir);
+}
+
+/**
+ * @brief The thread pool's worker function.
+ */
+static void delete_worker(gpointer data, gpointer user_data) {
+    DeleteRun *run = user_data;
+    g_atomic_int_add(&run->queued, -1);
+    // Each worker borrows an idle ring for the task, creating one if none is left over.
+    Uring *ring = NULL;
+    if (run->rings) {
+        ring = g_async_queue_try_pop(run->rings);
+        if (!ring) ring = uring_new(URING_BATCH);
+    }
+    delete_dir_contents(run, data, &ring);
+    if (ring) g_async_queue_push(run->rings, ring);
+}
+
+/**
+ * @brief rmtree_at(), with io_uring allowed or not.
+ */
+static gboolean delete_tree(int parent_fd, const gchar *name, gboolean allow_uring, OpProgress *progress) {
+    struct stat st;
+    if (fstatat(parent_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) return FALSE;
+    if (!S_ISDIR(st.st_mode)) {
+        if (op_progress_is_cancelled(progress) || unlinkat(parent_fd, name, 0) != 0) return FALSE;
+        op_progress_add(progress, 0, 1);
+        return TRUE;
+    }
+
+    DeleteRun run;
+    memset(&run, 0, sizeof(run));
+    run.progress = progress;
+    g_mutex_init(&run.lock);
+    g_cond_init(&run.cond);
+    // A spinning disk has to seek for every metadata update, so parallel deletes only make
+    // its head jump around more: one worker is enough there.
+    gboolean rotational = io_device_is_rotational(st.st_dev);
+    gint workers = rotational ? 1 : CLAMP(g_get_num_processors(), 1, MAX_WORKERS);
+    // io_uring lets the kernel run a batch of unlinks in parallel: good for an SSD, but on a
+    // spinning disk it would only bring back the seeking we avoid above. The first ring also
+    // tells us whether io_uring works here at all.
+    Uring *ring = (rotational || !allow_uring) ? NULL : uring_new(URING_BATCH);
+    if (ring) {
+        run.rings = g_async_queue_new_full((GDestroyNotify)uring_free);
+        g_async_queue_push(run.rings, ring);
+    }
+    run.max_queued = workers * QUEUE_PER_WORKER;
+    run.pool = g_thread_pool_new(delete_worker, &run, workers, FALSE, NULL);
+
+    run.queued = 1;
+    g_thread_pool_push(run.pool, delete_dir_new(NULL, parent_fd, name), NULL);
+
+    // The last worker to finish a directory removes it; the top one sets `finished`.
+    g_mutex_lock(&run.lock);
+    while (!run.finished) g_cond_wait(&run.cond, &run.lock);
+    g_mutex_unlock(&run.lock);
+
+    // Every directory is done; freeing the pool waits for the workers to return.
+    g_thread_pool_free(run.pool, FALSE, TRUE);
+    if (run.rings) g_async_queue_unref(run.rings);
+    g_mutex_clear(&run.lock);
+    g_cond_clear(&run.cond);
+    return !run.failed && !op_progress_is_cancelled(progress);
+}
+
+gboolean rmtree_at(int parent_fd, const gchar *name, OpProgress *progress) {
+    return delete_tree(parent_fd, name, TRUE, progress);
+}
+
+gboolean rmtree_at_without_uring(int parent_fd, const gchar *name, OpProgress *progress) {
+    return delete_tree(parent_fd, name, FALSE, progress);
+}
+
+gboolean rmtree_at_sequential(int parent_fd, const gchar *name, OpProgress *progress) {
+    // Only the progress is used by delete_cb; there is no pool to share.
+    DeleteRun run;
+    memset(&run, 0, sizeof(run));
+    run.progress = progress;
+    // The tree walker handles a file or a whole tree, within its own descriptor budget.
+    gboolean ok = tree_walk_at(parent_fd, name, delete_cb, &run);
+    return ok && !op_progress_is_cancelled(progress);
+}
@@ -0,0 +1,34 @@
+/**
+ * @file rmtree.h
+ * @brief Deleting big directory trees with several threads at once.
+ *
+ * Deleting a tree is mostly waiting for the file system to update its metadata, one name at
+ * a time. On an SSD many of those updates can be in flight at once, so the tree is split
+ * up: every directory becomes a task for a pool of worker threads, and a directory itself is
+ * removed by whichever thread deletes its last child.
+ *
+ * Background deletes that must not compete with the user's own disk work use
+ * rmtree_at_sequential() instead: it does everything on the calling thread, so an I/O
+ * priority set on that thread applies to every unlink.
+ */
+
+#ifndef RMTREE_H
+#define RMTREE_H
+
+#include <glib.h>
+#include "backend.h"
+
+// Deletes `name` (a file or a whole directory tree) inside the open directory `parent_fd`.
+// Progress is reported per item; bytes are not counted. Once `progress` is cancelled, no
+// further items are deleted. Returns TRUE if everything was deleted.
+gboolean rmtree_at(int parent_fd, const gchar *name, OpProgress *progress);
+
+// The same with worker threads but without io_uring: every unlink is a plain system call. Only
+// there to compare the two (see bench/rmtree_bench.c).
+gboolean rmtree_at_without_uring(int parent_fd, const gchar *name, OpProgress *progress);
+
+// The same, but on the calling thread alone: no worker threads and no io_uring (whose kernel
+// workers would not inherit the thread's I/O priority). Slower, and meant to be.
+gboolean rmtree_at_sequential(int parent_fd, const gchar *name, OpProgress *progress);
+
+#endif // RMTREE_H
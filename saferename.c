@@ -0,0 +1,26 @@
+/**
+ * @file saferename.c
+ * @brief The no-replace rename (see saferename.h).
+ */
+
+#include "saferename.h"
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+int rename_noreplace(int old_dir_fd, const gchar *old_name, int new_dir_fd, const gchar *new_name) {
+#if defined(__linux__) && defined(RENAME_NOREPLACE)
+    // The kernel checks and renames in one atomic step.
+    if (renameat2(old_dir_fd, old_name, new_dir_fd, new_name, RENAME_NOREPLACE) == 0) return 0;
+    // Old kernels and some file systems don't know the flag; any other error is the real answer.
+    if (errno != EINVAL && errno != ENOSYS) return -1;
+#elif defined(__APPLE__)
+    return renameatx_np(old_dir_fd, old_name, new_dir_fd, new_name, RENAME_EXCL);
+#endif
+    // Fallback: check first. Another program could still create the name in between,
+    // but this is the best a plain rename can do.
+    struct stat st;
+    if (fstatat(new_dir_fd, new_name, &st, AT_SYMLINK_NOFOLLOW) == 0) { errno = EEXIST; return -1; }
+    return renameat(old_dir_fd, old_name, new_dir_fd, new_name);
+}
@@ -0,0 +1,21 @@
+/**
+ * @file saferename.h
+ * @brief Renaming without ever replacing an item that already exists.
+ *
+ * A plain rename() silently replaces whatever has the new name. Checking first with stat()
+ * doesn't help: another program can create the name between the check and the rename. The
+ * kernel can do both in one atomic step (renameat2() with RENAME_NOREPLACE on Linux,
+ * renameatx_np() with RENAME_EXCL on macOS); this module uses that wherever it exists.
+ */
+
+#ifndef SAFERENAME_H
+#define SAFERENAME_H
+
+#include <glib.h>
+
+// Renames like renameat(), but fails with EEXIST instead of replacing an existing item. Where
+// the kernel or file system can't do that atomically, it falls back to checking first.
+// Returns 0 on success and -1 (with errno set) on failure.
+int rename_noreplace(int old_dir_fd, const gchar *old_name, int new_dir_fd, const gchar *new_name);
+
+#endif // SAFERENAME_H
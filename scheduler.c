@@ -0,0 +1,224 @@
+/**
+ * @file scheduler.c
+ * @brief Per-device admission control for background jobs.
+ *
+ * All state lives behind one lock. Jobs that cannot start yet wait in a single FIFO queue;
+ * every time a job arrives or finishes, dispatch() scans the queue and admits whatever fits.
+ * A waiting job "blocks" its devices for the jobs queued behind it, so a job that needs two
+ * busy devices is not starved by a stream of later jobs that only need one of them.
+ */
+
+#include "scheduler.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sysmacros.h>  // Provides major() and minor() for splitting a dev_t.
+#endif
+
+// An operation below both of these limits counts as "interactive".
+#define INTERACTIVE_MAX_BYTES (64 * 1024 * 1024)
+#define INTERACTIVE_MAX_FILES 256
+// How many interactive jobs may run on a device on top of its normal limit.
+#define EXPRESS_SLOTS 1
+// After being overtaken this many times by interactive jobs, a bulk job gets priority.
+#define BULK_MAX_PASSED_OVER 4
+// Concurrent jobs per device when we could not tell what kind of device it is.
+#define UNKNOWN_DEVICE_JOBS 2
+// Upper bound on concurrent jobs per SSD (further limited by the number of CPUs).
+#define SSD_MAX_JOBS 4
+
+// What the scheduler knows about one device.
+typedef struct {
+    gint64 key;             // The dev_t, widened so it can be used with g_int64_hash().
+    guint limit;            // How many jobs may use the device at once.
+    guint running;          // Jobs admitted through normal slots.
+    guint running_express;  // Interactive jobs admitted through the express lane.
+} IoDevice;
+
+struct IoTicket {
+    IoDevice **devices;     // The distinct devices this job touches.
+    guint n_devices;
+    IoClass io_class;
+    gboolean granted;       // Set by dispatch() when the job may start.
+    gboolean express;       // Admitted through the express lane rather than a normal slot.
+    guint passed_over;      // How often interactive jobs overtook this (bulk) job.
+};
+
+// A statically allocated GMutex/GCond needs no initialisation.
+static GMutex sched_lock;
+static GCond sched_cond;
+static GHashTable *known_devices = NULL;   // gint64 key -> IoDevice*, never freed.
+static GQueue waiting = G_QUEUE_INIT;      // IoTicket* in arrival order.
+
+IoClass io_class_for_size(guint64 bytes, guint files) {
+    return (bytes <= INTERACTIVE_MAX_BYTES && files <= INTERACTIVE_MAX_FILES) ? IO_CLASS_INTERACTIVE : IO_CLASS_BULK;
+}
+
+/**
+ * @brief Reads /sys/dev/block/MAJ:MIN/queue/rotational for a device.
+ * @return 1 for a spinning disk, 0 for an SSD, -1 if sysfs has no answer.
+ */
+static gint read_rotational(dev_t device) {
+#ifdef __linux__
+    // Major number 0 is used for file systems without a block device of their own
+    // (tmpfs, NFS, btrfs subvolumes, ...), so sysfs cannot tell us anything.
+    if (major(device) == 0) return -1;
+    // A partition (e.g. sda1) has no queue/ directory itself; its parent disk (sda) does.
+    const gchar *patterns[] = { "/sys/dev/block/%u:%u/queue/rotational", "/sys/dev/block/%u:%u/../queue/rotational" };
+    for (guint i = 0; i < G_N_ELEMENTS(patterns); i++) {
+        gchar path[128], *contents = NULL;
+        g_snprintf(path, sizeof(path), patterns[i], major(device), minor(device));
+        if (g_file_get_contents(path, &contents, NULL, NULL)) {
+            gint result = (contents[0] == '1') ? 1 : 0;
+            g_free(contents);
+            return result;
+        }
+    }
+#endif
+    return -1;
+}
+
+gboolean io_device_is_rotational(dev_t device) {
+    return read_rotational(device) == 1;
+}
+
+/**
+ * @brief Finds (or, on first sight, classifies and remembers) a device. Called with the lock held.
+ */
+static IoDevice* lookup_device(dev_t device) {
+    gint64 key = (gint64)device;
+    if (!known_devices) known_devices = g_hash_table_new(g_int64_hash, g_int64_equal);
+    IoDevice *d = g_hash_table_lookup(known_devices, &key);
+    if (d) return d;
+
+    d = g_new0(IoDevice, 1);
+    d->key = key;
+    switch (read_rotational(device)) {
+    case 1:  d->limit = 1; break;  // Spinning disk: one job at a time avoids seek storms.
+    case 0:  d->limit = CLAMP(g_get_num_processors(), 2, SSD_MAX_JOBS); break;
+    default: d->limit = UNKNOWN_DEVICE_JOBS; break;
+    }
+    g_hash_table_insert(known_devices, &d->key, d);
+    return d;
+}
+
+static gboolean ticket_uses(IoTicket *t, GHashTable *set) {
+    for (guint i = 0; i < t->n_devices; i++)
+        if (g_hash_table_contains(set, &t->devices[i]->key)) return TRUE;
+    return FALSE;
+}
+
+static void add_ticket_devices(IoTicket *t, GHashTable *set) {
+    for (guint i = 0; i < t->n_devices; i++) g_hash_table_add(set, &t->devices[i]->key);
+}
+
+/**
+ * @brief Tries to admit one waiting job. Called with the lock held.
+ * @param blocked Devices that an earlier waiting job is already queued for.
+ */
+static gboolean try_admit(IoTicket *t, GHashTable *blocked) {
+    gboolean normal = !ticket_uses(t, blocked);
+    gboolean express = (t->io_class == IO_CLASS_INTERACTIVE);
+    for (guint i = 0; i < t->n_devices; i++) {
+        if (t->devices[i]->running >= t->devices[i]->limit) normal = FALSE;
+        if (t->devices[i]->running_express >= EXPRESS_SLOTS) express = FALSE;
+    }
+    if (!normal && !express) return FALSE;
+
+    t->granted = TRUE;
+    t->express = !normal;
+    for (guint i = 0; i < t->n_devices; i++) {
+        if (t->express) t->devices[i]->running_express++;
+        else t->devices[i]->running++;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief Admits every waiting job that fits. Called with the lock held.
+ * Interactive jobs (and bulk jobs that have waited too long) are considered first, then
+ * the remaining bulk jobs, each group in arrival order.
+ */
+static void dispatch(void) {
+    GHashTable *blocked = g_hash_table_new(g_int64_hash, g_int64_equal);
+    GHashTable *interactive_started = g_hash_table_new(g_int64_hash, g_int64_equal);
+    gboolean any = FALSE;
+
+    for (int pass = 0; pass < 2; pass++) {
+        for (GList *l = waiting.head; l != NULL; l = l->next) {
+            IoTicket *t = l->data;
+            gboolean urgent = (t->io_class == IO_CLASS_INTERACTIVE || t->passed_over >= BULK_MAX_PASSED_OVER);
+            if (t->granted || urgent != (pass == 0)) continue;
+            if (try_admit(t, blocked)) {
+                any = TRUE;
+                if (t->io_class == IO_CLASS_INTERACTIVE) add_ticket_devices(t, interactive_started);
+            } else {
+                // Keep this device's queue order: later jobs must not take "its" slot.
+                add_ticket_devices(t, blocked);
+                if (t->io_class == IO_CLASS_BULK && ticket_uses(t, interactive_started)) t->passed_over++;
+            }
+        }
+    }
+
+    if (any) {
+        GList *l = waiting.head;
+        while (l != NULL) {
+            GList *next = l->next;
+            if (((IoTicket *)l->data)->granted) g_queue_delete_link(&waiting, l);
+            l = next;
+        }
+        g_cond_broadcast(&sched_cond);
+    }
+    g_hash_table_destroy(blocked);
+    g_hash_table_destroy(interactive_started);
+}
+
+static void free_ticket(IoTicket *t) {
+    g_free(t->devices);
+    g_free(t);
+}
+
+IoTicket* io_scheduler_acquire(const dev_t *devices, guint n_devices, IoClass io_class, OpProgress *progress) {
+    IoTicket *t = g_new0(IoTicket, 1);
+    t->io_class = io_class;
+    t->devices = g_new0(IoDevice *, MAX(n_devices, 1));
+
+    g_mutex_lock(&sched_lock);
+    for (guint i = 0; i < n_devices; i++) {
+        IoDevice *d = lookup_device(devices[i]);
+        // A copy within one disk names it twice; it still only takes one slot there.
+        gboolean seen = FALSE;
+        for (guint j = 0; j < t->n_devices; j++) if (t->devices[j] == d) seen = TRUE;
+        if (!seen) t->devices[t->n_devices++] = d;
+    }
+    g_queue_push_tail(&waiting, t);
+    dispatch();
+
+    // Wait to be admitted, waking up regularly to notice a cancel from the UI.
+    while (!t->granted) {
+        if (op_progress_is_cancelled(progress)) {
+            g_queue_remove(&waiting, t);
+            // Our departure may unblock jobs that were queued behind us.
+            dispatch();
+            g_mutex_unlock(&sched_lock);
+            free_ticket(t);
+            return NULL;
+        }
+        g_cond_wait_until(&sched_cond, &sched_lock, g_get_monotonic_time() + G_USEC_PER_SEC / 5);
+    }
+    g_mutex_unlock(&sched_lock);
+    return t;
+}
+
+void io_scheduler_release(IoTicket *ticket) {
+    if (!ticket) return;
+    g_mutex_lock(&sched_lock);
+    for (guint i = 0; i < ticket->n_devices; i++) {
+        if (ticket->express) ticket->devices[i]->running_express--;
+        else ticket->devices[i]->running--;
+    }
+    dispatch();
+    g_mutex_unlock(&sched_lock);
+    free_ticket(ticket);
+}
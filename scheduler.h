@@ -0,0 +1,47 @@
+/**
+ * @file scheduler.h
+ * @brief Decides when a background job may start touching the disk.
+ *
+ * Several copies running at once on the same spinning hard drive are much slower than the
+ * same copies run one after another, because the disk head keeps jumping between files.
+ * On an SSD the opposite is true: a few operations in parallel keep it busy. The scheduler
+ * therefore keeps a per-device limit on how many jobs may run at the same time:
+ *
+ *   - Each job names the devices it reads and writes (the st_dev of its source and target).
+ *   - Whether a device is rotational is read once from sysfs and cached.
+ *   - Rotational disks run one job at a time; SSDs run several. Jobs on different devices
+ *     never wait for each other.
+ *   - Small "interactive" operations get an express lane so they are not stuck behind a
+ *     huge transfer, and bulk jobs that were passed over too often get priority.
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <glib.h>
+#include <sys/types.h>
+#include "backend.h"
+
+// How urgent a job is.
+typedef enum {
+    IO_CLASS_INTERACTIVE,   // Small operations the user is waiting to see finish (a few files).
+    IO_CLASS_BULK           // Large transfers that take a while no matter what.
+} IoClass;
+
+// Proof that a job has been admitted; hand it back with io_scheduler_release().
+typedef struct IoTicket IoTicket;
+
+// Picks a class from the amount of work an operation involves.
+IoClass io_class_for_size(guint64 bytes, guint files);
+
+// Blocks until the job may run on all of `devices`. Returns NULL (without admitting the job)
+// if `progress` is cancelled while waiting.
+IoTicket* io_scheduler_acquire(const dev_t *devices, guint n_devices, IoClass io_class, OpProgress *progress);
+
+// Gives the job's slots back and lets waiting jobs start.
+void io_scheduler_release(IoTicket *ticket);
+
+// Reports whether the device is a rotational disk (TRUE), an SSD/virtual device (FALSE).
+gboolean io_device_is_rotational(dev_t device);
+
+#endif // SCHEDULER_H
@@ -0,0 +1,634 @@
+/**
+ * @file tarball.c
+ * @brief Implementation of the tar.zst / tar.xz writer and reader.
+ *
+ * The writer gathers the tar stream (headers, file data, padding) in one big buffer and hands
+ * it to the compressor a megabyte at a time; zstd and xz then farm the data out to their own
+ * worker threads. The reader does the opposite: it decompresses into a buffer and walks the
+ * headers as they come. Both sides are strictly sequential, so neither ever seeks.
+ */
+
+#include "tarball.h"
+#include "treewalk.h"
+#include "extractdir.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <zstd.h>
+#include <lzma.h>
+
+// Everything in a tar archive comes in blocks of this size.
+#define TAR_BLOCK 512
+// The biggest size (8 GiB - 1) that fits the header's 11 octal digits; bigger files get a pax header.
+#define TAR_MAX_OCTAL_SIZE 077777777777ULL
+// Tar data collected before it goes to the compressor, and compressed data read at once.
+#define BUFFER_SIZE (1024 * 1024)
+// pax and GNU long-name headers bigger than this are not believed.
+#define MAX_META_SIZE (1024 * 1024)
+// Long-distance matching looks back this far (2^27 = 128 MiB). The reader accepts windows up to
+// this size, and no bigger: a crafted archive could otherwise make it allocate gigabytes.
+#define ZSTD_LONG_WINDOW_LOG 27
+
+// zstd levels for our scale of 1 (fastest) to 9 (smallest); index 0 is the default.
+static const int zstd_levels[] = { 3, 1, 2, 3, 5, 7, 9, 12, 15, 19 };
+
+// The first bytes of compressed streams, to recognise them when extracting.
+static const guchar zstd_magic[] = { 0x28, 0xB5, 0x2F, 0xFD };
+static const guchar xz_magic[] = { 0xFD, '7', 'z', 'X', 'Z', 0x00 };
+
+typedef enum {
+    CODEC_NONE,     // A plain .tar.
+    CODEC_ZSTD,
+    CODEC_XZ
+} Codec;
+
+typedef struct {
+    int fd;                 // The temporary archive file.
+    Codec codec;
+    ZSTD_CCtx *zstd;
+    lzma_stream xz;
+    guchar *in;             // Tar data waiting to be compressed...
+    gsize in_len;           // ...and how much of it there is.
+    guchar *out;            // Compressed data on its way to the file.
+    gboolean failed;        // Writing the archive failed; the walk stops.
+    ZipStats stats;
+    OpProgress *progress;
+} TarWriter;
+
+typedef struct {
+    int fd;
+    Codec codec;
+    ZSTD_DCtx *zstd;
+    gsize zstd_left;        // What the last ZSTD_decompressStream() returned: 0 at the end of a frame.
+    lzma_stream xz;
+    gboolean xz_ended;
+    guchar *in;             // Compressed data read from the file...
+    gsize in_len, in_pos;   // ...how much, and how much of it is used up.
+    gboolean in_eof;
+    guchar *data;           // Room for file data on its way out.
+    OpProgress *progress;
+} TarReader;
+
+static gboolean write_full(int fd, const guchar *buf, gsize len) {
+    while (len > 0) {
+        gssize n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return FALSE;
+        buf += n;
+        len -= n;
+    }
+    return TRUE;
+}
+
+static gsize padding(guint64 size) {
+    return (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+}
+
+// --- Writing ---
+
+static gboolean write_out(TarWriter *tw, gsize len) {
+    tw->stats.bytes_out += len;
+    return write_full(tw->fd, tw->out, len);
+}
+
+/**
+ * @brief Compresses `len` bytes of tar data and writes the result. With `finish`, the
+ * compressor also writes out everything it still holds and ends the stream.
+ */
+static gboolean compress_data(TarWriter *tw, const guchar *data, gsize len, gboolean finish) {
+    if (tw->codec == CODEC_NONE) {
+        tw->stats.bytes_out += len;
+        return write_full(tw->fd, data, len);
+    }
+    if (tw->codec == CODEC_ZSTD) {
+        ZSTD_inBuffer in = { data, len, 0 };
+        gsize left;
+        // With worker threads, zstd may take only part of the input at a time, so keep going
+        // until it has all of it (and, when finishing, until nothing is left inside).
+        do {
+            ZSTD_outBuffer out = { tw->out, BUFFER_SIZE, 0 };
+            left = ZSTD_compressStream2(tw->zstd, &out, &in, finish ? ZSTD_e_end : ZSTD_e_continue);
+            if (ZSTD_isError(left) || !write_out(tw, out.pos)) return FALSE;
+        } while (finish ? left != 0 : in.pos < in.size);
+        return TRUE;
+    }
+    tw->xz.next_in = data;
+    tw->xz.avail_in = len;
+    lzma_ret ret;
+    do {
+        tw->xz.next_out = tw->out;
+        tw->xz.avail_out = BUFFER_SIZE;
+        ret = lzma_code(&tw->xz, finish ? LZMA_FINISH : LZMA_RUN);
+        if ((ret != LZMA_OK && ret != LZMA_STREAM_END) || !write_out(tw, BUFFER_SIZE - tw->xz.avail_out)) return FALSE;
+    } while (finish ? ret != LZMA_STREAM_END : tw->xz.avail_in > 0);
+    return TRUE;
+}
+
+static gboolean flush_input(TarWriter *tw, gboolean finish) {
+    if (!tw->failed && !compress_data(tw, tw->in, tw->in_len, finish)) tw->failed = TRUE;
+    tw->in_len = 0;
+    return !tw->failed;
+}
+
+/**
+ * @brief Appends tar data (NULL for zeros) to the buffer, compressing it whenever it is full.
+ */
+static gboolean put(TarWriter *tw, const void *data, gsize len) {
+    while (len > 0) {
+        if (tw->in_len == BUFFER_SIZE && !flush_input(tw, FALSE)) return FALSE;
+        gsize n = MIN(len, BUFFER_SIZE - tw->in_len);
+        if (data) {
+            memcpy(tw->in + tw->in_len, data, n);
+            data = (const guchar *)data + n;
+        } else {
+            memset(tw->in + tw->in_len, 0, n);
+        }
+        tw->in_len += n;
+        len -= n;
+    }
+    return !tw->failed;
+}
+
+// Writes `value` as zero-padded octal digits filling a header field, followed by a NUL.
+static void put_octal(guchar *field, gsize width, guint64 value) {
+    g_snprintf((gchar *)field, width, "%0*" G_GINT64_MODIFIER "o", (int)width - 1, value);
+}
+
+/**
+ * @brief Adds a "key=value" record to a pax extended header. Each record starts with its own
+ * length in decimal, and that length includes its own digits.
+ */
+static void pax_record(GString *pax, const gchar *key, const gchar *value) {
+    gsize body = strlen(key) + strlen(value) + 3;   // The space, the "=" and the newline.
+    gsize len = body + 1;
+    gchar digits[24];
+    while (body + g_snprintf(digits, sizeof(digits), "%" G_GSIZE_FORMAT, len) != len)
+        len = body + strlen(digits);
+    g_string_append_printf(pax, "%" G_GSIZE_FORMAT " %s=%s\n", len, key, value);
+}
+
+static gboolean put_header_block(TarWriter *tw, const gchar *name, gchar type, guint32 mode, guint64 size, const struct stat *st) {
+    guchar h[TAR_BLOCK];
+    memset(h, 0, sizeof(h));
+    memcpy(h, name, MIN(strlen(name), 100));
+    put_octal(h + 100, 8, mode & 07777);
+    // Owners that don't fit the field's 7 octal digits are left out.
+    put_octal(h + 108, 8, st->st_uid <= 07777777 ? st->st_uid : 0);
+    put_octal(h + 116, 8, st->st_gid <= 07777777 ? st->st_gid : 0);
+    put_octal(h + 124, 12, size);
+    put_octal(h + 136, 12, st->st_mtime > 0 && (guint64)st->st_mtime <= TAR_MAX_OCTAL_SIZE ? st->st_mtime : 0);
+    h[156] = type;
+    memcpy(h + 257, "ustar", 6);
+    memcpy(h + 263, "00", 2);
+    // The checksum is the sum of all header bytes, counting its own field as spaces.
+    memset(h + 148, ' ', 8);
+    guint sum = 0;
+    for (gsize i = 0; i < TAR_BLOCK; i++) sum += h[i];
+    put_octal(h + 148, 7, sum);
+    return put(tw, h, TAR_BLOCK);
+}
+
+/**
+ * @brief Writes the header(s) for one item: a pax header first if its name or size doesn't
+ * fit the classic fields, then the ustar header itself.
+ */
+static gboolean put_header(TarWriter *tw, const gchar *name, gchar type, const struct stat *st, guint64 size) {
+    GString *pax = g_string_new(NULL);
+    if (strlen(name) > 100) pax_record(pax, "path", name);
+    if (size > TAR_MAX_OCTAL_SIZE) {
+        gchar *value = g_strdup_printf("%" G_GUINT64_FORMAT, size);
+        pax_record(pax, "size", value);
+        g_free(value);
+    }
+    gboolean ok = TRUE;
+    if (pax->len > 0) {
+        ok = put_header_block(tw, "PaxHeader", 'x', 0644, pax->len, st)
+             && put(tw, pax->str, pax->len) && put(tw, NULL, padding(pax->len));
+    }
+    g_string_free(pax, TRUE);
+    return ok && put_header_block(tw, name, type, st->st_mode, size > TAR_MAX_OCTAL_SIZE ? 0 : size, st);
+}
+
+/**
+ * @brief Adds the file `name` in `dir_fd` to the archive. File data is read straight into the
+ * writer's buffer.
+ * @return FALSE if the file could not be read; tw->failed is set if the archive could not be written.
+ */
+static gboolean put_file(TarWriter *tw, int dir_fd, const gchar *name, const gchar *tar_name, const struct stat *st) {
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    // A file we can't open is left out of the archive.
+    if (fd == -1) return FALSE;
+    gboolean read_ok = TRUE;
+    guint64 left = st->st_size;
+    if (put_header(tw, tar_name, '0', st, st->st_size)) {
+        while (left > 0 && !op_progress_is_cancelled(tw->progress)) {
+            if (tw->in_len == BUFFER_SIZE && !flush_input(tw, FALSE)) break;
+            gsize want = MIN(left, BUFFER_SIZE - tw->in_len);
+            gssize n = read_ok ? read(fd, tw->in + tw->in_len, want) : 0;
+            if (n < 0 && errno == EINTR) continue;
+            if (n > 0) {
+                tw->stats.bytes_in += n;
+            } else {
+                // The file shrank or stopped being readable. The header has promised its size,
+                // so the rest is filled with zeros to keep the archive readable.
+                read_ok = FALSE;
+                memset(tw->in + tw->in_len, 0, want);
+                n = want;
+            }
+            tw->in_len += n;
+            left -= n;
+            op_progress_add(tw->progress, n, 0);
+        }
+        put(tw, NULL, padding(st->st_size));
+    }
+    close(fd);
+    return read_ok && !tw->failed;
+}
+
+/**
+ * @brief The tree-walk callback that adds each visited item to the archive. As for a zip,
+ * symlinks to files are followed and anything else that isn't a file or folder is left out.
+ */
+static TreeWalkResult tar_cb(TreeWalkEntry *e, gpointer user_data) {
+    TarWriter *tw = user_data;
+    if (e->event == TREE_WALK_DIR_POST) return TREE_WALK_CONTINUE;
+    if (op_progress_is_cancelled(tw->progress)) return TREE_WALK_STOP;
+
+    struct stat st = e->st;
+    // A link that leads nowhere is left out too, rather than failing the whole archive.
+    if (S_ISLNK(st.st_mode) && fstatat(e->parent_fd, e->name, &st, 0) != 0) return TREE_WALK_CONTINUE;
+    if (e->event == TREE_WALK_FILE && !S_ISREG(st.st_mode)) return TREE_WALK_CONTINUE;
+
+    gchar *tar_name = tree_walk_entry_relpath(e);
+    gboolean ok;
+    if (e->event == TREE_WALK_DIR_PRE) {
+        // Folder names end with "/" in a tar archive.
+        gchar *dir_name = g_strconcat(tar_name, "/", NULL);
+        ok = put_header(tw, dir_name, '5', &st, 0);
+        g_free(dir_name);
+    } else {
+        ok = put_file(tw, e->parent_fd, e->name, tar_name, &st);
+    }
+    g_free(tar_name);
+    op_progress_add(tw->progress, 0, 1);
+    if (tw->failed) return TREE_WALK_STOP;
+    return ok ? TREE_WALK_CONTINUE : TREE_WALK_FAILED;
+}
+
+/**
+ * @brief Sets up the compressor that `options` asks for.
+ */
+static gboolean start_compressor(TarWriter *tw, const ZipOptions *options) {
+    int level = CLAMP(options->level, 0, 9);
+    int threads = options->threads > 0 ? options->threads : (int)g_get_num_processors();
+    if (options->level == ZIP_LEVEL_STORE) {
+        tw->codec = CODEC_NONE;
+        return TRUE;
+    }
+    if (options->format == ARCHIVE_TAR_XZ) {
+        tw->codec = CODEC_XZ;
+        lzma_mt mt;
+        memset(&mt, 0, sizeof(mt));
+        mt.threads = threads;
+        mt.preset = level ? (guint32)level : LZMA_PRESET_DEFAULT;
+        mt.check = LZMA_CHECK_CRC64;
+        return lzma_stream_encoder_mt(&tw->xz, &mt) == LZMA_OK;
+    }
+    tw->codec = CODEC_ZSTD;
+    tw->zstd = ZSTD_createCCtx();
+    if (!tw->zstd) return FALSE;
+    ZSTD_CCtx_setParameter(tw->zstd, ZSTD_c_compressionLevel, zstd_levels[level]);
+    ZSTD_CCtx_setParameter(tw->zstd, ZSTD_c_checksumFlag, 1);
+    // If libzstd was built without thread support this fails, and zstd compresses on our thread.
+    ZSTD_CCtx_setParameter(tw->zstd, ZSTD_c_nbWorkers, threads);
+    if (options->long_distance) {
+        ZSTD_CCtx_setParameter(tw->zstd, ZSTD_c_enableLongDistanceMatching, 1);
+        ZSTD_CCtx_setParameter(tw->zstd, ZSTD_c_windowLog, ZSTD_LONG_WINDOW_LOG);
+    }
+    return TRUE;
+}
+
+gboolean tar_create(const gchar *src_path, const gchar *dest_path, const ZipOptions *options, ZipStats *stats, OpProgress *progress) {
+    ZipOptions defaults = { .format = ARCHIVE_TAR_ZSTD };
+    if (!options) options = &defaults;
+    // Like a zip, the archive is written under a temporary name and only renamed into place
+    // once it is complete.
+    gchar *tmp_path = g_strconcat(dest_path, ".XXXXXX", NULL);
+    int fd = g_mkstemp_full(tmp_path, O_WRONLY | O_CLOEXEC, 0644);
+    if (fd == -1) { g_free(tmp_path); return FALSE; }
+
+    TarWriter tw;
+    memset(&tw, 0, sizeof(tw));
+    lzma_stream xz_init = LZMA_STREAM_INIT;
+    tw.xz = xz_init;
+    tw.fd = fd;
+    tw.progress = progress;
+    tw.in = g_malloc(BUFFER_SIZE);
+    tw.out = g_malloc(BUFFER_SIZE);
+
+    gboolean ok = start_compressor(&tw, options);
+    gboolean walked = ok && tree_walk(src_path, tar_cb, &tw);
+    // Two blocks of zeros mark the end of a tar archive.
+    ok = ok && !op_progress_is_cancelled(progress) && put(&tw, NULL, 2 * TAR_BLOCK) && flush_input(&tw, TRUE);
+    if (stats) *stats = tw.stats;
+    ok = (close(fd) == 0) && ok;
+    if (ok) ok = (rename(tmp_path, dest_path) == 0);
+    if (!ok) unlink(tmp_path);
+
+    ZSTD_freeCCtx(tw.zstd);
+    lzma_end(&tw.xz);
+    g_free(tw.in);
+    g_free(tw.out);
+    g_free(tmp_path);
+    return ok && walked;
+}
+
+// --- Reading ---
+
+static gboolean fill_input(TarReader *r) {
+    for (;;) {
+        gssize n = read(r->fd, r->in, BUFFER_SIZE);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return FALSE;
+        r->in_len = n;
+        r->in_pos = 0;
+        r->in_eof = (n == 0);
+        op_progress_add(r->progress, n, 0);
+        return TRUE;
+    }
+}
+
+/**
+ * @brief Reads up to `len` bytes of tar data.
+ * @return How many bytes it read, 0 at the end of the stream, or -1 if the archive is damaged.
+ */
+static gssize read_some(TarReader *r, guchar *dst, gsize len) {
+    for (;;) {
+        if (r->in_pos == r->in_len && !r->in_eof && !fill_input(r)) return -1;
+        gboolean input_done = (r->in_pos == r->in_len);
+        if (r->codec == CODEC_NONE) {
+            if (input_done) return 0;
+            gsize n = MIN(len, r->in_len - r->in_pos);
+            memcpy(dst, r->in + r->in_pos, n);
+            r->in_pos += n;
+            return n;
+        }
+        if (r->codec == CODEC_ZSTD) {
+            // The stream may hold several frames; it may only end between two of them.
+            if (input_done) return r->zstd_left == 0 ? 0 : -1;
+            ZSTD_inBuffer in = { r->in, r->in_len, r->in_pos };
+            ZSTD_outBuffer out = { dst, len, 0 };
+            gsize ret = ZSTD_decompressStream(r->zstd, &out, &in);
+            if (ZSTD_isError(ret)) return -1;
+            r->in_pos = in.pos;
+            r->zstd_left = ret;
+            if (out.pos > 0) return out.pos;
+            continue;
+        }
+        if (r->xz_ended) return 0;
+        r->xz.next_in = r->in + r->in_pos;
+        r->xz.avail_in = r->in_len - r->in_pos;
+        r->xz.next_out = dst;
+        r->xz.avail_out = len;
+        lzma_ret ret = lzma_code(&r->xz, r->in_eof ? LZMA_FINISH : LZMA_RUN);
+        r->in_pos = r->in_len - r->xz.avail_in;
+        gsize produced = len - r->xz.avail_out;
+        if (ret == LZMA_STREAM_END) r->xz_ended = TRUE;
+        else if (ret != LZMA_OK) return -1;
+        if (produced > 0 || r->xz_ended) return produced;
+    }
+}
+
+static gboolean read_full(TarReader *r, guchar *dst, gsize len) {
+    while (len > 0) {
+        gssize n = read_some(r, dst, len);
+        if (n <= 0) return FALSE;
+        dst += n;
+        len -= n;
+    }
+    return TRUE;
+}
+
+static gboolean skip_data(TarReader *r, guint64 len) {
+    while (len > 0) {
+        gsize n = MIN(len, BUFFER_SIZE);
+        if (!read_full(r, r->data, n)) return FALSE;
+        len -= n;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief Reads a number from a header field: octal digits (padded with spaces or NULs), or
+ * GNU tar's big-endian binary form, flagged by the top bit, for values too big for octal.
+ */
+static guint64 parse_number(const guchar *field, gsize width) {
+    guint64 value = 0;
+    if (field[0] & 0x80) {
+        value = field[0] & 0x7F;
+        for (gsize i = 1; i < width; i++) value = (value << 8) | field[i];
+        return value;
+    }
+    for (gsize i = 0; i < width; i++) {
+        if (field[i] == ' ' && value == 0) continue;
+        if (field[i] < '0' || field[i] > '7') break;
+        value = value * 8 + (field[i] - '0');
+    }
+    return value;
+}
+
+static gboolean header_is_valid(const guchar *h) {
+    guint sum = 0;
+    for (gsize i = 0; i < TAR_BLOCK; i++) sum += (i >= 148 && i < 156) ? ' ' : h[i];
+    return sum == parse_number(h + 148, 8);
+}
+
+static gboolean is_zero_block(const guchar *h) {
+    for (gsize i = 0; i < TAR_BLOCK; i++) if (h[i]) return FALSE;
+    return TRUE;
+}
+
+/**
+ * @brief Picks the path and size out of a pax extended header; other records are ignored.
+ */
+static void parse_pax(const gchar *data, gsize len, gchar **path, gint64 *size) {
+    const gchar *p = data, *end = data + len;
+    while (p < end) {
+        gchar *rest;
+        guint64 record_len = g_ascii_strtoull(p, &rest, 10);
+        if (record_len == 0 || record_len > (guint64)(end - p) || *rest != ' ' || p[record_len - 1] != '\n') return;
+        const gchar *key = rest + 1, *record_end = p + record_len - 1;
+        const gchar *eq = memchr(key, '=', record_end - key);
+        if (eq) {
+            if (eq - key == 4 && memcmp(key, "path", 4) == 0) {
+                g_free(*path);
+                *path = g_strndup(eq + 1, record_end - eq - 1);
+            } else if (eq - key == 4 && memcmp(key, "size", 4) == 0) {
+                *size = g_ascii_strtoll(eq + 1, NULL, 10);
+            }
+        }
+        p += record_len;
+    }
+}
+
+/**
+ * @brief Extracts the data of a file entry to the new file `path`.
+ * @param file_ok Set to FALSE if the file could not be created or written; the data is still
+ * read, so the next header can be found.
+ * @return FALSE if the archive itself could not be read.
+ */
+static gboolean extract_tar_file(TarReader *r, ExtractDir *dest, const gchar *path, guint32 mode, guint64 size, gint64 mtime, gboolean *file_ok) {
+    const gchar *base;
+    gchar *parent = extract_dir_split(path, &base);
+    int dir_fd = extract_dir_make(dest, parent, 0) ? extract_dir_open(dest, parent) : -1;
+    // O_EXCL: an existing file is never replaced. O_NOFOLLOW: nor written through a symlink.
+    int fd = dir_fd == -1 ? -1 : openat(dir_fd, base, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, (mode & 0777) ? mode & 0777 : 0666);
+    *file_ok = (fd != -1);
+    if (*file_ok) extract_dir_created(dest, path);
+
+    gboolean stream_ok = TRUE;
+    for (guint64 left = size; stream_ok && left > 0;) {
+        gsize n = MIN(left, BUFFER_SIZE);
+        stream_ok = read_full(r, r->data, n) && !op_progress_is_cancelled(r->progress);
+        if (stream_ok && *file_ok) *file_ok = write_full(fd, r->data, n);
+        left -= n;
+    }
+    if (fd != -1) {
+        if (stream_ok && *file_ok) {
+            struct timespec times[2] = { { 0, UTIME_NOW }, { mtime, 0 } };
+            futimens(fd, times);
+        }
+        *file_ok = (close(fd) == 0) && *file_ok && stream_ok;
+        // Never leave a half-written file behind.
+        if (!*file_ok) unlinkat(dir_fd, base, 0);
+    }
+    if (dir_fd != -1) close(dir_fd);
+    g_free(parent);
+    return stream_ok && skip_data(r, padding(size));
+}
+
+/**
+ * @brief Recognises the compression from the first bytes of the file and sets up the decompressor.
+ */
+static gboolean start_decompressor(TarReader *r) {
+    guchar magic[sizeof(xz_magic)];
+    gssize n = pread(r->fd, magic, sizeof(magic), 0);
+    if (n >= (gssize)sizeof(zstd_magic) && memcmp(magic, zstd_magic, sizeof(zstd_magic)) == 0) {
+        r->codec = CODEC_ZSTD;
+        r->zstd = ZSTD_createDCtx();
+        if (!r->zstd) return FALSE;
+        ZSTD_DCtx_setParameter(r->zstd, ZSTD_d_windowLogMax, ZSTD_LONG_WINDOW_LOG);
+        return TRUE;
+    }
+    if (n == (gssize)sizeof(xz_magic) && memcmp(magic, xz_magic, sizeof(xz_magic)) == 0) {
+        r->codec = CODEC_XZ;
+        // LZMA_CONCATENATED: read on through several xz streams, as `xz -d` does.
+        return lzma_stream_decoder(&r->xz, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK;
+    }
+    r->codec = CODEC_NONE;
+    return TRUE;
+}
+
+gboolean tar_extract(const gchar *tar_path, const gchar *dest_dir, OpProgress *progress) {
+    TarReader r;
+    memset(&r, 0, sizeof(r));
+    lzma_stream xz_init = LZMA_STREAM_INIT;
+    r.xz = xz_init;
+    r.zstd_left = 1;
+    r.progress = progress;
+    r.fd = open(tar_path, O_RDONLY | O_CLOEXEC);
+    ExtractDir *dest = extract_dir_new(dest_dir);
+    gboolean ok = r.fd != -1 && dest && start_decompressor(&r);
+    gboolean all_files_ok = TRUE;
+    r.in = g_malloc(BUFFER_SIZE);
+    r.data = g_malloc(BUFFER_SIZE);
+
+    // Names and sizes from pax or GNU headers, for the entry that follows them.
+    gchar *long_name = NULL;
+    gint64 pax_size = -1;
+    guchar h[TAR_BLOCK];
+    while (ok && !op_progress_is_cancelled(progress)) {
+        if (!read_full(&r, h, TAR_BLOCK)) { ok = FALSE; break; }
+        // A block of zeros ends the archive (a second one follows, but isn't needed).
+        if (is_zero_block(h)) break;
+        if (!header_is_valid(h)) { ok = FALSE; break; }
+        gchar type = h[156];
+        guint64 size = parse_number(h + 124, 12);
+
+        if (type == 'x' || type == 'g' || type == 'L' || type == 'K') {
+            // Metadata for the next entry: 'x' pax and 'L' GNU long names are used; 'g' global
+            // pax settings and 'K' long link targets are not needed.
+            if (size > MAX_META_SIZE) { ok = FALSE; break; }
+            gchar *meta = g_malloc(size + 1);
+            ok = read_full(&r, (guchar *)meta, size) && skip_data(&r, padding(size));
+            meta[size] = '\0';
+            if (ok && type == 'x') parse_pax(meta, size, &long_name, &pax_size);
+            if (ok && type == 'L') {
+                g_free(long_name);
+                long_name = g_strdup(meta);
+            }
+            g_free(meta);
+            continue;
+        }
+
+        if (pax_size >= 0) size = pax_size;
+        gchar *name = long_name;
+        if (!name) {
+            // ustar archives may put the start of a long name in a separate prefix field.
+            gsize name_len = strnlen((const gchar *)h, 100);
+            if (memcmp(h + 257, "ustar", 5) == 0 && h[345] != '\0')
+                name = g_strdup_printf("%.*s/%.*s", (int)strnlen((const gchar *)h + 345, 155), h + 345, (int)name_len, h);
+            else
+                name = g_strndup((const gchar *)h, name_len);
+        }
+        long_name = NULL;
+        pax_size = -1;
+        gsize name_len = strlen(name);
+        // Very old tar versions mark folders only with a trailing "/".
+        gboolean is_dir = type == '5' || ((type == '0' || type == '\0') && name_len > 0 && name[name_len - 1] == '/');
+        gchar *path = archive_entry_path(name, name_len);
+        g_free(name);
+        // An unsafe name fails the whole extraction, just like in a zip.
+        if (!path) { ok = FALSE; break; }
+
+        guint32 mode = parse_number(h + 100, 8);
+        if (is_dir) {
+            if (!extract_dir_make(dest, path, mode)) all_files_ok = FALSE;
+            ok = skip_data(&r, size + padding(size));
+        } else if (type == '0' || type == '\0' || type == '7') {
+            gboolean file_ok;
+            ok = extract_tar_file(&r, dest, path, mode, size, parse_number(h + 136, 12), &file_ok);
+            if (!file_ok) all_files_ok = FALSE;
+        } else {
+            // Links, devices and pipes are not recreated: a link could point anywhere, and
+            // later entries be written through it.
+            ok = skip_data(&r, size + padding(size));
+        }
+        g_free(path);
+    }
+    g_free(long_name);
+
+    if (dest && op_progress_is_cancelled(progress)) {
+        extract_dir_remove_created(dest);
+        ok = FALSE;
+    }
+    extract_dir_free(dest);
+    if (r.fd != -1) close(r.fd);
+    ZSTD_freeDCtx(r.zstd);
+    lzma_end(&r.xz);
+    g_free(r.in);
+    g_free(r.data);
+    return ok && all_files_ok;
+}
+
+gboolean tar_is_archive_name(const gchar *path) {
+    static const gchar *suffixes[] = { ".tar", ".tar.zst", ".tzst", ".tar.xz", ".txz" };
+    gchar *lower = g_ascii_strdown(path, -1);
+    gboolean match = FALSE;
+    for (gsize i = 0; i < G_N_ELEMENTS(suffixes) && !match; i++) match = g_str_has_suffix(lower, suffixes[i]);
+    g_free(lower);
+    return match;
+}
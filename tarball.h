@@ -0,0 +1,39 @@
+/**
+ * @file tarball.h
+ * @brief Writing and extracting .tar.zst and .tar.xz archives.
+ *
+ * A tar archive is one long stream: each item is a 512-byte header followed by its data. The
+ * whole stream is then compressed in one go, so, unlike a zip, similar files compress against
+ * each other. zstd and xz both split the stream into pieces that worker threads compress at
+ * the same time, so every CPU core helps. zstd's "long-distance matching" additionally finds
+ * repeats up to 128 MiB apart, such as a second copy of the same file deep in another folder.
+ *
+ * Headers use the POSIX "ustar" layout, with "pax" extended headers for names longer than 100
+ * bytes and files over 8 GiB, so any modern tar can read the archives. When extracting, the
+ * compression is recognised from the first bytes of the file, entry names are checked the
+ * same way as a zip's, and only files and folders are created: links and devices are skipped.
+ */
+
+#ifndef TARBALL_H
+#define TARBALL_H
+
+#include <glib.h>
+#include "backend.h"
+
+// Writes `src_path` (a file, or a folder and everything in it) as a compressed tar archive at
+// `dest_path`, in options->format (ARCHIVE_TAR_ZSTD or ARCHIVE_TAR_XZ). Like a zip, it is
+// written under a temporary name and only appears once complete. Fills in the byte counts of
+// `stats` (if not NULL).
+gboolean tar_create(const gchar *src_path, const gchar *dest_path, const ZipOptions *options, ZipStats *stats, OpProgress *progress);
+
+// Extracts a .tar, .tar.zst or .tar.xz archive into the folder `dest_dir`. Progress is counted
+// in bytes of the archive read. Existing files are never replaced. Returns FALSE if the archive
+// is damaged or unsafe, or if any entry could not be extracted. Once `progress` is cancelled
+// the extraction stops and removes everything it had created.
+gboolean tar_extract(const gchar *tar_path, const gchar *dest_dir, OpProgress *progress);
+
+// TRUE if the file name looks like an archive tar_extract() can read (".tar", ".tar.zst",
+// ".tzst", ".tar.xz" or ".txz", in any case).
+gboolean tar_is_archive_name(const gchar *path);
+
+#endif // TARBALL_H
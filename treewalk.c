@@ -0,0 +1,313 @@
+/**
+ * @file treewalk.c
+ * @brief Implementation of the descriptor-based directory tree walker.
+ *
+ * The walk is iterative rather than recursive: an explicit stack holds one "frame" per
+ * directory we are currently inside. Each frame owns the open DIR stream for that directory,
+ * and the frame's fd is what every child item is opened, stat'ed or unlinked relative to.
+ *
+ * Parking always takes the outermost open frame, and only the frame directly above the
+ * innermost one is ever reopened, so the open frames are always the top of the stack:
+ * frames[first_open .. len-1].
+ */
+
+#include "treewalk.h"
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+// One directory on the walk's stack.
+typedef struct {
+    DIR *dir;           // The open directory stream we are reading children from (NULL once parked).
+    int fd;             // The handle children are looked up relative to (-1 while parked).
+    GPtrArray *unread;  // Once parked: the names that were not read yet, taken from the front.
+    guint next_unread;
+    int mirror_fd;      // The callback's mirror of this directory (see TreeWalkEntry), or -1.
+    gboolean has_mirror;
+    struct stat mirror_st; // The mirror's identity, to check it when it is reopened.
+    gchar *name;        // The directory's own name, relative to its parent.
+    struct stat st;     // The directory's metadata, handed back in DIR_POST.
+    gpointer data;      // The callback's per-directory state from DIR_PRE.
+} TreeWalkFrame;
+
+struct TreeWalk {
+    const gchar *root_dir; // The folder containing the root item (NULL for tree_walk_at). Only used for display paths.
+    int root_parent_fd;   // An open fd for the folder containing the root item.
+    GPtrArray *frames;    // The stack of TreeWalkFrame*; frames[i] is the directory at depth i.
+    guint first_open;     // frames below this index are parked.
+    int fd_budget;
+    int open_fds;         // Descriptors held by the frames right now.
+    int fd_high_water;
+    gboolean ok;          // Cleared as soon as anything goes wrong.
+    gboolean stopped;     // Set when a callback asks us to abort.
+};
+
+/**
+ * @brief Applies a callback's verdict to the walk's overall state.
+ */
+static void note_result(TreeWalk *walk, TreeWalkResult r) {
+    if (r == TREE_WALK_FAILED) walk->ok = FALSE;
+    if (r == TREE_WALK_STOP) { walk->ok = FALSE; walk->stopped = TRUE; }
+}
+
+static int frame_fds(const TreeWalkFrame *frame) {
+    return (frame->fd != -1) + (frame->mirror_fd != -1);
+}
+
+static void count_fds(TreeWalk *walk, int delta) {
+    walk->open_fds += delta;
+    walk->fd_high_water = MAX(walk->fd_high_water, walk->open_fds);
+}
+
+/**
+ * @brief Parks a frame: remembers the names it has not read yet and closes its descriptors.
+ */
+static void park_frame(TreeWalk *walk, TreeWalkFrame *frame) {
+    frame->unread = g_ptr_array_new_with_free_func(g_free);
+    struct dirent *de;
+    while ((de = readdir(frame->dir)) != NULL)
+        if (strcmp(de->d_name, ".") != 0 && strcmp(de->d_name, "..") != 0)
+            g_ptr_array_add(frame->unread, g_strdup(de->d_name));
+    count_fds(walk, -frame_fds(frame));
+    // closedir() closes frame->fd too.
+    closedir(frame->dir);
+    frame->dir = NULL;
+    frame->fd = -1;
+    if (frame->mirror_fd != -1) close(frame->mirror_fd);
+    frame->mirror_fd = -1;
+}
+
+/**
+ * @brief Opens the parent of `child_fd` and checks that it is the directory we expect.
+ * @return The new fd, or -1 if it can't be opened or is a different directory.
+ */
+static int reopen_parent(int child_fd, const struct stat *expected) {
+    if (child_fd == -1) return -1;
+    int fd = openat(child_fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct stat st;
+    if (fd != -1 && (fstat(fd, &st) != 0 || st.st_dev != expected->st_dev || st.st_ino != expected->st_ino)) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Reopens a parked frame through ".." of its (open) child frame.
+ */
+static void unpark_frame(TreeWalk *walk, TreeWalkFrame *frame, const TreeWalkFrame *child) {
+    frame->fd = reopen_parent(child->fd, &frame->st);
+    if (frame->has_mirror) frame->mirror_fd = reopen_parent(child->mirror_fd, &frame->mirror_st);
+    count_fds(walk, frame_fds(frame));
+    // The directory was moved (or removed) while we were inside it: we no longer know
+    // where its remaining children are, so give up rather than guess.
+    if (frame->fd == -1 || (frame->has_mirror && frame->mirror_fd == -1)) {
+        walk->ok = FALSE;
+        walk->stopped = TRUE;
+    }
+}
+
+/**
+ * @brief Parks the outermost open frames until the walk is within its budget again.
+ * The innermost frame is never parked: its children are being read.
+ */
+static void enforce_budget(TreeWalk *walk) {
+    while (walk->open_fds > walk->fd_budget && walk->first_open + 1 < walk->frames->len)
+        park_frame(walk, g_ptr_array_index(walk->frames, walk->first_open++));
+}
+
+/**
+ * @brief Returns the next child name of a frame, or NULL when there are no more.
+ */
+static const gchar* next_name(TreeWalkFrame *frame) {
+    if (frame->unread)
+        return frame->next_unread < frame->unread->len ? g_ptr_array_index(frame->unread, frame->next_unread++) : NULL;
+    struct dirent *de;
+    while (frame->dir && (de = readdir(frame->dir)) != NULL)
+        if (strcmp(de->d_name, ".") != 0 && strcmp(de->d_name, "..") != 0) return de->d_name;
+    return NULL;
+}
+
+/**
+ * @brief Visits one item: a FILE callback for non-directories, or DIR_PRE (and, if the
+ * callback agrees, a push onto the stack) for directories.
+ */
+static void visit(TreeWalk *walk, TreeWalkEntry *e, TreeWalkFunc func, gpointer user_data) {
+    if (!S_ISDIR(e->st.st_mode)) {
+        e->event = TREE_WALK_FILE;
+        e->dir_fd = -1;
+        note_result(walk, func(e, user_data));
+        return;
+    }
+
+    // O_NOFOLLOW guards against the directory being swapped for a symlink after fstatat().
+    int fd = openat(e->parent_fd, e->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) { walk->ok = FALSE; return; }
+
+    e->event = TREE_WALK_DIR_PRE;
+    e->dir_fd = fd;
+    e->dir_data = NULL;
+    e->mirror_fd = -1;
+    TreeWalkResult r = func(e, user_data);
+    note_result(walk, r);
+    if (r != TREE_WALK_CONTINUE) {
+        close(fd);
+        if (e->mirror_fd != -1) close(e->mirror_fd);
+        return;
+    }
+
+    // fdopendir() takes ownership of fd; closedir() will close it for us later.
+    // (A directory we can't read still gets its DIR_POST, since its DIR_PRE went through.)
+    DIR *dir = fdopendir(fd);
+    if (!dir) { close(fd); fd = -1; walk->ok = FALSE; }
+
+    TreeWalkFrame *frame = g_new0(TreeWalkFrame, 1);
+    frame->dir = dir;
+    frame->fd = fd;
+    frame->mirror_fd = e->mirror_fd;
+    frame->has_mirror = (e->mirror_fd != -1 && fstat(e->mirror_fd, &frame->mirror_st) == 0);
+    frame->name = g_strdup(e->name);
+    frame->st = e->st;
+    frame->data = e->dir_data;
+    g_ptr_array_add(walk->frames, frame);
+    count_fds(walk, frame_fds(frame));
+    enforce_budget(walk);
+}
+
+/**
+ * @brief Pops the innermost directory off the stack and sends its DIR_POST.
+ */
+static void leave_directory(TreeWalk *walk, TreeWalkFunc func, gpointer user_data) {
+    TreeWalkFrame *frame = g_ptr_array_remove_index(walk->frames, walk->frames->len - 1);
+    TreeWalkFrame *parent = walk->frames->len > 0 ? g_ptr_array_index(walk->frames, walk->frames->len - 1) : NULL;
+    // DIR_POST needs the parent, which may have been parked while we were down here.
+    if (parent && walk->first_open > walk->frames->len - 1) {
+        walk->first_open = walk->frames->len - 1;
+        unpark_frame(walk, parent, frame);
+    }
+    TreeWalkEntry e = {0};
+    e.event = TREE_WALK_DIR_POST;
+    e.parent_fd = parent ? parent->fd : walk->root_parent_fd;
+    e.name = frame->name;
+    e.st = frame->st;
+    e.depth = walk->frames->len;
+    e.dir_fd = frame->fd;
+    e.parent_data = parent ? parent->data : NULL;
+    e.dir_data = frame->data;
+    e.walk = walk;
+    e.mirror_fd = frame->mirror_fd;
+    e.parent_mirror_fd = parent ? parent->mirror_fd : -1;
+    note_result(walk, func(&e, user_data));
+
+    count_fds(walk, -frame_fds(frame));
+    if (frame->dir) closedir(frame->dir);
+    else if (frame->fd != -1) close(frame->fd);
+    if (frame->mirror_fd != -1) close(frame->mirror_fd);
+    if (frame->unread) g_ptr_array_free(frame->unread, TRUE);
+    g_free(frame->name);
+    g_free(frame);
+}
+
+/**
+ * @brief The walk itself, shared by tree_walk() and tree_walk_at(). See treewalk.h for the contract.
+ */
+static gboolean walk_tree(const gchar *root_dir, int root_parent_fd, const gchar *root_name, TreeWalkLimits *limits, TreeWalkFunc func, gpointer user_data) {
+    TreeWalk walk = {0};
+    walk.ok = TRUE;
+    walk.root_dir = root_dir;
+    walk.root_parent_fd = root_parent_fd;
+    walk.frames = g_ptr_array_new();
+    walk.fd_budget = (limits && limits->fd_budget > 0) ? limits->fd_budget : TREE_WALK_DEFAULT_FD_BUDGET;
+
+    TreeWalkEntry root = {0};
+    root.parent_fd = walk.root_parent_fd;
+    root.name = root_name;
+    root.walk = &walk;
+    root.mirror_fd = -1;
+    root.parent_mirror_fd = -1;
+    if (fstatat(walk.root_parent_fd, root_name, &root.st, AT_SYMLINK_NOFOLLOW) == 0) {
+        visit(&walk, &root, func, user_data);
+    } else {
+        walk.ok = FALSE;
+    }
+
+    // The main loop: read the next child of the innermost open directory. When a directory
+    // runs out of children we send its DIR_POST and return to its parent.
+    while (walk.frames->len > 0 && !walk.stopped) {
+        TreeWalkFrame *top = g_ptr_array_index(walk.frames, walk.frames->len - 1);
+        const gchar *name = next_name(top);
+        if (!name) { leave_directory(&walk, func, user_data); continue; }
+
+        TreeWalkEntry e = {0};
+        e.parent_fd = top->fd;
+        e.name = name;
+        e.depth = walk.frames->len;
+        e.parent_data = top->data;
+        e.walk = &walk;
+        e.mirror_fd = -1;
+        e.parent_mirror_fd = top->mirror_fd;
+        // fstatat() only resolves one name inside an already-open directory.
+        if (fstatat(top->fd, name, &e.st, AT_SYMLINK_NOFOLLOW) != 0) { walk.ok = FALSE; continue; }
+        visit(&walk, &e, func, user_data);
+    }
+
+    // If the walk was stopped early, unwind whatever is still open. DIR_POST is still sent so
+    // callbacks can release the state they stored in dir_data.
+    while (walk.frames->len > 0) leave_directory(&walk, func, user_data);
+
+    g_ptr_array_free(walk.frames, TRUE);
+    if (limits) limits->fd_high_water = walk.fd_high_water;
+    return walk.ok;
+}
+
+/**
+ * @brief Walks a file or a whole directory tree, starting from a path.
+ */
+gboolean tree_walk(const gchar *root_path, TreeWalkFunc func, gpointer user_data) {
+    gchar *root_dir = g_path_get_dirname(root_path);
+    int parent_fd = open(root_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (parent_fd == -1) { g_free(root_dir); return FALSE; }
+    gchar *root_name = g_path_get_basename(root_path);
+    gboolean ok = walk_tree(root_dir, parent_fd, root_name, NULL, func, user_data);
+    close(parent_fd);
+    g_free(root_dir);
+    g_free(root_name);
+    return ok;
+}
+
+/**
+ * @brief Walks a file or a whole directory tree, starting from a name inside an open directory.
+ */
+gboolean tree_walk_at(int parent_fd, const gchar *name, TreeWalkFunc func, gpointer user_data) {
+    return walk_tree(NULL, parent_fd, name, NULL, func, user_data);
+}
+
+/**
+ * @brief tree_walk_at() with an explicit descriptor budget.
+ */
+gboolean tree_walk_with_limits(int parent_fd, const gchar *name, TreeWalkLimits *limits, TreeWalkFunc func, gpointer user_data) {
+    return walk_tree(NULL, parent_fd, name, limits, func, user_data);
+}
+
+gchar* tree_walk_entry_relpath(const TreeWalkEntry *entry) {
+    GString *s = g_string_new(NULL);
+    // frames[0 .. depth-1] are exactly the ancestors of an item at this depth.
+    for (int i = 0; i < entry->depth; i++) {
+        TreeWalkFrame *frame = g_ptr_array_index(entry->walk->frames, i);
+        g_string_append(s, frame->name);
+        g_string_append_c(s, G_DIR_SEPARATOR);
+    }
+    g_string_append(s, entry->name);
+    return g_string_free(s, FALSE);
+}
+
+gchar* tree_walk_entry_path(const TreeWalkEntry *entry) {
+    gchar *rel = tree_walk_entry_relpath(entry);
+    if (!entry->walk->root_dir) return rel;
+    gchar *path = g_build_filename(entry->walk->root_dir, rel, NULL);
+    g_free(rel);
+    return path;
+}
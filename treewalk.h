@@ -0,0 +1,98 @@
+/**
+ * @file treewalk.h
+ * @brief A directory tree walker that works with directory file descriptors.
+ *
+ * Copy, delete and zip all need to visit every item below a folder. Instead of building
+ * an absolute path string for every item (and making the kernel re-resolve that whole path
+ * on every system call), the walker keeps the parent directory open and hands callbacks a
+ * (directory fd, name) pair. Callbacks then use the "*at" family of system calls
+ * (openat, mkdirat, fstatat, unlinkat), which only look up a single path component.
+ * Full path strings are built on request, only when they have to be shown to the user.
+ *
+ * Keeping every directory on the way down open would use one file descriptor per level, and
+ * a very deep tree would run the process out of them (EMFILE). So each walk has a descriptor
+ * budget: once it is exceeded, the outermost open directories are "parked". A parked
+ * directory's unread names are kept in memory and its descriptor is closed; when the walk
+ * climbs back up, it is reopened through ".." of its child and checked to still be the same
+ * directory (device and inode), so a folder moved away in the meantime can't mislead us.
+ * If that check fails the walk stops, and the remaining DIR_POSTs get -1 for any descriptor
+ * that could not be reopened.
+ */
+
+#ifndef TREEWALK_H
+#define TREEWALK_H
+
+#include <glib.h>
+#include <sys/stat.h>
+
+// Descriptors a walk keeps open at most, unless the caller asks for a different budget.
+#define TREE_WALK_DEFAULT_FD_BUDGET 32
+
+// The three kinds of visits a callback can receive.
+typedef enum {
+    TREE_WALK_FILE,      // Anything that is not a directory (regular file, symlink, device, ...).
+    TREE_WALK_DIR_PRE,   // A directory, visited before any of its children.
+    TREE_WALK_DIR_POST   // The same directory again, visited after all of its children.
+} TreeWalkEvent;
+
+// What a callback returns to steer the walk.
+typedef enum {
+    TREE_WALK_CONTINUE,  // Carry on normally.
+    TREE_WALK_SKIP,      // (DIR_PRE only) Do not descend into this directory and do not send DIR_POST.
+    TREE_WALK_FAILED,    // Remember that something went wrong, but keep walking (DIR_PRE also skips).
+    TREE_WALK_STOP       // Abort the whole walk immediately.
+} TreeWalkResult;
+
+typedef struct TreeWalk TreeWalk;
+
+// Everything a callback gets to know about the item being visited.
+typedef struct {
+    TreeWalkEvent event;
+    int parent_fd;         // An open fd for the directory that contains this item.
+    const gchar *name;     // The item's name, relative to parent_fd.
+    struct stat st;        // Metadata from fstatat(parent_fd, name, AT_SYMLINK_NOFOLLOW).
+    int depth;             // 0 for the item the walk was started on, 1 for its children, and so on.
+    int dir_fd;            // DIR_PRE/DIR_POST only: an open fd for this directory itself.
+    gpointer parent_data;  // Whatever the parent directory's DIR_PRE stored in dir_data (NULL at depth 0).
+    gpointer dir_data;     // DIR_PRE may store per-directory state here; DIR_POST receives it back.
+    TreeWalk *walk;        // The walk this entry belongs to (needed to build path strings).
+    // Callbacks that build a matching tree elsewhere (copy) need the matching directory open
+    // as well. DIR_PRE may put an fd for it in mirror_fd; the walker then owns it, counts it in
+    // the budget, parks it along with the directory and closes it after DIR_POST.
+    int mirror_fd;         // DIR_PRE: -1, may be set. DIR_POST: the fd given in DIR_PRE, or -1.
+    int parent_mirror_fd;  // The parent's mirror fd, or -1 (always -1 at depth 0).
+} TreeWalkEntry;
+
+typedef TreeWalkResult (*TreeWalkFunc)(TreeWalkEntry *entry, gpointer user_data);
+
+// Walks root_path (a file or a directory) depth-first, calling func for every item.
+// Symlinks are reported as TREE_WALK_FILE and never followed. Every DIR_PRE that returned
+// TREE_WALK_CONTINUE gets its DIR_POST, even when the walk is stopped early.
+// Returns FALSE if any item could not be visited, a callback returned TREE_WALK_FAILED,
+// or the walk was stopped.
+gboolean tree_walk(const gchar *root_path, TreeWalkFunc func, gpointer user_data);
+
+// The same walk, for an item named relative to an already-open directory. Walks started
+// this way have no display path: tree_walk_entry_path() returns the relative path instead.
+gboolean tree_walk_at(int parent_fd, const gchar *name, TreeWalkFunc func, gpointer user_data);
+
+// Limits and statistics for tree_walk_with_limits().
+typedef struct {
+    int fd_budget;         // In: descriptors the walk may keep open (0 means the default).
+    int fd_high_water;     // Out: the most descriptors the walk actually had open at once.
+} TreeWalkLimits;
+
+// tree_walk_at() with an explicit descriptor budget; reports how many descriptors it used.
+// The directory being visited (and its mirror) always stays open, so the budget can be
+// exceeded by a few while a DIR_POST is sent.
+gboolean tree_walk_with_limits(int parent_fd, const gchar *name, TreeWalkLimits *limits, TreeWalkFunc func, gpointer user_data);
+
+// Builds the item's path relative to the folder containing the walk's root, e.g. "Photos/2024/a.jpg".
+// Must be freed with g_free().
+gchar* tree_walk_entry_relpath(const TreeWalkEntry *entry);
+
+// Builds the item's full path, e.g. "/home/user/Photos/2024/a.jpg". Must be freed with g_free().
+// For a walk started with tree_walk_at(), this is the same as tree_walk_entry_relpath().
+gchar* tree_walk_entry_path(const TreeWalkEntry *entry);
+
+#endif // TREEWALK_H
@@ -0,0 +1,189 @@
+/**
+ * @file uring.c
+ * @brief Implementation of the minimal io_uring queue.
+ *
+ * An io_uring consists of two ring buffers in memory shared with the kernel: the submission
+ * queue (SQ), where we put requests, and the completion queue (CQ), where the kernel puts
+ * results. Each side only ever moves its own index: we advance the SQ tail and the CQ head,
+ * the kernel advances the SQ head and the CQ tail. The indexes are read and written with
+ * acquire/release ordering so the entries behind them are seen completely.
+ */
+
+#include "uring.h"
+
+#ifdef HAVE_IO_URING
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+struct Uring {
+    int fd;
+    guint entries;
+    // The submission queue: the indexes and the array of slots that point into `sqes`.
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    // The completion queue.
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    // The shared memory, for unmapping. With IORING_FEAT_SINGLE_MMAP both rings share one map.
+    void *sq_ring, *cq_ring;
+    gsize sq_ring_size, cq_ring_size, sqes_size;
+    guint to_submit;        // Requests queued but not yet handed to the kernel.
+    guint in_flight;        // Requests handed to the kernel whose results we haven't seen.
+};
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/**
+ * @brief Asks the kernel whether it knows the unlinkat operation (added in Linux 5.11).
+ */
+static gboolean supports_unlinkat(int fd) {
+    gsize size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = g_malloc0(size);
+    gboolean ok = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0
+                  && probe->last_op >= IORING_OP_UNLINKAT
+                  && (probe->ops[IORING_OP_UNLINKAT].flags & IO_URING_OP_SUPPORTED);
+    g_free(probe);
+    return ok;
+}
+
+Uring* uring_new(guint entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = io_uring_setup(entries, &params);
+    if (fd < 0) return NULL;
+    if (!supports_unlinkat(fd)) { close(fd); return NULL; }
+
+    Uring *ring = g_new0(Uring, 1);
+    ring->fd = fd;
+    ring->entries = params.sq_entries;   // The kernel rounds up to a power of two.
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        ring->sq_ring_size = ring->cq_ring_size = MAX(ring->sq_ring_size, ring->cq_ring_size);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = (params.features & IORING_FEAT_SINGLE_MMAP) ? ring->sq_ring
+                    : mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        uring_free(ring);
+        return NULL;
+    }
+
+    guchar *sq = ring->sq_ring, *cq = ring->cq_ring;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return ring;
+}
+
+void uring_free(Uring *ring) {
+    if (!ring) return;
+    if (ring->sqes && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring && ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+    g_free(ring);
+}
+
+guint uring_space(Uring *ring) {
+    return ring->entries - ring->to_submit - ring->in_flight;
+}
+
+void uring_queue_unlinkat(Uring *ring, int dir_fd, const gchar *name, int flags, guint64 user_data) {
+    g_return_if_fail(uring_space(ring) > 0);
+    // Only we move the tail, so a plain read is enough; the kernel reads it with acquire.
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_UNLINKAT;
+    sqe->fd = dir_fd;
+    sqe->addr = (guint64)(guintptr)name;
+    sqe->unlink_flags = flags;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    // Publish the filled-in entry: the kernel must not see the new tail before the entry.
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+}
+
+/**
+ * @brief Hands every finished request's result to `func`.
+ */
+static void reap(Uring *ring, UringCompletionFunc func, gpointer data) {
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        func(cqe->user_data, cqe->res, data);
+        ring->in_flight--;
+    }
+    // Give the slots back to the kernel only after we are done reading them.
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Takes back requests the kernel has not picked up, reporting `error` for each.
+ */
+static void drop_unsubmitted(Uring *ring, int error, UringCompletionFunc func, gpointer data) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail;
+    for (unsigned i = head; i != tail; i++)
+        func(ring->sqes[i & *ring->sq_mask].user_data, -error, data);
+    __atomic_store_n(ring->sq_tail, head, __ATOMIC_RELEASE);
+    ring->to_submit = 0;
+}
+
+gboolean uring_run(Uring *ring, UringCompletionFunc func, gpointer data) {
+    gboolean ok = TRUE;
+    while (ring->to_submit > 0 || ring->in_flight > 0) {
+        // One call both submits the new requests and waits for at least one result.
+        int submitted = io_uring_enter(ring->fd, ring->to_submit, 1, IORING_ENTER_GETEVENTS);
+        if (submitted < 0) {
+            if (errno == EINTR) continue;
+            int error = errno;
+            // EAGAIN/EBUSY: the kernel is short of resources until we collect some results.
+            gboolean retry = (error == EAGAIN || error == EBUSY) && ring->in_flight > 0;
+            if (!retry) {
+                ok = FALSE;
+                drop_unsubmitted(ring, error, func, data);
+                if (ring->in_flight == 0) break;
+                // Still wait for what the kernel already has: it may be using our names.
+                if (io_uring_enter(ring->fd, 0, ring->in_flight, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) break;
+            }
+        } else {
+            ring->to_submit -= submitted;
+            ring->in_flight += submitted;
+        }
+        reap(ring, func, data);
+    }
+    return ok;
+}
+
+#else // !HAVE_IO_URING
+
+Uring* uring_new(guint entries) { return NULL; }
+void uring_free(Uring *ring) {}
+guint uring_space(Uring *ring) { return 0; }
+void uring_queue_unlinkat(Uring *ring, int dir_fd, const gchar *name, int flags, guint64 user_data) {}
+gboolean uring_run(Uring *ring, UringCompletionFunc func, gpointer data) { return FALSE; }
+
+#endif // HAVE_IO_URING
@@ -0,0 +1,49 @@
+/**
+ * @file uring.h
+ * @brief A minimal io_uring queue for submitting file system calls in batches (Linux only).
+ *
+ * Normally every unlink() is a separate trip into the kernel, and our thread waits while the
+ * file system does the work. With io_uring we write a whole batch of requests into a queue
+ * shared with the kernel, make one system call to submit them all, and collect the results
+ * from a second queue when they are done. The kernel works on the requests in parallel.
+ *
+ * This talks to the kernel directly (there's no liburing dependency) and only implements the
+ * few operations the file manager needs. On other systems, or on kernels that don't support
+ * an operation, uring_new() returns NULL and callers fall back to plain system calls.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <glib.h>
+
+// Defined when this system can have io_uring at all; it may still be unavailable at runtime.
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+typedef struct Uring Uring;
+
+// Called for each finished request with the user_data it was queued with and its result:
+// 0 (or more) on success, or a negative errno value.
+typedef void (*UringCompletionFunc)(guint64 user_data, int result, gpointer data);
+
+// Creates a queue with room for `entries` requests that supports unlinkat, or returns NULL
+// if io_uring is unavailable (old kernel, not Linux, or disabled by a sandbox).
+Uring* uring_new(guint entries);
+void uring_free(Uring *ring);
+
+// How many more requests can be queued before uring_run() has to be called.
+guint uring_space(Uring *ring);
+
+// Queues an unlinkat(dir_fd, name, flags). `name` must stay valid until uring_run() returns.
+void uring_queue_unlinkat(Uring *ring, int dir_fd, const gchar *name, int flags, guint64 user_data);
+
+// Submits every queued request and waits until all of them have finished, calling `func` for
+// each. Returns FALSE if the kernel refused the batch: requests it did not take are reported
+// to `func` with the error, and the queue should not be used again.
+gboolean uring_run(Uring *ring, UringCompletionFunc func, gpointer data);
+
+#endif // URING_H
@@ -0,0 +1,102 @@
+/**
+ * @file zipdeflate.c
+ * @brief The zlib and libdeflate backends and CRC-32 (see zipdeflate.h).
+ */
+
+#include "zipdeflate.h"
+#include <string.h>
+#include <zlib.h>
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+static gsize zlib_bound(gsize len) {
+    // The same bound deflateBound() gives for the default memory settings, plus room for
+    // the end-of-stream marker of an empty input.
+    return compressBound(len) + 16;
+}
+
+static gsize zlib_compress(const guchar *in, gsize len, guchar *out, gsize capacity, int level) {
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    // Negative window bits give a raw deflate stream: the zip format has its own headers.
+    if (deflateInit2(&z, level > 0 ? level : Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return 0;
+    z.next_in = (guchar *)in;
+    z.avail_in = len;
+    z.next_out = out;
+    z.avail_out = capacity;
+    int ret = deflate(&z, Z_FINISH);
+    gsize out_len = capacity - z.avail_out;
+    deflateEnd(&z);
+    return ret == Z_STREAM_END ? out_len : 0;
+}
+
+static const ZipDeflateBackend zlib_backend = { "zlib", zlib_bound, zlib_compress };
+
+const ZipDeflateBackend* zip_deflate_zlib(void) {
+    return &zlib_backend;
+}
+
+#ifdef HAVE_LIBDEFLATE
+// A libdeflate compressor can only be used by one thread at a time and is costly to set up,
+// so each worker thread keeps its own, for the level it used last.
+typedef struct {
+    int level;
+    struct libdeflate_compressor *compressor;
+} ThreadCompressor;
+
+static void thread_compressor_free(gpointer data) {
+    ThreadCompressor *tc = data;
+    libdeflate_free_compressor(tc->compressor);
+    g_free(tc);
+}
+
+static GPrivate thread_compressor = G_PRIVATE_INIT(thread_compressor_free);
+
+static gsize libdeflate_bound(gsize len) {
+    // libdeflate's bound doesn't depend on the compressor or its level.
+    return libdeflate_deflate_compress_bound(NULL, len);
+}
+
+static gsize libdeflate_compress(const guchar *in, gsize len, guchar *out, gsize capacity, int level) {
+    // zlib's default level is 6; libdeflate's levels mean about the same as zlib's.
+    if (level <= 0) level = 6;
+    ThreadCompressor *tc = g_private_get(&thread_compressor);
+    if (!tc || tc->level != level) {
+        struct libdeflate_compressor *compressor = libdeflate_alloc_compressor(level);
+        if (!compressor) return 0;
+        tc = g_new0(ThreadCompressor, 1);
+        tc->level = level;
+        tc->compressor = compressor;
+        // Frees the thread's previous compressor, if any.
+        g_private_replace(&thread_compressor, tc);
+    }
+    return libdeflate_deflate_compress(tc->compressor, in, len, out, capacity);
+}
+
+static const ZipDeflateBackend libdeflate_backend = { "libdeflate", libdeflate_bound, libdeflate_compress };
+#endif // HAVE_LIBDEFLATE
+
+const ZipDeflateBackend* zip_deflate_best(void) {
+#ifdef HAVE_LIBDEFLATE
+    return &libdeflate_backend;
+#else
+    return &zlib_backend;
+#endif
+}
+
+guint32 zip_crc32(guint32 crc, const guchar *buf, gsize len) {
+#ifdef HAVE_LIBDEFLATE
+    return libdeflate_crc32(crc, buf, len);
+#else
+    // zlib takes the length as an unsigned int, so huge buffers go in pieces.
+    while (len > 0) {
+        uInt n = MIN(len, G_MAXUINT32);
+        crc = crc32(crc, buf, n);
+        buf += n;
+        len -= n;
+    }
+    return crc;
+#endif
+}
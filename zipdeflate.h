@@ -0,0 +1,45 @@
+/**
+ * @file zipdeflate.h
+ * @brief Interchangeable deflate implementations for compressing whole files in memory,
+ * and the fastest CRC-32 the build has.
+ *
+ * Most files are smaller than one ZIP_BLOCK_SIZE block, so the zip writer compresses them
+ * in a single piece: the whole file in memory, with no dictionary before it and nothing
+ * after it. That simple case is exactly what libdeflate is built for, and it does it about
+ * twice as fast as zlib, with the same or slightly smaller output. Every backend writes
+ * standard deflate data, so the archives open everywhere whichever one made them.
+ *
+ * Bigger files are cut into blocks that must be chained into one stream (a dictionary from
+ * the previous block, a sync flush at the end), which only zlib supports; they always use
+ * zlib. A zlib-ng build in zlib-compatible mode can replace -lz without any change here.
+ *
+ * Every byte that goes into or comes out of a zip also goes through CRC-32. libdeflate picks
+ * the carry-less multiply (PCLMULQDQ) or ARMv8 CRC instructions at run time when the CPU has
+ * them, which makes the checksum several times faster than zlib's table-driven one.
+ */
+
+#ifndef ZIPDEFLATE_H
+#define ZIPDEFLATE_H
+
+#include <glib.h>
+
+typedef struct {
+    const gchar *name;
+    // The most bytes compressing `len` bytes can produce.
+    gsize (*bound)(gsize len);
+    // Compresses `len` bytes into one complete raw deflate stream in `out`, which has room for
+    // bound(len) bytes. `level` is 1 to 9, or 0 for the default. Returns the compressed size,
+    // or 0 on failure. Safe to call from several threads at once.
+    gsize (*compress)(const guchar *in, gsize len, guchar *out, gsize capacity, int level);
+} ZipDeflateBackend;
+
+// zlib, which every build has.
+const ZipDeflateBackend* zip_deflate_zlib(void);
+
+// The fastest backend in this build: libdeflate if it was built with it, zlib otherwise.
+const ZipDeflateBackend* zip_deflate_best(void);
+
+// Continues the CRC-32 `crc` (0 to start) over `len` more bytes, the same as zlib's crc32().
+guint32 zip_crc32(guint32 crc, const guchar *buf, gsize len);
+
+#endif // ZIPDEFLATE_H
@@ -0,0 +1,636 @@
+/**
+ * @file zipreader.c
+ * @brief Implementation of the zip index and the parallel zip extractor.
+ *
+ * Opening an archive maps it into memory and walks its central directory in place, so only
+ * the pages holding the directory are ever read from disk; the entries are copied out and the
+ * mapping is dropped again. The folder tree used for browsing is only built the first time
+ * a folder is listed.
+ *
+ * Extraction then runs in two more steps. The calling thread creates all the folders, so the
+ * workers never race each other to create the same one. Then the files go to a thread pool,
+ * biggest first: a huge file that started last would keep one core busy long after the
+ * others have run out of work.
+ *
+ * Testing an archive is extraction without the output: the same workers inflate every file
+ * and check its CRC-32, but nothing is created, so there is no skeleton step either.
+ */
+
+#include "zipreader.h"
+#include "extractdir.h"
+#include "zipdeflate.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <zlib.h>
+
+// Record signatures and flags from the zip specification (APPNOTE.TXT).
+#define SIG_LOCAL_HEADER 0x04034b50
+#define SIG_CENTRAL_HEADER 0x02014b50
+#define SIG_END 0x06054b50
+#define SIG_ZIP64_END 0x06064b50
+#define SIG_ZIP64_LOCATOR 0x07064b50
+#define FLAG_ENCRYPTED 0x0001
+#define METHOD_STORE 0
+#define METHOD_DEFLATE 8
+#define MADE_BY_UNIX 3
+#define MSDOS_DIRECTORY 0x10
+#define ZIP32_MAX 0xFFFFFFFFULL
+
+// Sizes of the fixed parts of the records (before their names and extra fields).
+#define LOCAL_HEADER_SIZE 30
+#define CENTRAL_HEADER_SIZE 46
+#define END_SIZE 22
+#define ZIP64_END_SIZE 56
+#define ZIP64_LOCATOR_SIZE 20
+// The end record can be followed by a comment of up to this many bytes.
+#define MAX_COMMENT 0xFFFF
+// Compressed data is read, and inflated data written, in pieces of this size.
+#define CHUNK_SIZE (256 * 1024)
+
+// One file or folder of the archive, as listed in the central directory.
+typedef struct {
+    gchar *path;            // The checked path inside the archive, e.g. "Photos/2024/a.jpg".
+    gboolean is_dir;
+    guint16 flags;
+    guint16 method;
+    guint32 crc;
+    guint64 compressed_size, size;
+    guint64 header_offset;  // Where the entry's local header starts.
+    guint32 mode;           // Unix type and permission bits, or 0 if the archive has none.
+    guint16 dos_time, dos_date;
+} UnzipEntry;
+
+// A folder of the browsing tree.
+typedef struct {
+    ZipIndexItem *self;     // The folder's own item in its parent (NULL for the top).
+    GPtrArray *items;       // ZipIndexItem*, in archive order.
+} ZipFolder;
+
+struct ZipIndex {
+    int fd;                 // The archive, kept open for reading entry data.
+    guint64 data_end;       // Entry data must end before this offset, where the central directory starts.
+    GPtrArray *entries;     // UnzipEntry*, in archive order.
+    GHashTable *folders;    // Folder path ("" for the top) -> ZipFolder*. Built on first use.
+    GPtrArray *items;       // Every ZipIndexItem, for freeing.
+    GHashTable *files;      // File path -> UnzipEntry*. Built on first use.
+};
+
+typedef struct {
+    ZipIndex *index;
+    ExtractDir *dest;
+    OpProgress *progress;
+    gint failed;            // Set (atomically) by a worker that could not extract its file.
+} Unzip;
+
+typedef struct {
+    ZipIndex *index;
+    OpProgress *progress;
+    GMutex lock;
+    GPtrArray *corrupt;     // Paths of the files that failed their check, added under `lock`.
+} ZipTest;
+
+static gboolean pread_full(int fd, guchar *buf, gsize len, guint64 offset) {
+    while (len > 0) {
+        gssize n = pread(fd, buf, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        // n == 0: the archive ends in the middle of the data.
+        if (n <= 0) return FALSE;
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return TRUE;
+}
+
+static gboolean write_full(int fd, const guchar *buf, gsize len) {
+    while (len > 0) {
+        gssize n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return FALSE;
+        buf += n;
+        len -= n;
+    }
+    return TRUE;
+}
+
+// Little-endian helpers for reading records.
+static guint16 get16(const guchar *p) { guint16 v; memcpy(&v, p, 2); return GUINT16_FROM_LE(v); }
+static guint32 get32(const guchar *p) { guint32 v; memcpy(&v, p, 4); return GUINT32_FROM_LE(v); }
+static guint64 get64(const guchar *p) { guint64 v; memcpy(&v, p, 8); return GUINT64_FROM_LE(v); }
+
+static void entry_free(gpointer data) {
+    UnzipEntry *e = data;
+    g_free(e->path);
+    g_free(e);
+}
+
+/**
+ * @brief Finds the central directory of the mapped archive through the end record at its
+ * end (and, for ZIP64 archives, the ZIP64 end record the locator before it points to).
+ */
+static gboolean find_central_directory(const guchar *map, guint64 size, guint64 *cd_offset, guint64 *cd_size, guint64 *count) {
+    guint64 lowest = size - MIN(size, END_SIZE + MAX_COMMENT);
+    guint64 end_offset = 0;
+    gboolean found = FALSE;
+    // Search backwards. The comment could contain the signature too, so a match only counts
+    // if its comment length reaches exactly to the end of the file.
+    for (guint64 pos = size - END_SIZE + 1; !found && pos > lowest;) {
+        pos--;
+        const guchar *p = map + pos;
+        if (get32(p) != SIG_END || pos + END_SIZE + get16(p + 20) != size) continue;
+        *count = get16(p + 10);
+        *cd_size = get32(p + 12);
+        *cd_offset = get32(p + 16);
+        end_offset = pos;
+        found = TRUE;
+    }
+    if (!found) return FALSE;
+
+    if (end_offset >= ZIP64_LOCATOR_SIZE && get32(map + end_offset - ZIP64_LOCATOR_SIZE) == SIG_ZIP64_LOCATOR) {
+        guint64 record_offset = get64(map + end_offset - ZIP64_LOCATOR_SIZE + 8);
+        if (record_offset > end_offset - ZIP64_LOCATOR_SIZE || end_offset - ZIP64_LOCATOR_SIZE - record_offset < ZIP64_END_SIZE)
+            return FALSE;
+        const guchar *record = map + record_offset;
+        if (get32(record) != SIG_ZIP64_END) return FALSE;
+        *count = get64(record + 32);
+        *cd_size = get64(record + 40);
+        *cd_offset = get64(record + 48);
+        end_offset = record_offset;
+    }
+    return *cd_offset <= end_offset && *cd_size <= end_offset - *cd_offset;
+}
+
+/**
+ * @brief Takes the real sizes and offset from a ZIP64 extra field. It holds exactly the values
+ * whose classic fields say 0xFFFFFFFF, in this order.
+ */
+static gboolean read_zip64_extra(const guchar *extra, gsize len, UnzipEntry *e) {
+    while (len >= 4) {
+        guint16 id = get16(extra), size = get16(extra + 2);
+        if (size > len - 4) return FALSE;
+        if (id == 0x0001) {
+            const guchar *p = extra + 4, *end = p + size;
+            guint64 *fields[] = { &e->size, &e->compressed_size, &e->header_offset };
+            for (gsize i = 0; i < G_N_ELEMENTS(fields); i++) {
+                if (*fields[i] != ZIP32_MAX) continue;
+                if (end - p < 8) return FALSE;
+                *fields[i] = get64(p);
+                p += 8;
+            }
+            return TRUE;
+        }
+        extra += 4 + size;
+        len -= 4 + size;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief Walks the central directory, in the mapped archive, and turns it into the list of entries.
+ * @return FALSE if the archive is damaged or any entry has an unsafe name.
+ */
+static gboolean read_central_directory(ZipIndex *index, const guchar *map, guint64 size) {
+    guint64 cd_offset, cd_size, count;
+    if (!find_central_directory(map, size, &cd_offset, &cd_size, &count)) return FALSE;
+    index->data_end = cd_offset;
+    const guchar *cd = map + cd_offset;
+    gsize pos = 0;
+    gboolean ok = TRUE;
+    for (guint64 i = 0; ok && i < count; i++) {
+        const guchar *p = cd + pos;
+        if (cd_size - pos < CENTRAL_HEADER_SIZE || get32(p) != SIG_CENTRAL_HEADER) { ok = FALSE; break; }
+        guint16 made_by = get16(p + 4);
+        guint16 name_len = get16(p + 28), extra_len = get16(p + 30), comment_len = get16(p + 32);
+        guint32 external = get32(p + 38);
+        gsize record_len = CENTRAL_HEADER_SIZE + name_len + extra_len + comment_len;
+        if (cd_size - pos < record_len) { ok = FALSE; break; }
+        pos += record_len;
+
+        UnzipEntry *e = g_new0(UnzipEntry, 1);
+        e->flags = get16(p + 8);
+        e->method = get16(p + 10);
+        e->dos_time = get16(p + 12);
+        e->dos_date = get16(p + 14);
+        e->crc = get32(p + 16);
+        e->compressed_size = get32(p + 20);
+        e->size = get32(p + 24);
+        e->header_offset = get32(p + 42);
+        const gchar *name = (const gchar *)p + CENTRAL_HEADER_SIZE;
+        if ((made_by >> 8) == MADE_BY_UNIX) e->mode = external >> 16;
+        e->is_dir = (name_len > 0 && (name[name_len - 1] == '/' || name[name_len - 1] == '\\'))
+                    || S_ISDIR(e->mode) || (external & MSDOS_DIRECTORY);
+        e->path = archive_entry_path(name, name_len);
+        ok = e->path && read_zip64_extra(p + CENTRAL_HEADER_SIZE + name_len, extra_len, e);
+        // Symlinks are not recreated: one could point anywhere, and later entries be written through it.
+        if (!ok || S_ISLNK(e->mode)) entry_free(e);
+        else g_ptr_array_add(index->entries, e);
+    }
+    return ok;
+}
+
+ZipIndex* zip_index_open(const gchar *zip_path) {
+    int fd = open(zip_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < END_SIZE) { close(fd); return NULL; }
+    // Mapping the archive lets the central directory be parsed where it lies: the kernel
+    // reads in just the pages we touch, without copying them into a buffer first.
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) { close(fd); return NULL; }
+
+    ZipIndex *index = g_new0(ZipIndex, 1);
+    index->fd = fd;
+    index->entries = g_ptr_array_new_with_free_func(entry_free);
+    gboolean ok = read_central_directory(index, map, st.st_size);
+    munmap(map, st.st_size);
+    if (!ok) {
+        zip_index_free(index);
+        return NULL;
+    }
+    return index;
+}
+
+static void folder_free(gpointer data) {
+    ZipFolder *folder = data;
+    g_ptr_array_free(folder->items, TRUE);
+    g_free(folder);
+}
+
+void zip_index_free(ZipIndex *index) {
+    if (!index) return;
+    close(index->fd);
+    g_ptr_array_free(index->entries, TRUE);
+    if (index->folders) g_hash_table_destroy(index->folders);
+    if (index->items) g_ptr_array_free(index->items, TRUE);
+    if (index->files) g_hash_table_destroy(index->files);
+    g_free(index);
+}
+
+static ZipIndexItem* item_new(ZipIndex *index, const gchar *name, gboolean is_dir) {
+    ZipIndexItem *item = g_new0(ZipIndexItem, 1);
+    item->name = name;
+    item->is_dir = is_dir;
+    g_ptr_array_add(index->items, item);
+    return item;
+}
+
+static void item_fill(ZipIndexItem *item, const UnzipEntry *e) {
+    item->size = e->is_dir ? 0 : e->size;
+    item->mode = e->mode;
+    item->dos_time = e->dos_time;
+    item->dos_date = e->dos_date;
+}
+
+/**
+ * @brief Finds the folder `path` of the browsing tree, creating it (and its parents) if it is
+ * new. Takes ownership of `path`.
+ */
+static ZipFolder* folder_for(ZipIndex *index, gchar *path) {
+    ZipFolder *folder = g_hash_table_lookup(index->folders, path);
+    if (folder) {
+        g_free(path);
+        return folder;
+    }
+    folder = g_new0(ZipFolder, 1);
+    folder->items = g_ptr_array_new();
+    g_hash_table_insert(index->folders, path, folder);
+    // Archives don't have to list folders, only the files in them, so a folder can first
+    // turn up as part of a path. Its item's name points into the table's key.
+    if (*path) {
+        const gchar *base;
+        gchar *parent = extract_dir_split(path, &base);
+        folder->self = item_new(index, base, TRUE);
+        g_ptr_array_add(folder_for(index, parent)->items, folder->self);
+    }
+    return folder;
+}
+
+static void build_folders(ZipIndex *index) {
+    index->folders = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, folder_free);
+    index->items = g_ptr_array_new_with_free_func(g_free);
+    folder_for(index, g_strdup(""));
+    for (guint i = 0; i < index->entries->len; i++) {
+        UnzipEntry *e = g_ptr_array_index(index->entries, i);
+        if (e->is_dir) {
+            item_fill(folder_for(index, g_strdup(e->path))->self, e);
+        } else {
+            const gchar *base;
+            gchar *parent = extract_dir_split(e->path, &base);
+            ZipIndexItem *item = item_new(index, base, FALSE);
+            item_fill(item, e);
+            g_ptr_array_add(folder_for(index, parent)->items, item);
+        }
+    }
+}
+
+GPtrArray* zip_index_list(ZipIndex *index, const gchar *dir) {
+    if (!index->folders) build_folders(index);
+    // Accept "a/b", "/a/b/" and so on; the tree's keys have no slashes at either end.
+    while (*dir == '/') dir++;
+    gchar *key = g_strdup(dir);
+    gsize len = strlen(key);
+    while (len > 0 && key[len - 1] == '/') key[--len] = '\0';
+    ZipFolder *folder = g_hash_table_lookup(index->folders, key);
+    g_free(key);
+    return folder ? folder->items : NULL;
+}
+
+gchar* zip_index_item_modified(const ZipIndexItem *item) {
+    // A folder the archive doesn't list has no date of its own.
+    if (item->dos_date == 0) return g_strdup("");
+    // MS-DOS dates are local time already, so they can be shown as they are.
+    return g_strdup_printf("%04d-%02d-%02d %02d:%02d:%02d", (item->dos_date >> 9) + 1980, (item->dos_date >> 5) & 15,
+                           item->dos_date & 31, item->dos_time >> 11, (item->dos_time >> 5) & 63, (item->dos_time & 31) * 2);
+}
+
+/**
+ * @brief Reserves `size` bytes for a new file up front, so the file system can give it one
+ * contiguous run of blocks. Failure doesn't matter: the file just grows as it is written.
+ */
+static void preallocate(int fd, guint64 size) {
+    if (size == 0) return;
+#if defined(__linux__)
+    fallocate(fd, 0, 0, size);
+#elif defined(__APPLE__)
+    fstore_t store = { F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, size, 0 };
+    if (fcntl(fd, F_PREALLOCATE, &store) == -1) {
+        store.fst_flags = F_ALLOCATEALL;
+        fcntl(fd, F_PREALLOCATE, &store);
+    }
+#endif
+}
+
+/**
+ * @brief Finds where an entry's data starts. It follows the local header, whose name and
+ * extra field may differ in length from the central directory's copy, so that is read first.
+ * @return FALSE for damaged entries and ones we can't extract (encrypted, or another method).
+ */
+static gboolean entry_data_offset(ZipIndex *index, const UnzipEntry *e, guint64 *offset) {
+    if ((e->flags & FLAG_ENCRYPTED) || (e->method != METHOD_STORE && e->method != METHOD_DEFLATE)) return FALSE;
+    guchar h[LOCAL_HEADER_SIZE];
+    if (!pread_full(index->fd, h, sizeof(h), e->header_offset) || get32(h) != SIG_LOCAL_HEADER) return FALSE;
+    *offset = e->header_offset + LOCAL_HEADER_SIZE + get16(h + 26) + get16(h + 28);
+    return *offset <= index->data_end && e->compressed_size <= index->data_end - *offset;
+}
+
+gboolean zip_index_find_member(ZipIndex *index, const gchar *member, ZipMemberData *data) {
+    if (!index->files) {
+        index->files = g_hash_table_new(g_str_hash, g_str_equal);
+        for (guint i = 0; i < index->entries->len; i++) {
+            UnzipEntry *e = g_ptr_array_index(index->entries, i);
+            if (!e->is_dir) g_hash_table_insert(index->files, e->path, e);
+        }
+    }
+    UnzipEntry *e = g_hash_table_lookup(index->files, member);
+    if (!e || !entry_data_offset(index, e, &data->data_offset)) return FALSE;
+    data->fd = index->fd;
+    data->method = e->method;
+    data->crc = e->crc;
+    data->compressed_size = e->compressed_size;
+    data->size = e->size;
+    data->dos_time = e->dos_time;
+    data->dos_date = e->dos_date;
+    return TRUE;
+}
+
+/**
+ * @brief Copies (stored) or inflates (deflated) an entry's data into `out_fd`, checking its
+ * size and CRC-32 against the central directory. With `out_fd` -1 it only checks.
+ */
+static gboolean write_data(ZipIndex *index, const UnzipEntry *e, guint64 offset, int out_fd, OpProgress *progress) {
+    gboolean inflating = (e->method == METHOD_DEFLATE);
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    // Negative window bits: zip entries hold a raw deflate stream, without zlib's header.
+    if (inflating && inflateInit2(&z, -MAX_WBITS) != Z_OK) return FALSE;
+    guchar *in = g_malloc(CHUNK_SIZE), *out = g_malloc(CHUNK_SIZE);
+    guint64 left = e->compressed_size, written = 0;
+    guint32 crc = 0;
+    gboolean ok = TRUE;
+    for (;;) {
+        gsize n = MIN(left, CHUNK_SIZE);
+        if (op_progress_is_cancelled(progress) || !pread_full(index->fd, in, n, offset)) { ok = FALSE; break; }
+        offset += n;
+        left -= n;
+        op_progress_add(progress, n, 0);
+        if (!inflating) {
+            crc = zip_crc32(crc, in, n);
+            written += n;
+            ok = (out_fd == -1 || write_full(out_fd, in, n));
+            if (!ok || left == 0) break;
+            continue;
+        }
+        int ret;
+        z.next_in = in;
+        z.avail_in = n;
+        do {
+            z.next_out = out;
+            z.avail_out = CHUNK_SIZE;
+            ret = inflate(&z, Z_NO_FLUSH);
+            gsize produced = CHUNK_SIZE - z.avail_out;
+            // More data than the central directory promised means a damaged archive (or a
+            // "zip bomb"); either way, stop before it fills the disk.
+            ok = (ret == Z_OK || ret == Z_STREAM_END || ret == Z_BUF_ERROR) && produced <= e->size - written;
+            if (ok) {
+                crc = zip_crc32(crc, out, produced);
+                written += produced;
+                ok = (out_fd == -1 || write_full(out_fd, out, produced));
+            }
+        } while (ok && ret != Z_STREAM_END && z.avail_out == 0);
+        if (!ok || ret == Z_STREAM_END) break;
+        // The compressed data ran out before the deflate stream ended.
+        if (left == 0) { ok = FALSE; break; }
+    }
+    if (inflating) inflateEnd(&z);
+    g_free(in);
+    g_free(out);
+    return ok && written == e->size && crc == e->crc;
+}
+
+/**
+ * @brief Gives an extracted file the modification time recorded in the archive
+ * (MS-DOS format: local time, two-second steps).
+ */
+static void set_mtime(int fd, const UnzipEntry *e) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = (e->dos_date >> 9) + 80;
+    tm.tm_mon = ((e->dos_date >> 5) & 15) - 1;
+    tm.tm_mday = e->dos_date & 31;
+    tm.tm_hour = e->dos_time >> 11;
+    tm.tm_min = (e->dos_time >> 5) & 63;
+    tm.tm_sec = (e->dos_time & 31) * 2;
+    tm.tm_isdst = -1;   // Let mktime() work out whether summer time applied.
+    struct timespec times[2] = { { 0, UTIME_NOW }, { mktime(&tm), 0 } };
+    futimens(fd, times);
+}
+
+/**
+ * @brief Writes entry `e` as the new file `name` in the open folder `dir_fd`.
+ * @return FALSE (leaving no file behind) if anything went wrong.
+ */
+static gboolean extract_entry_at(ZipIndex *index, const UnzipEntry *e, int dir_fd, const gchar *name, OpProgress *progress) {
+    guint64 offset;
+    if (!entry_data_offset(index, e, &offset)) return FALSE;
+    // O_EXCL: an existing file is never replaced. O_NOFOLLOW: nor written through a symlink.
+    int fd = openat(dir_fd, name, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, e->mode ? e->mode & 0777 : 0666);
+    if (fd == -1) return FALSE;
+    preallocate(fd, e->size);
+    gboolean ok = write_data(index, e, offset, fd, progress);
+    if (ok) set_mtime(fd, e);
+    ok = (close(fd) == 0) && ok;
+    // Never leave a half-written file behind.
+    if (!ok) unlinkat(dir_fd, name, 0);
+    return ok;
+}
+
+gchar* zip_index_extract_member(ZipIndex *index, const gchar *member, const gchar *dest_dir) {
+    while (*member == '/') member++;
+    for (guint i = 0; i < index->entries->len; i++) {
+        UnzipEntry *e = g_ptr_array_index(index->entries, i);
+        if (e->is_dir || strcmp(e->path, member) != 0) continue;
+        int dir_fd = open(dest_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd == -1) return NULL;
+        const gchar *base = strrchr(e->path, '/');
+        base = base ? base + 1 : e->path;
+        gboolean ok = extract_entry_at(index, e, dir_fd, base, NULL);
+        close(dir_fd);
+        return ok ? g_build_filename(dest_dir, base, NULL) : NULL;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Extracts one file (runs on a worker thread). Its folder already exists.
+ */
+static gboolean extract_file(Unzip *u, UnzipEntry *e) {
+    const gchar *base;
+    gchar *parent = extract_dir_split(e->path, &base);
+    int dir_fd = extract_dir_open(u->dest, parent);
+    gboolean ok = (dir_fd != -1 && extract_entry_at(u->index, e, dir_fd, base, u->progress));
+    // Only a file we created is recorded; a file that was in the way is left alone.
+    if (ok) extract_dir_created(u->dest, e->path);
+    if (dir_fd != -1) close(dir_fd);
+    g_free(parent);
+    return ok;
+}
+
+/**
+ * @brief The thread pool's worker function.
+ */
+static void unzip_worker(gpointer data, gpointer user_data) {
+    Unzip *u = user_data;
+    if (op_progress_is_cancelled(u->progress) || !extract_file(u, data)) g_atomic_int_set(&u->failed, TRUE);
+}
+
+static gint compare_biggest_first(gconstpointer a, gconstpointer b) {
+    const UnzipEntry *ea = *(UnzipEntry * const *)a, *eb = *(UnzipEntry * const *)b;
+    return (ea->compressed_size < eb->compressed_size) - (ea->compressed_size > eb->compressed_size);
+}
+
+gboolean zip_extract(const gchar *zip_path, const gchar *dest_dir, int threads, OpProgress *progress) {
+    Unzip u;
+    memset(&u, 0, sizeof(u));
+    // Step 1: the central directory, with every name checked before anything is written.
+    u.index = zip_index_open(zip_path);
+    u.dest = extract_dir_new(dest_dir);
+    u.progress = progress;
+    gboolean ok = u.index && u.dest;
+    GPtrArray *entries = ok ? u.index->entries : NULL;
+
+    // Step 2: the skeleton. Folders listed in the archive come first, so they get their own
+    // permissions; then the folders of the files, for archives that don't list them.
+    for (guint i = 0; ok && i < entries->len; i++) {
+        UnzipEntry *e = g_ptr_array_index(entries, i);
+        if (e->is_dir) ok = extract_dir_make(u.dest, e->path, e->mode) && !op_progress_is_cancelled(progress);
+    }
+    GPtrArray *files = g_ptr_array_new();
+    for (guint i = 0; ok && i < entries->len; i++) {
+        UnzipEntry *e = g_ptr_array_index(entries, i);
+        if (e->is_dir) continue;
+        const gchar *base;
+        gchar *parent = extract_dir_split(e->path, &base);
+        ok = extract_dir_make(u.dest, parent, 0) && !op_progress_is_cancelled(progress);
+        g_free(parent);
+        g_ptr_array_add(files, e);
+    }
+
+    // Step 3: the files, in parallel.
+    if (ok && files->len > 0) {
+        g_ptr_array_sort(files, compare_biggest_first);
+        if (threads <= 0) threads = g_get_num_processors();
+        GThreadPool *pool = g_thread_pool_new(unzip_worker, &u, MIN((guint)threads, files->len), FALSE, NULL);
+        for (guint i = 0; i < files->len; i++) g_thread_pool_push(pool, g_ptr_array_index(files, i), NULL);
+        // Waits until every file has been handled.
+        g_thread_pool_free(pool, FALSE, TRUE);
+        ok = !g_atomic_int_get(&u.failed);
+    }
+    g_ptr_array_free(files, TRUE);
+
+    if (u.dest && op_progress_is_cancelled(progress)) {
+        extract_dir_remove_created(u.dest);
+        ok = FALSE;
+    }
+    zip_index_free(u.index);
+    extract_dir_free(u.dest);
+    return ok;
+}
+
+/**
+ * @brief The thread pool's worker function for testing: checks one file.
+ */
+static void test_worker(gpointer data, gpointer user_data) {
+    ZipTest *t = user_data;
+    UnzipEntry *e = data;
+    if (op_progress_is_cancelled(t->progress)) return;
+    guint64 offset;
+    gboolean ok = entry_data_offset(t->index, e, &offset) && write_data(t->index, e, offset, -1, t->progress);
+    // A check cut short by cancelling says nothing about the file.
+    if (ok || op_progress_is_cancelled(t->progress)) return;
+    g_mutex_lock(&t->lock);
+    g_ptr_array_add(t->corrupt, g_strdup(e->path));
+    g_mutex_unlock(&t->lock);
+}
+
+static gint compare_paths(gconstpointer a, gconstpointer b) {
+    return strcmp(*(const gchar * const *)a, *(const gchar * const *)b);
+}
+
+gboolean zip_test(const gchar *zip_path, int threads, GPtrArray *corrupt, OpProgress *progress) {
+    ZipTest t;
+    memset(&t, 0, sizeof(t));
+    t.index = zip_index_open(zip_path);
+    if (!t.index) return FALSE;
+    t.progress = progress;
+    t.corrupt = corrupt ? corrupt : g_ptr_array_new_with_free_func(g_free);
+    g_mutex_init(&t.lock);
+
+    GPtrArray *files = g_ptr_array_new();
+    for (guint i = 0; i < t.index->entries->len; i++) {
+        UnzipEntry *e = g_ptr_array_index(t.index->entries, i);
+        if (!e->is_dir) g_ptr_array_add(files, e);
+    }
+    if (files->len > 0) {
+        // Biggest first, for the same reason as when extracting.
+        g_ptr_array_sort(files, compare_biggest_first);
+        if (threads <= 0) threads = g_get_num_processors();
+        GThreadPool *pool = g_thread_pool_new(test_worker, &t, MIN((guint)threads, files->len), FALSE, NULL);
+        for (guint i = 0; i < files->len; i++) g_thread_pool_push(pool, g_ptr_array_index(files, i), NULL);
+        // Waits until every file has been checked.
+        g_thread_pool_free(pool, FALSE, TRUE);
+    }
+    g_ptr_array_free(files, TRUE);
+
+    // The workers finish in any order; the report lists the files by name.
+    g_ptr_array_sort(t.corrupt, compare_paths);
+    gboolean ok = (t.corrupt->len == 0) && !op_progress_is_cancelled(progress);
+    if (!corrupt) g_ptr_array_free(t.corrupt, TRUE);
+    g_mutex_clear(&t.lock);
+    zip_index_free(t.index);
+    return ok;
+}
@@ -0,0 +1,93 @@
+/**
+ * @file zipreader.h
+ * @brief Extracting .zip archives with every CPU core inflating at once.
+ *
+ * A zip archive ends with a table of contents, the "central directory", that lists every
+ * entry with its sizes and where its data starts. So the archive does not have to be read
+ * front to back: the central directory is read once, every folder is created up front (the
+ * "skeleton"), and then a pool of worker threads extracts the files independently, each
+ * reading its own part of the archive. Every output file gets its full size reserved on disk
+ * before it is written, so it is laid out in one piece instead of growing bit by bit.
+ *
+ * Entry names come from whoever made the archive and are not trusted. A name that is absolute
+ * or climbs out with ".." (the "zip slip" attack) makes the extraction fail before anything
+ * is written. Folders are opened one component at a time without following symlinks, so a
+ * symlink already in the destination can't redirect a file elsewhere either, and existing
+ * files are never replaced. Symlink entries are skipped, not recreated.
+ *
+ * The same central directory lets an archive be browsed like a folder without extracting it:
+ * zip_index_open() reads just the table of contents, and zip_index_list() lists one folder of
+ * it. Even an archive with hundreds of thousands of entries opens in a fraction of a second,
+ * because the file data is never touched until a single member is extracted.
+ *
+ * zip_test() checks an archive the way extracting it would, on every core at once, but
+ * writes nothing: each file is inflated in memory and its CRC-32 compared with the one the
+ * archive recorded. It is limited by how fast the archive can be read, not by the disk
+ * writes an extraction would need.
+ */
+
+#ifndef ZIPREADER_H
+#define ZIPREADER_H
+
+#include <glib.h>
+#include "backend.h"
+
+// The table of contents of an open archive.
+typedef struct ZipIndex ZipIndex;
+
+// One file or folder in a listing.
+typedef struct {
+    const gchar *name;      // Its last path component.
+    gboolean is_dir;
+    guint64 size;           // Uncompressed size in bytes (0 for folders).
+    guint32 mode;           // Unix type and permission bits, or 0 if the archive has none.
+    guint16 dos_time, dos_date; // Modification time in MS-DOS format (0 if unknown).
+} ZipIndexItem;
+
+// Opens the archive at `zip_path` and reads its central directory. Returns NULL if it is not
+// a zip archive, is damaged, or has an unsafe entry name.
+ZipIndex* zip_index_open(const gchar *zip_path);
+void zip_index_free(ZipIndex *index);
+
+// Lists the folder `dir` of the archive ("" for the top), in archive order, as ZipIndexItem*
+// owned by the index. Returns NULL if there is no such folder. The first call builds the
+// folder tree; later ones are a single lookup.
+GPtrArray* zip_index_list(ZipIndex *index, const gchar *dir);
+
+// Formats an item's modification time as "YYYY-MM-DD HH:MM:SS" (empty if unknown).
+gchar* zip_index_item_modified(const ZipIndexItem *item);
+
+// Where a file's data lies in an archive, for copying it into a new archive as it is.
+typedef struct {
+    int fd;                 // The archive (owned by the index).
+    guint64 data_offset;    // Where the file's compressed data starts.
+    guint16 method;         // 0 (stored) or 8 (deflated).
+    guint32 crc;            // CRC-32 of the uncompressed data.
+    guint64 compressed_size, size;
+    guint16 dos_time, dos_date;
+} ZipMemberData;
+
+// Looks up the file `member` (its path inside the archive). Returns FALSE if there is no such
+// file or its data can't be used as it is (encrypted, or compressed with another method).
+gboolean zip_index_find_member(ZipIndex *index, const gchar *member, ZipMemberData *data);
+
+// Extracts the single file `member` (its path inside the archive) into the folder
+// `dest_dir`. Returns the path of the new file, or NULL if there is no such file, it
+// couldn't be extracted, or a file with its name is already there.
+gchar* zip_index_extract_member(ZipIndex *index, const gchar *member, const gchar *dest_dir);
+
+// Extracts the archive at `zip_path` into the folder `dest_dir` with `threads` threads
+// (0 means one per CPU). Progress is counted in bytes of the archive processed. Returns FALSE
+// if the archive is damaged or unsafe, or if any entry could not be extracted. Once `progress`
+// is cancelled the extraction stops and removes everything it had created.
+gboolean zip_extract(const gchar *zip_path, const gchar *dest_dir, int threads, OpProgress *progress);
+
+// Checks every file in the archive at `zip_path` with `threads` threads (0 means one per CPU)
+// without extracting anything. The paths of the files that are damaged, or can't be checked
+// (encrypted, or compressed with another method), are added to `corrupt` (if not NULL) as
+// newly allocated strings, sorted by name. Progress is counted in bytes of the archive read.
+// Returns FALSE if any file failed its check, if the archive's table of contents can't be
+// read (then `corrupt` stays empty), or if `progress` was cancelled.
+gboolean zip_test(const gchar *zip_path, int threads, GPtrArray *corrupt, OpProgress *progress);
+
+#endif // ZIPREADER_H
@@ -0,0 +1,748 @@
+/**
+ * @file zipwriter.c
+ * @brief Implementation of the parallel zip writer.
+ *
+ * Every block of every file goes into one queue, in archive order. Worker threads compress
+ * the blocks in any order; the thread that adds the files writes them out from the front of
+ * the queue as they become ready. The queue is limited to a few blocks per thread, so memory
+ * use stays small no matter how big the files are: when it is full, adding a file waits for
+ * the front block and writes it.
+ *
+ * Folders travel through the same queue (as blocks without data), so they land in the
+ * archive in the order they were added as well.
+ *
+ * Nothing is kept per entry once it is written: its central directory record goes straight
+ * into a temporary file, which is appended to the archive at the end. So memory and open
+ * files stay the same whether the archive has ten entries or ten million, and the archive
+ * grows on disk as the zip goes along.
+ *
+ * Files that fit in one block are compressed by the fastest deflate backend in the build
+ * (see zipdeflate.h); only the chained blocks of bigger files need zlib itself.
+ *
+ * When an earlier version of the archive is given, files that haven't changed since are not
+ * compressed again: their blocks are copied from the old archive byte for byte instead.
+ */
+
+#include "zipwriter.h"
+#include "zipdeflate.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <zlib.h>
+
+// Deflate refers back at most 32 KiB, so that much data before a block is its dictionary.
+#define DICT_SIZE 32768
+// Blocks in the queue per worker thread: enough to keep every worker busy.
+#define BLOCKS_PER_THREAD 4
+// Files at least this big get ZIP64 sizes. Deflate can make incompressible data slightly
+// bigger, so this stays well clear of the 4 GiB limit of the classic size fields.
+#define ZIP64_FILE_LIMIT 0xF0000000ULL
+#define ZIP32_MAX 0xFFFFFFFFULL
+// Files are checked for compressibility by reading this many pieces of this size, spread
+// evenly over the file. Smaller files are simply deflated: there is little to save on them.
+#define SAMPLE_COUNT 4
+#define SAMPLE_SIZE 16384
+// Above this many bits of entropy per byte (8 is the maximum), a file is stored uncompressed.
+// Already-compressed data measures 7.99; text is around 4.5 and programs 5 to 6.5.
+#define STORE_ENTROPY 7.5
+
+// Record signatures and flags from the zip specification (APPNOTE.TXT).
+#define SIG_LOCAL_HEADER 0x04034b50
+#define SIG_CENTRAL_HEADER 0x02014b50
+#define SIG_END 0x06054b50
+#define SIG_ZIP64_END 0x06064b50
+#define SIG_ZIP64_LOCATOR 0x07064b50
+#define SIG_DATA_DESCRIPTOR 0x08074b50
+#define FLAG_DATA_DESCRIPTOR 0x0008
+#define FLAG_UTF8_NAME 0x0800
+#define METHOD_STORE 0
+#define METHOD_DEFLATE 8
+#define MADE_BY_UNIX (3 << 8)
+
+// One file or folder in the archive. It lives as long as it has blocks in the queue.
+// Only the writing thread changes `refs`.
+typedef struct {
+    int fd;                 // The open file (-1 for folders).
+    int refs;
+    gchar *name;            // The path inside the archive; folders end with "/".
+    gboolean is_dir;
+    guint16 method;         // METHOD_DEFLATE, or METHOD_STORE for folders and incompressible files.
+    gboolean zip64;         // The local header has a ZIP64 extra field for the sizes.
+    gboolean descriptor;    // The CRC and sizes follow the data instead of being filled in later.
+    // A streamed stored file bigger than one block: its CRC and size are taken before its data
+    // is sent, so its header can be final (see zip_writer_add_file()).
+    gboolean presized;
+    guint32 presized_crc;
+    guint64 presized_size;
+    guint32 mode;           // Unix type and permission bits.
+    guint16 dos_time, dos_date;
+    guint64 header_offset;  // Where the local header starts in the archive.
+    guint32 crc;
+    guint64 compressed_size, size;
+    // Entries copied from the previous archive: their data is read from there, already
+    // compressed, and the CRC and sizes above are known from the start.
+    gboolean copied;
+    int copy_fd;            // The previous archive (not owned by the entry).
+    guint64 copy_offset;    // Where the entry's data starts in it.
+} ZipEntry;
+
+// One piece of a file: compressed by a worker, then written by the writing thread.
+typedef struct {
+    ZipEntry *entry;
+    guint64 offset;
+    gsize len;
+    gboolean first, last;   // The entry's first and last block (both for small files).
+    // Filled in by the worker.
+    guchar *out;
+    gsize out_len;
+    guint32 crc;
+    gint64 cpu_ns;          // CPU time deflate took.
+    gboolean failed;
+    gboolean done;          // Protected by the writer's lock.
+} ZipBlock;
+
+struct ZipWriter {
+    gchar *path;
+    gchar *tmp_path;        // NULL when streaming to a file descriptor we don't own.
+    int fd;
+    gboolean streaming;     // `fd` can't seek: headers are never rewritten.
+    guint64 offset;         // Where the next byte goes in the archive.
+    FILE *central;          // The central directory records of the entries written so far.
+    guint64 entry_count;
+    GThreadPool *pool;
+    GQueue pending;         // ZipBlock*, in archive order: queued but not written yet.
+    guint max_pending;
+    int level;              // The deflate level, or ZIP_LEVEL_STORE.
+    const ZipDeflateBackend *whole; // Compresses files that fit in one block.
+    ZipStats stats;
+    guint64 bytes_deflated; // File data that went through deflate (for the CPU estimate).
+    ZipIndex *previous;     // The archive being updated, or NULL.
+    OpProgress *progress;
+    gboolean failed;
+    GMutex lock;
+    GCond cond;
+};
+
+static gboolean pread_full(int fd, guchar *buf, gsize len, guint64 offset) {
+    while (len > 0) {
+        gssize n = pread(fd, buf, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        // n == 0: the file got shorter since we looked at its size.
+        if (n <= 0) return FALSE;
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return TRUE;
+}
+
+static gboolean write_full(int fd, const guchar *buf, gsize len) {
+    while (len > 0) {
+        gssize n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return FALSE;
+        buf += n;
+        len -= n;
+    }
+    return TRUE;
+}
+
+static gint64 thread_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (gint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief Reads a block of a stored file: its data goes into the archive as it is.
+ */
+static void read_block(ZipBlock *b) {
+    b->out = g_malloc(b->len + 1);
+    b->failed = !pread_full(b->entry->fd, b->out, b->len, b->offset);
+    if (b->failed) return;
+    b->crc = zip_crc32(0, b->out, b->len);
+    b->out_len = b->len;
+}
+
+/**
+ * @brief Reads a block of an entry copied from the previous archive, compressed as it is there.
+ */
+static void copy_block(ZipBlock *b) {
+    b->out = g_malloc(b->len + 1);
+    b->failed = !pread_full(b->entry->copy_fd, b->out, b->len, b->entry->copy_offset + b->offset);
+    b->out_len = b->len;
+}
+
+/**
+ * @brief Compresses one block (runs on a worker thread). Single-block files go through
+ * `whole`; the blocks of bigger files are chained with zlib.
+ */
+static void compress_block(ZipBlock *b, int level, const ZipDeflateBackend *whole) {
+    // The dictionary is the data right before the block, so both are read in one go.
+    gsize dict_len = MIN(b->offset, DICT_SIZE);
+    guchar *in = g_malloc(dict_len + b->len + 1);
+    if (!pread_full(b->entry->fd, in, dict_len + b->len, b->offset - dict_len)) {
+        b->failed = TRUE;
+        g_free(in);
+        return;
+    }
+    guchar *data = in + dict_len;
+    b->crc = zip_crc32(0, data, b->len);
+
+    // A file that fits in one block is a complete stream on its own, which the faster
+    // whole-buffer backend can produce.
+    if (b->first && b->last) {
+        b->out = g_malloc(whole->bound(b->len));
+        gint64 start_ns = thread_cpu_ns();
+        b->out_len = whole->compress(data, b->len, b->out, whole->bound(b->len), level);
+        b->cpu_ns = thread_cpu_ns() - start_ns;
+        b->failed = (b->out_len == 0);
+        g_free(in);
+        return;
+    }
+
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    // Negative window bits give a raw deflate stream: the zip format has its own headers.
+    if (deflateInit2(&z, level > 0 ? level : Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        b->failed = TRUE;
+        g_free(in);
+        return;
+    }
+    if (dict_len > 0) deflateSetDictionary(&z, in, dict_len);
+    // deflateBound() covers the compressed data; the sync flush marker needs a few bytes more.
+    gsize capacity = deflateBound(&z, b->len) + 16;
+    b->out = g_malloc(capacity);
+    z.next_in = data;
+    z.avail_in = b->len;
+    z.next_out = b->out;
+    z.avail_out = capacity;
+    // Only the last block ends the stream. The others end with a sync flush, which pads the
+    // output to a whole byte so the next block's data can simply be appended.
+    gint64 start_ns = thread_cpu_ns();
+    int ret = deflate(&z, b->last ? Z_FINISH : Z_SYNC_FLUSH);
+    b->cpu_ns = thread_cpu_ns() - start_ns;
+    b->failed = b->last ? (ret != Z_STREAM_END) : (ret != Z_OK || z.avail_in != 0);
+    b->out_len = capacity - z.avail_out;
+    deflateEnd(&z);
+    g_free(in);
+}
+
+/**
+ * @brief The thread pool's worker function.
+ */
+static void zip_worker(gpointer data, gpointer user_data) {
+    ZipBlock *b = data;
+    ZipWriter *zw = user_data;
+    if (op_progress_is_cancelled(zw->progress)) b->failed = TRUE;
+    else if (b->entry->copied) copy_block(b);
+    else if (b->entry->method == METHOD_STORE) read_block(b);
+    else compress_block(b, zw->level, zw->whole);
+    // A copied file's progress was counted when it was checked.
+    if (!b->failed && !b->entry->copied) op_progress_add(zw->progress, b->len, 0);
+
+    g_mutex_lock(&zw->lock);
+    b->done = TRUE;
+    g_cond_broadcast(&zw->cond);
+    g_mutex_unlock(&zw->lock);
+}
+
+static void entry_unref(ZipEntry *e) {
+    if (--e->refs > 0) return;
+    if (e->fd != -1) close(e->fd);
+    g_free(e->name);
+    g_free(e);
+}
+
+static void block_free(ZipBlock *b) {
+    entry_unref(b->entry);
+    g_free(b->out);
+    g_free(b);
+}
+
+// Little-endian helpers for building headers.
+static void put16(GByteArray *a, guint16 v) { v = GUINT16_TO_LE(v); g_byte_array_append(a, (const guint8 *)&v, 2); }
+static void put32(GByteArray *a, guint32 v) { v = GUINT32_TO_LE(v); g_byte_array_append(a, (const guint8 *)&v, 4); }
+static void put64(GByteArray *a, guint64 v) { v = GUINT64_TO_LE(v); g_byte_array_append(a, (const guint8 *)&v, 8); }
+
+/**
+ * @brief Converts a timestamp to the MS-DOS date and time the zip format uses
+ * (local time, two-second steps, years 1980 to 2107).
+ */
+static void dos_date_time(time_t t, guint16 *dos_time, guint16 *dos_date) {
+    struct tm tm;
+    localtime_r(&t, &tm);
+    if (tm.tm_year < 80) { *dos_date = (1 << 5) | 1; *dos_time = 0; return; }
+    *dos_date = (MIN(tm.tm_year - 80, 127) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday;
+    *dos_time = (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2);
+}
+
+static void local_header(GByteArray *h, const ZipEntry *e) {
+    gsize name_len = strlen(e->name);
+    put32(h, SIG_LOCAL_HEADER);
+    put16(h, e->zip64 ? 45 : 20);          // Version needed to extract: 4.5 for ZIP64.
+    put16(h, FLAG_UTF8_NAME | (e->descriptor ? FLAG_DATA_DESCRIPTOR : 0));
+    put16(h, e->method);
+    put16(h, e->dos_time);
+    put16(h, e->dos_date);
+    // With a data descriptor, the CRC and sizes here are 0: the descriptor has them.
+    guint32 crc = e->descriptor ? 0 : e->presized ? e->presized_crc : e->crc;
+    guint64 size = e->descriptor ? 0 : e->presized ? e->presized_size : e->size;
+    guint64 compressed_size = e->descriptor ? 0 : e->presized ? e->presized_size : e->compressed_size;
+    put32(h, crc);
+    put32(h, e->zip64 ? ZIP32_MAX : compressed_size);
+    put32(h, e->zip64 ? ZIP32_MAX : size);
+    put16(h, name_len);
+    put16(h, e->zip64 ? 20 : 0);
+    g_byte_array_append(h, (const guint8 *)e->name, name_len);
+    if (e->zip64) {
+        put16(h, 0x0001);                  // The ZIP64 extra field.
+        put16(h, 16);
+        put64(h, size);
+        put64(h, compressed_size);
+    }
+}
+
+static void central_header(GByteArray *h, const ZipEntry *e) {
+    gsize name_len = strlen(e->name);
+    gboolean big_offset = e->header_offset >= ZIP32_MAX;
+    // The ZIP64 extra field holds exactly the values whose classic fields say 0xFFFFFFFF.
+    guint16 extra_len = (e->zip64 ? 16 : 0) + (big_offset ? 8 : 0);
+    guint16 version = (e->zip64 || big_offset) ? 45 : 20;
+    put32(h, SIG_CENTRAL_HEADER);
+    put16(h, MADE_BY_UNIX | version);
+    put16(h, version);
+    put16(h, FLAG_UTF8_NAME | (e->descriptor ? FLAG_DATA_DESCRIPTOR : 0));
+    put16(h, e->method);
+    put16(h, e->dos_time);
+    put16(h, e->dos_date);
+    put32(h, e->crc);
+    put32(h, e->zip64 ? ZIP32_MAX : e->compressed_size);
+    put32(h, e->zip64 ? ZIP32_MAX : e->size);
+    put16(h, name_len);
+    put16(h, extra_len ? extra_len + 4 : 0);
+    put16(h, 0);                           // Comment length.
+    put16(h, 0);                           // Disk number.
+    put16(h, 0);                           // Internal attributes.
+    // External attributes: Unix mode in the high half, MS-DOS "directory" bit in the low half.
+    put32(h, (e->mode << 16) | (e->is_dir ? 0x10 : 0));
+    put32(h, big_offset ? ZIP32_MAX : e->header_offset);
+    g_byte_array_append(h, (const guint8 *)e->name, name_len);
+    if (extra_len) {
+        put16(h, 0x0001);
+        put16(h, extra_len);
+        if (e->zip64) { put64(h, e->size); put64(h, e->compressed_size); }
+        if (big_offset) put64(h, e->header_offset);
+    }
+}
+
+/**
+ * @brief The data descriptor that follows a streamed file's data. Its sizes are 8 bytes long
+ * when the local header has a ZIP64 extra field, as the specification requires.
+ */
+static void data_descriptor(GByteArray *h, const ZipEntry *e) {
+    put32(h, SIG_DATA_DESCRIPTOR);
+    put32(h, e->crc);
+    if (e->zip64) {
+        put64(h, e->compressed_size);
+        put64(h, e->size);
+    } else {
+        put32(h, e->compressed_size);
+        put32(h, e->size);
+    }
+}
+
+/**
+ * @brief Writes one finished block, with its entry's local header before the first block.
+ * After the last block, the header is written again with the final CRC and sizes (or, when
+ * streaming, a data descriptor follows the data), and the entry's central directory record is
+ * set aside for the end of the archive.
+ */
+static gboolean write_block(ZipWriter *zw, ZipBlock *b) {
+    if (b->failed) return FALSE;
+    ZipEntry *e = b->entry;
+    if (e->copied) {
+        if (b->last) zw->stats.bytes_in += e->size;
+    } else {
+        // The CRC of the whole file is built from the CRCs of its blocks.
+        e->crc = crc32_combine(e->crc, b->crc, b->len);
+        e->compressed_size += b->out_len;
+        e->size += b->len;
+        zw->stats.bytes_in += b->len;
+        if (e->method == METHOD_STORE) zw->stats.bytes_stored += b->len;
+        else zw->bytes_deflated += b->len;
+        zw->stats.cpu_seconds += b->cpu_ns / 1e9;
+    }
+    if (b->first) {
+        // A file that fits in one block is complete by now, so even a streamed one gets its
+        // real CRC and sizes in the header. Only bigger files need a data descriptor.
+        if (zw->streaming && !e->is_dir && !e->copied) e->descriptor = !b->last && !e->presized;
+        e->header_offset = zw->offset;
+        GByteArray *h = g_byte_array_new();
+        local_header(h, e);
+        gboolean ok = write_full(zw->fd, h->data, h->len);
+        zw->offset += h->len;
+        g_byte_array_free(h, TRUE);
+        if (!ok) return FALSE;
+    }
+    if (b->out_len > 0 && !write_full(zw->fd, b->out, b->out_len)) return FALSE;
+    zw->offset += b->out_len;
+    zw->stats.bytes_out += b->out_len;
+    if (b->last) {
+        // The header already went out; if the file changed since, the archive would be wrong.
+        if (e->presized && (e->crc != e->presized_crc || e->size != e->presized_size)) return FALSE;
+        GByteArray *h = g_byte_array_new();
+        gboolean ok = TRUE;
+        if (e->descriptor) {
+            data_descriptor(h, e);
+            ok = write_full(zw->fd, h->data, h->len);
+            zw->offset += h->len;
+            g_byte_array_set_size(h, 0);
+        } else if (!e->is_dir && !b->first && !zw->streaming) {
+            // (A header written together with the last block was final already.)
+            local_header(h, e);
+            ok = pwrite(zw->fd, h->data, h->len, e->header_offset) == (gssize)h->len;
+            g_byte_array_set_size(h, 0);
+        }
+        central_header(h, e);
+        ok = ok && fwrite(h->data, 1, h->len, zw->central) == h->len;
+        g_byte_array_free(h, TRUE);
+        if (!ok) return FALSE;
+        zw->entry_count++;
+        if (e->copied) zw->stats.files_reused++;
+        else if (!e->is_dir && e->method == METHOD_STORE) zw->stats.files_stored++;
+        op_progress_add(zw->progress, 0, 1);
+    }
+    return TRUE;
+}
+
+/**
+ * @brief Writes the finished blocks at the front of the queue. While more than
+ * `max_pending` blocks are still queued, it also waits for the front one.
+ */
+static gboolean write_ready(ZipWriter *zw, guint max_pending) {
+    while (!g_queue_is_empty(&zw->pending)) {
+        ZipBlock *b = g_queue_peek_head(&zw->pending);
+        g_mutex_lock(&zw->lock);
+        if (!b->done && zw->pending.length <= max_pending) {
+            g_mutex_unlock(&zw->lock);
+            break;
+        }
+        while (!b->done) g_cond_wait(&zw->cond, &zw->lock);
+        g_mutex_unlock(&zw->lock);
+
+        g_queue_pop_head(&zw->pending);
+        gboolean ok = write_block(zw, b);
+        block_free(b);
+        if (!ok) {
+            zw->failed = TRUE;
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * @brief Queues a block (after making room for it) and hands it to the pool if it has data.
+ */
+static gboolean submit(ZipWriter *zw, ZipBlock *b) {
+    if (!write_ready(zw, zw->max_pending - 1)) {
+        block_free(b);
+        return FALSE;
+    }
+    g_queue_push_tail(&zw->pending, b);
+    if (!b->entry->is_dir) g_thread_pool_push(zw->pool, b, NULL);
+    else b->done = TRUE;    // Nothing to compress; no worker ever sees this block.
+    return TRUE;
+}
+
+static ZipEntry* entry_new(int fd, const gchar *zip_name, const struct stat *st, gboolean is_dir) {
+    ZipEntry *e = g_new0(ZipEntry, 1);
+    e->fd = fd;
+    e->refs = 1;            // The caller's reference, held while it queues the blocks.
+    e->name = is_dir ? g_strconcat(zip_name, "/", NULL) : g_strdup(zip_name);
+    e->is_dir = is_dir;
+    e->method = is_dir ? METHOD_STORE : METHOD_DEFLATE;
+    e->mode = (is_dir ? S_IFDIR : S_IFREG) | (st->st_mode & 07777);
+    dos_date_time(st->st_mtime, &e->dos_time, &e->dos_date);
+    return e;
+}
+
+// Extensions of formats whose data is compressed already. Compared without regard to case.
+static const gchar *incompressible_extensions[] = {
+    "jpg", "jpeg", "png", "gif", "webp", "heic", "heif", "avif", "jxl",
+    "mp3", "m4a", "aac", "ogg", "oga", "opus", "flac", "wma",
+    "mp4", "m4v", "mov", "mkv", "webm", "avi", "wmv", "flv",
+    "zip", "gz", "tgz", "bz2", "tbz2", "xz", "txz", "zst", "lz4", "lzma", "7z", "rar", "cab",
+    "jar", "apk", "ipa", "deb", "rpm", "dmg", "docx", "xlsx", "pptx", "odt", "ods", "odp", "epub",
+    "woff", "woff2",
+};
+
+static gboolean has_incompressible_extension(const gchar *name) {
+    const gchar *dot = strrchr(name, '.');
+    if (!dot) return FALSE;
+    for (gsize i = 0; i < G_N_ELEMENTS(incompressible_extensions); i++)
+        if (g_ascii_strcasecmp(dot + 1, incompressible_extensions[i]) == 0) return TRUE;
+    return FALSE;
+}
+
+/**
+ * @brief Estimates whether a file's data is already compressed, from a few samples of it.
+ * The Shannon entropy of the byte values says how many bits per byte an ideal coder would
+ * need; when that is close to 8, deflate cannot shrink the data.
+ */
+static gboolean looks_incompressible(int fd, guint64 size) {
+    if (size < SAMPLE_COUNT * SAMPLE_SIZE) return FALSE;
+    guint64 counts[256] = {0};
+    guchar *buf = g_malloc(SAMPLE_SIZE);
+    gboolean ok = TRUE;
+    for (int i = 0; i < SAMPLE_COUNT && ok; i++) {
+        ok = pread_full(fd, buf, SAMPLE_SIZE, (size - SAMPLE_SIZE) * i / (SAMPLE_COUNT - 1));
+        for (gsize j = 0; ok && j < SAMPLE_SIZE; j++) counts[buf[j]]++;
+    }
+    g_free(buf);
+    if (!ok) return FALSE;  // The compressing worker will run into the problem and report it.
+    gdouble total = SAMPLE_COUNT * SAMPLE_SIZE, entropy = 0;
+    for (int v = 0; v < 256; v++) {
+        if (counts[v] == 0) continue;
+        gdouble p = counts[v] / total;
+        entropy -= p * log2(p);
+    }
+    return entropy > STORE_ENTROPY;
+}
+
+/**
+ * @brief Sets up a writer for the open archive `fd`. Takes ownership of `tmp_path`.
+ */
+static ZipWriter* writer_new(int fd, const gchar *path, gchar *tmp_path, int threads, int level, OpProgress *progress) {
+    // tmpfile() files have no name, so they disappear by themselves when closed.
+    FILE *central = tmpfile();
+    if (!central) return NULL;
+
+    ZipWriter *zw = g_new0(ZipWriter, 1);
+    zw->path = g_strdup(path);
+    zw->tmp_path = tmp_path;
+    zw->fd = fd;
+    zw->streaming = (tmp_path == NULL);
+    zw->central = central;
+    zw->level = level;
+    zw->whole = zip_deflate_best();
+    zw->progress = progress;
+    g_queue_init(&zw->pending);
+    g_mutex_init(&zw->lock);
+    g_cond_init(&zw->cond);
+    if (threads <= 0) threads = g_get_num_processors();
+    zw->max_pending = threads * BLOCKS_PER_THREAD;
+    zw->pool = g_thread_pool_new(zip_worker, zw, threads, FALSE, NULL);
+    return zw;
+}
+
+ZipWriter* zip_writer_new(const gchar *path, int threads, int level, OpProgress *progress) {
+    gchar *tmp_path = g_strconcat(path, ".XXXXXX", NULL);
+    int fd = g_mkstemp_full(tmp_path, O_RDWR | O_CLOEXEC, 0644);
+    if (fd == -1) { g_free(tmp_path); return NULL; }
+    ZipWriter *zw = writer_new(fd, path, tmp_path, threads, level, progress);
+    if (!zw) { close(fd); unlink(tmp_path); g_free(tmp_path); }
+    return zw;
+}
+
+ZipWriter* zip_writer_new_for_fd(int fd, int threads, int level, OpProgress *progress) {
+    return writer_new(fd, NULL, NULL, threads, level, progress);
+}
+
+void zip_writer_set_previous(ZipWriter *zw, ZipIndex *previous) {
+    zw->previous = previous;
+}
+
+/**
+ * @brief Reads the first `size` bytes of a file and computes their CRC-32.
+ */
+static gboolean file_crc(ZipWriter *zw, int fd, guint64 size, guint32 *crc) {
+    guchar *buf = g_malloc(ZIP_BLOCK_SIZE);
+    gboolean ok = TRUE;
+    *crc = 0;
+    for (guint64 offset = 0; ok && offset < size; offset += ZIP_BLOCK_SIZE) {
+        gsize n = MIN(size - offset, ZIP_BLOCK_SIZE);
+        ok = pread_full(fd, buf, n, offset) && !op_progress_is_cancelled(zw->progress);
+        if (ok) *crc = zip_crc32(*crc, buf, n);
+    }
+    g_free(buf);
+    return ok;
+}
+
+/**
+ * @brief Checks whether a file is unchanged since the previous archive: same size and
+ * modification time (as far as MS-DOS time can tell) and, to be sure, the same CRC-32.
+ */
+static gboolean is_unchanged(ZipWriter *zw, const ZipEntry *e, const struct stat *st, ZipMemberData *old) {
+    if (!zw->previous || !zip_index_find_member(zw->previous, e->name, old)) return FALSE;
+    if (old->size != (guint64)st->st_size || old->dos_time != e->dos_time || old->dos_date != e->dos_date) return FALSE;
+    guint32 crc;
+    return file_crc(zw, e->fd, old->size, &crc) && crc == old->crc;
+}
+
+/**
+ * @brief Queues the blocks of a file or of an unchanged file's compressed data in the
+ * previous archive. `size` is the number of bytes to go through the blocks.
+ */
+static gboolean queue_blocks(ZipWriter *zw, ZipEntry *e, guint64 size) {
+    guint64 offset = 0;
+    gboolean ok = TRUE;
+    // An empty file still gets one (empty) block, which carries its header.
+    do {
+        ZipBlock *b = g_new0(ZipBlock, 1);
+        b->entry = e;
+        e->refs++;
+        b->offset = offset;
+        b->len = MIN(size - offset, ZIP_BLOCK_SIZE);
+        b->first = (offset == 0);
+        offset += b->len;
+        b->last = (offset == size);
+        ok = submit(zw, b);
+    } while (ok && offset < size);
+    entry_unref(e);
+    return ok;
+}
+
+gboolean zip_writer_add_dir(ZipWriter *zw, const gchar *zip_name, const struct stat *st) {
+    if (zw->failed) return FALSE;
+    ZipBlock *b = g_new0(ZipBlock, 1);
+    b->entry = entry_new(-1, zip_name, st, TRUE);   // The block takes over our reference.
+    b->first = b->last = TRUE;
+    return submit(zw, b);
+}
+
+gboolean zip_writer_add_file(ZipWriter *zw, int dir_fd, const gchar *name, const gchar *zip_name, const struct stat *st) {
+    if (zw->failed) return FALSE;
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return FALSE;
+    ZipEntry *e = entry_new(fd, zip_name, st, FALSE);
+    ZipMemberData old;
+    if (is_unchanged(zw, e, st, &old)) {
+        // The file itself isn't needed any more: its data comes from the previous archive.
+        close(e->fd);
+        e->fd = -1;
+        e->copied = TRUE;
+        e->copy_fd = old.fd;
+        e->copy_offset = old.data_offset;
+        e->method = old.method;
+        e->crc = old.crc;
+        e->size = old.size;
+        e->compressed_size = old.compressed_size;
+        e->zip64 = (MAX(old.size, old.compressed_size) >= ZIP64_FILE_LIMIT);
+        op_progress_add(zw->progress, old.size, 0);
+        return queue_blocks(zw, e, old.compressed_size);
+    }
+    e->zip64 = ((guint64)st->st_size >= ZIP64_FILE_LIMIT);
+    if (zw->level == ZIP_LEVEL_STORE || has_incompressible_extension(name) || looks_incompressible(fd, st->st_size))
+        e->method = METHOD_STORE;
+    // Readers that go through a stream front to back can't tell where stored data ends unless
+    // its header says so. A deflated file ends by itself, so it can use a data descriptor;
+    // a stored one gets a pass over it first (fast: CRC-32 runs at memory speed) instead.
+    if (zw->streaming && e->method == METHOD_STORE && (guint64)st->st_size > ZIP_BLOCK_SIZE) {
+        if (!file_crc(zw, fd, st->st_size, &e->presized_crc)) {
+            entry_unref(e);
+            return FALSE;
+        }
+        e->presized = TRUE;
+        e->presized_size = st->st_size;
+    }
+    return queue_blocks(zw, e, st->st_size);
+}
+
+/**
+ * @brief Writes the central directory (the archive's table of contents) and the end records.
+ */
+static gboolean write_central_directory(ZipWriter *zw) {
+    // Append the records collected so far.
+    guint64 cd_offset = zw->offset, cd_size = 0;
+    guchar buf[65536];
+    gsize n;
+    if (fflush(zw->central) != 0 || fseek(zw->central, 0, SEEK_SET) != 0) return FALSE;
+    while ((n = fread(buf, 1, sizeof(buf), zw->central)) > 0) {
+        if (!write_full(zw->fd, buf, n)) return FALSE;
+        cd_size += n;
+    }
+    if (ferror(zw->central)) return FALSE;
+    guint64 count = zw->entry_count;
+
+    GByteArray *h = g_byte_array_new();
+    if (count >= 0xFFFF || cd_offset >= ZIP32_MAX || cd_size >= ZIP32_MAX) {
+        guint64 zip64_end_offset = cd_offset + cd_size;
+        put32(h, SIG_ZIP64_END);
+        put64(h, 44);                      // Size of the rest of this record.
+        put16(h, MADE_BY_UNIX | 45);
+        put16(h, 45);
+        put32(h, 0);                       // This disk, and the disk the directory starts on.
+        put32(h, 0);
+        put64(h, count);
+        put64(h, count);
+        put64(h, cd_size);
+        put64(h, cd_offset);
+        put32(h, SIG_ZIP64_LOCATOR);
+        put32(h, 0);
+        put64(h, zip64_end_offset);
+        put32(h, 1);                       // Total number of disks.
+    }
+    // The classic end record; values that don't fit are 0xFFFF... and live in the ZIP64 record.
+    put32(h, SIG_END);
+    put16(h, 0);
+    put16(h, 0);
+    put16(h, MIN(count, 0xFFFF));
+    put16(h, MIN(count, 0xFFFF));
+    put32(h, MIN(cd_size, ZIP32_MAX));
+    put32(h, MIN(cd_offset, ZIP32_MAX));
+    put16(h, 0);                           // Comment length.
+    gboolean ok = write_full(zw->fd, h->data, h->len);
+    g_byte_array_free(h, TRUE);
+    return ok;
+}
+
+/**
+ * @brief Stops the workers and frees everything, deleting the temporary file if it is still there.
+ */
+static void zip_writer_free(ZipWriter *zw) {
+    // Blocks still waiting in the pool are dropped; running ones are waited for.
+    g_thread_pool_free(zw->pool, TRUE, TRUE);
+    ZipBlock *b;
+    while ((b = g_queue_pop_head(&zw->pending)) != NULL) block_free(b);
+    fclose(zw->central);
+    // A stream's descriptor belongs to the caller; what was sent can't be taken back.
+    if (zw->fd != -1 && !zw->streaming) {
+        close(zw->fd);
+        unlink(zw->tmp_path);
+    }
+    g_mutex_clear(&zw->lock);
+    g_cond_clear(&zw->cond);
+    g_free(zw->path);
+    g_free(zw->tmp_path);
+    g_free(zw);
+}
+
+gboolean zip_writer_finish(ZipWriter *zw, ZipStats *stats) {
+    gboolean ok = !zw->failed && write_ready(zw, 0) && !op_progress_is_cancelled(zw->progress)
+                  && write_central_directory(zw);
+    if (stats) {
+        *stats = zw->stats;
+        // Assume the stored bytes would have cost as much CPU per byte as the deflated ones did.
+        if (zw->bytes_deflated > 0)
+            stats->cpu_seconds_saved = zw->stats.cpu_seconds * zw->stats.bytes_stored / zw->bytes_deflated;
+    }
+    if (ok && !zw->streaming) {
+        ok = (close(zw->fd) == 0);
+        zw->fd = -1;
+        // Only a complete archive ever appears under the real name.
+        if (ok) ok = (rename(zw->tmp_path, zw->path) == 0);
+        if (!ok) unlink(zw->tmp_path);
+    }
+    zip_writer_free(zw);
+    return ok;
+}
+
+void zip_writer_discard(ZipWriter *zw) {
+    zip_writer_free(zw);
+}
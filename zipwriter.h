@@ -0,0 +1,82 @@
+/**
+ * @file zipwriter.h
+ * @brief Writing .zip archives with every CPU core compressing at once.
+ *
+ * Compression is the slow part of zipping, and one deflate stream can only use one core.
+ * So every file is cut into blocks of ZIP_BLOCK_SIZE bytes and a pool of worker threads
+ * deflates the blocks at the same time. The calling thread writes the finished blocks to the
+ * archive strictly in order, and stitches each file's blocks back into one valid deflate
+ * stream: every block but the last ends on a byte boundary (a "sync flush"), and each block is
+ * compressed with the 32 KiB of data before it as its dictionary, so the compression ratio
+ * stays close to that of a single stream (this is the trick pigz uses). The CRC-32 of a file is
+ * put together from the CRCs of its blocks.
+ *
+ * Sizes and CRCs are only known after the last block of a file, so the local header of a file
+ * bigger than one block is written first with what is known and filled in afterwards. Archives
+ * and files over 4 GiB get ZIP64 records.
+ *
+ * An archive can also be streamed to a pipe or socket, which can't go back to fill anything in.
+ * Then the header of every file bigger than one block says "see the data descriptor", and a
+ * small descriptor record with the CRC and sizes follows the file's data instead. Unzip tools
+ * read those archives just the same. Nothing else changes: the central directory still builds
+ * up in a temporary file, so memory stays the same whatever the archive's size, and the workers
+ * keep compressing the next blocks while the writing thread waits for the reader to take the
+ * last ones.
+ *
+ * Files whose data is already compressed are stored as they are instead of deflated. They are
+ * recognised by their extension (".jpg", ".mp4", ".zip"...) or, failing that, by sampling a
+ * few pieces of the file: data whose bytes are spread almost evenly over all 256 values (high
+ * "entropy") has no redundancy left for deflate to remove.
+ */
+
+#ifndef ZIPWRITER_H
+#define ZIPWRITER_H
+
+#include <glib.h>
+#include <sys/stat.h>
+#include "backend.h"
+#include "zipreader.h"
+
+// Bytes of a file compressed per task.
+#define ZIP_BLOCK_SIZE (1024 * 1024)
+
+typedef struct ZipWriter ZipWriter;
+
+// Starts a new archive at `path` with `threads` compressing threads (0 means one per CPU).
+// `level` is a deflate level from 1 to 9, 0 for the default, or ZIP_LEVEL_STORE to store every
+// file uncompressed. The archive is written to a temporary file next to `path` and only
+// appears under its name in zip_writer_finish(). Returns NULL if the temporary file can't be
+// created.
+ZipWriter* zip_writer_new(const gchar *path, int threads, int level, OpProgress *progress);
+
+// Starts a new archive streamed to the open file descriptor `fd`, which may be a pipe or a
+// socket: it is only ever written to in order, never seeked. The caller keeps ownership of
+// `fd`. A failed or cancelled stream just stops, leaving the reader with an incomplete archive
+// (its table of contents comes last). Writing to a pipe whose reader has gone away raises
+// SIGPIPE unless the program ignores it. Returns NULL if the writer can't be set up.
+ZipWriter* zip_writer_new_for_fd(int fd, int threads, int level, OpProgress *progress);
+
+// Makes the writer copy the compressed data of files that are unchanged since `previous`
+// (an earlier version of the archive) instead of compressing them again. A file counts as
+// unchanged if its size, modification time and CRC-32 all match. `previous` must stay open
+// until the writer is finished.
+void zip_writer_set_previous(ZipWriter *zw, ZipIndex *previous);
+
+// Adds a folder entry. `zip_name` is its path inside the archive, without a trailing "/".
+gboolean zip_writer_add_dir(ZipWriter *zw, const gchar *zip_name, const struct stat *st);
+
+// Adds the file `name` inside the open directory `dir_fd` (symlinks are followed) under the
+// path `zip_name`. `st` is the file's metadata; its size decides how much is read.
+// Returns as soon as the file's blocks are queued, so the file may still be being compressed.
+gboolean zip_writer_add_file(ZipWriter *zw, int dir_fd, const gchar *name, const gchar *zip_name, const struct stat *st);
+
+// Waits for all blocks, writes the archive's table of contents and moves it into place
+// (a streamed archive is complete once its table of contents is written).
+// Fills in `stats` (if not NULL) and frees the writer. Returns FALSE (leaving no archive
+// behind) if anything failed or the progress was cancelled.
+gboolean zip_writer_finish(ZipWriter *zw, ZipStats *stats);
+
+// Stops, throws the temporary file away (if any) and frees the writer.
+void zip_writer_discard(ZipWriter *zw);
+
+#endif // ZIPWRITER_H